@@ -0,0 +1,257 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * gentree: Builds a deterministic synthetic hierarchy for benchmarking.  The
+ * same shape, entry count and seed always produce the same names, sizes,
+ * modes, mtimes and link targets, so results are comparable between builds
+ * and machines.  File sizes are set with ftruncate() so the trees are sparse.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define STAMP	".gentree"
+#define BASETIME 1600000000
+
+enum { WIDE, DEEP, SYMLINKS, GITIGNORE, UNICODE };
+
+static char *shapes[] = { "wide", "deep", "symlinks", "gitignore", "unicode", NULL };
+
+static uint64_t seed = 0x9E3779B97F4A7C15ULL;
+static long made, limit, seq;
+static int shape;
+
+static char *exts[] = {
+  ".c", ".h", ".o", ".txt", ".log", ".md", ".json", ".tar.gz", ".tmp", "", NULL
+};
+static char *uwords[] = {
+  "r\xc3\xa9sum\xc3\xa9", "na\xc3\xafve", "\xd1\x84\xd0\xb0\xd0\xb9\xd0\xbb",
+  "\xce\xb1\xcf\x81\xcf\x87\xce\xb5\xce\xaf\xce\xbf",
+  "\xe3\x83\x95\xe3\x82\xa1\xe3\x82\xa4\xe3\x83\xab", "\xe6\x96\x87\xe4\xbb\xb6",
+  "\xed\x8c\x8c\xec\x9d\xbc", "\xd7\xa7\xd7\x95\xd7\x91\xd7\xa5",
+  "\xf0\x9f\x93\x81", "caf\xc3\xa9 cr\xc3\xa8me", NULL
+};
+static char *ignores[] = {
+  "*.o", "*.tmp", "build/", "!keep.o", "/cache", "**/gen/*", "d00[13579]*",
+  "*.log", "!important.log", "f*[02468].md", "docs/**/draft", "#comment",
+  "*.tar.gz", "out?/", NULL
+};
+
+static uint64_t rnd(void)
+{
+  seed ^= seed >> 12;
+  seed ^= seed << 25;
+  seed ^= seed >> 27;
+  return seed * 0x2545F4914F6CDD1DULL;
+}
+
+static int pick(int n)
+{
+  return (int)(rnd() % (uint64_t)n);
+}
+
+static int count(char **list)
+{
+  int n;
+  for(n=0; list[n]; n++);
+  return n;
+}
+
+static void die(char *what, char *path)
+{
+  fprintf(stderr,"gentree: %s: %s: %s\n", what, path, strerror(errno));
+  exit(1);
+}
+
+static void setmtime(char *path)
+{
+  struct timeval tv[2];
+
+  tv[0].tv_sec = tv[1].tv_sec = BASETIME - pick(3*365*86400);
+  tv[0].tv_usec = tv[1].tv_usec = 0;
+  if (lutimes(path, tv) < 0) die("lutimes", path);
+}
+
+static void name(char *buf, char *dir, char kind)
+{
+  long i = seq++;
+
+  if (shape == UNICODE)
+    sprintf(buf, "%s/%s %c%05ld%s", dir, uwords[pick(count(uwords))], kind, i, kind == 'd'? "" : exts[pick(count(exts))]);
+  else
+    sprintf(buf, "%s/%c%05ld%s", dir, kind, i, kind == 'd'? "" : exts[pick(count(exts))]);
+}
+
+/**
+ * Sizes are mostly small with a long tail, roughly like a source tree.
+ */
+static void mkfile(char *path)
+{
+  int fd;
+  off_t size = pick(8) ? pick(1 << (pick(16)+1)) : (off_t)pick(1 << 28);
+
+  if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, pick(10)? 0644 : 0755)) < 0) die("open", path);
+  if (ftruncate(fd, size) < 0) die("ftruncate", path);
+  close(fd);
+  setmtime(path);
+  made++;
+}
+
+static void mkignore(char *dir)
+{
+  char path[PATH_MAX];
+  FILE *fp;
+  int i, n = 4 + pick(count(ignores));
+
+  sprintf(path, "%s/.gitignore", dir);
+  if ((fp = fopen(path, "w")) == NULL) die("fopen", path);
+  for(i=0; i < n; i++) fprintf(fp, "%s\n", ignores[pick(count(ignores))]);
+  fclose(fp);
+  setmtime(path);
+}
+
+/**
+ * Symlinks point back at siblings, at the parent, at nothing or at an
+ * ancestor (a loop for -l).
+ */
+static void mklink(char *dir, char *sibling)
+{
+  char path[PATH_MAX], *target;
+  int r = pick(20);
+
+  sprintf(path, "%s/l%05ld", dir, seq++);
+  if (r == 0) target = "nowhere";
+  else if (r == 1) target = "..";
+  else if (r == 2) target = "../..";
+  else target = sibling? strrchr(sibling, '/')+1 : ".";
+  if (symlink(target, path) < 0) die("symlink", path);
+  setmtime(path);
+  made++;
+}
+
+/**
+ * Fills dir with up to nfiles entries and ndirs subdirectories, then recurses
+ * until depth runs out or the entry limit is reached.
+ */
+static void fill(char *dir, int depth, int ndirs, int nfiles)
+{
+  char path[PATH_MAX], last[PATH_MAX];
+  long i, n;
+
+  *last = 0;
+  if (shape == GITIGNORE) mkignore(dir);
+  for(i=0; i < nfiles && made < limit; i++) {
+    if (shape == SYMLINKS && *last && pick(3) == 0) mklink(dir, last);
+    else {
+      name(path, dir, 'f');
+      mkfile(path);
+      strcpy(last, path);
+    }
+  }
+  if (depth <= 0) return;
+  for(i=0, n=ndirs; i < n && made < limit; i++) {
+    name(path, dir, 'd');
+    if (mkdir(path, pick(10)? 0755 : 0700) < 0) die("mkdir", path);
+    made++;
+    switch(shape) {
+      case DEEP:
+	fill(path, depth-1, i? 1 : 2, 3);
+	break;
+      default:
+	fill(path, depth-1, ndirs, nfiles);
+    }
+    setmtime(path);
+  }
+}
+
+static void usage(void)
+{
+  fprintf(stderr,"usage: gentree [-s wide|deep|symlinks|gitignore|unicode] [-n entries] [-S seed] dir\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  char stamp[PATH_MAX], want[256], have[256], *dir;
+  unsigned long s = 1;
+  FILE *fp;
+  int c, i;
+
+  limit = 100000;
+  while ((c = getopt(argc, argv, "s:n:S:")) != -1) {
+    switch(c) {
+      case 's':
+	for(i=0; shapes[i] && strcmp(shapes[i], optarg); i++);
+	if (!shapes[i]) usage();
+	shape = i;
+	break;
+      case 'n':
+	limit = atol(optarg);
+	break;
+      case 'S':
+	s = strtoul(optarg, NULL, 0);
+	break;
+      default:
+	usage();
+    }
+  }
+  if (optind != argc-1 || limit <= 0) usage();
+  dir = argv[optind];
+  seed ^= s * 0xBF58476D1CE4E5B9ULL;
+
+  /* Don't rebuild a tree that already matches: */
+  sprintf(want, "%s %ld %lu\n", shapes[shape], limit, s);
+  snprintf(stamp, PATH_MAX, "%s/%s", dir, STAMP);
+  if ((fp = fopen(stamp, "r")) != NULL) {
+    if (fgets(have, sizeof(have), fp) && !strcmp(have, want)) return 0;
+    fclose(fp);
+    fprintf(stderr,"gentree: %s exists and differs, remove it first.\n", dir);
+    return 1;
+  }
+  if (mkdir(dir, 0755) < 0) die("mkdir", dir);
+
+  switch(shape) {
+    case WIDE:
+      /* A few levels of very large directories: */
+      fill(dir, 2, 8, (int)(limit/73 > 1? limit/73 : 1));
+      break;
+    case DEEP:
+      /* Long chains with a side branch at each level: */
+      while (made < limit) fill(dir, 96, 2, 3);
+      break;
+    default:
+      /* Something resembling a source tree: */
+      while (made < limit) fill(dir, 6, 4, 24);
+      break;
+  }
+
+  if ((fp = fopen(stamp, "w")) == NULL) die("fopen", stamp);
+  fputs(want, fp);
+  fclose(fp);
+  return 0;
+}
@@ -0,0 +1,473 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * treebench: Micro and end to end benchmarks, linked against tree's own
+ * objects (tree.c built with -DTREE_NO_MAIN).  File system calls are counted
+ * by wrapping them at link time (see BENCH_WRAP in the Makefile), output is
+ * written to a counting sink instead of a terminal.  Each case is run -i
+ * times and the fastest run is reported.
+ */
+#include "../tree.h"
+
+#include <stdarg.h>
+
+extern bool Fflag, fflag, Hflag, Rflag, duflag, pruneflag, Jflag, Xflag;
+extern bool noindent, noreport;
+extern char *host, *sp, *_nl;
+extern const char *charset;
+extern _Thread_local FILE *outfile;
+extern int mb_cur_max;
+extern _Atomic int errors;
+extern _Thread_local int *dirs, maxdirs;
+extern struct walkopts opts;
+
+/* System call counters, the --wrap'ed symbols forward to the real ones: */
+static u_long ncalls;
+
+DIR *__real_opendir(const char *name);
+int __real_closedir(DIR *d);
+int __real_lstat64(const char *path, struct stat *st);
+int __real_stat64(const char *path, struct stat *st);
+ssize_t __real_readlink(const char *path, char *buf, size_t len);
+int __real_open64(const char *path, int flags, ...);
+int __real_openat64(int dfd, const char *path, int flags, ...);
+int __real_fstatat64(int dfd, const char *path, struct stat *st, int flags);
+ssize_t __real_readlinkat(int dfd, const char *path, char *buf, size_t len);
+int __real_close(int fd);
+
+DIR *__wrap_opendir(const char *name) { ncalls++; return __real_opendir(name); }
+int __wrap_closedir(DIR *d) { ncalls++; return __real_closedir(d); }
+int __wrap_lstat64(const char *path, struct stat *st) { ncalls++; return __real_lstat64(path, st); }
+int __wrap_stat64(const char *path, struct stat *st) { ncalls++; return __real_stat64(path, st); }
+ssize_t __wrap_readlink(const char *path, char *buf, size_t len) { ncalls++; return __real_readlink(path, buf, len); }
+int __wrap_fstatat64(int dfd, const char *path, struct stat *st, int flags) { ncalls++; return __real_fstatat64(dfd, path, st, flags); }
+ssize_t __wrap_readlinkat(int dfd, const char *path, char *buf, size_t len) { ncalls++; return __real_readlinkat(dfd, path, buf, len); }
+int __wrap_close(int fd) { ncalls++; return __real_close(fd); }
+
+/* The mode argument is only there when the open can create a file (O_TMPFILE
+ * includes O_DIRECTORY, so all of its bits have to be set): */
+#ifdef O_TMPFILE
+#define NEEDSMODE(f)	(((f) & O_CREAT) || ((f) & O_TMPFILE) == O_TMPFILE)
+#else
+#define NEEDSMODE(f)	((f) & O_CREAT)
+#endif
+
+int __wrap_open64(const char *path, int flags, ...)
+{
+  va_list ap;
+  int mode = 0;
+
+  if (NEEDSMODE(flags)) {
+    va_start(ap, flags);
+    mode = va_arg(ap, int);
+    va_end(ap);
+  }
+  ncalls++;
+  return __real_open64(path, flags, mode);
+}
+
+int __wrap_openat64(int dfd, const char *path, int flags, ...)
+{
+  va_list ap;
+  int mode = 0;
+
+  if (NEEDSMODE(flags)) {
+    va_start(ap, flags);
+    mode = va_arg(ap, int);
+    va_end(ap);
+  }
+  ncalls++;
+  return __real_openat64(dfd, path, flags, mode);
+}
+
+/* Output goes here, only the byte count is kept: */
+static unsigned long long nbytes;
+
+static ssize_t sink_write(void *cookie, const char *buf, size_t size)
+{
+  nbytes += size;
+  return size;
+}
+
+static FILE *sink;
+
+/* A loaded copy of the tree, for the in-memory benchmarks: */
+struct node {
+  char *path;
+  struct _info **dir;
+  int n;
+};
+static struct node *nodes;
+static int nnodes, maxnodes;
+static char **names;
+static int nnames, maxnames;
+
+static int iterations = 5;
+static char *shape;
+
+/* Captured from the backend's report call: */
+static struct totals seen;
+static void (*realreport)(struct walkopts *w, struct totals tot);
+
+static void capture_report(struct walkopts *w, struct totals tot)
+{
+  seen = tot;
+  realreport(w, tot);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* For benchmarks that make no calls at all: */
+#define NOCALLS	((u_long)-1)
+
+static void result(char *name, double secs, u_long entries, u_long calls, unsigned long long bytes)
+{
+  char rate[32], percall[32];
+
+  if (bytes) sprintf(rate, "%.1f", bytes / secs / (1024*1024));
+  else strcpy(rate, "-");
+  if (calls != NOCALLS) sprintf(percall, "%.2f", entries? (double)calls / entries : 0.0);
+  else strcpy(percall, "-");
+  printf("%-10s %-14s %10lu %12.0f %10s %12s\n", shape, name, entries,
+	 entries / (secs > 0? secs : 1e-9), percall, rate);
+  fflush(stdout);
+}
+
+static void reset_globals(void)
+{
+  Fflag = fflag = Hflag = Rflag = duflag = pruneflag = FALSE;
+  Jflag = Xflag = noindent = noreport = FALSE;
+  host = NULL; sp = " "; _nl = "\n";
+  opts = (struct walkopts){ .level = -1, .basesort = alnumsort, .errors = &errors };
+  memset(dirs, 0, sizeof(int) * maxdirs);
+  errors = 0;
+  outfile = sink;
+}
+
+/**
+ * Loads the whole tree (with -a) into nodes[] and names[].
+ */
+static void load(char *path)
+{
+  struct _info **dir;
+  char *sub;
+  int i, n;
+
+  dir = read_dir(&opts, path, &n, FALSE);
+  if (nnodes == maxnodes) nodes = xrealloc(nodes, sizeof(struct node) * (maxnodes += 1024));
+  nodes[nnodes++] = (struct node){ scopy(path), dir, n };
+  if (!dir) return;
+  for(i=0; i < n; i++) {
+    if (nnames == maxnames) names = xrealloc(names, sizeof(char *) * (maxnames += 4096));
+    names[nnames++] = dir[i]->name;
+    if (dir[i]->isdir && !dir[i]->lnk) {
+      sub = xmalloc(strlen(path) + strlen(dir[i]->name) + 2);
+      sprintf(sub, "%s/%s", path, dir[i]->name);
+      load(sub);
+      free(sub);
+    }
+  }
+}
+
+static void unload(void)
+{
+  int i;
+
+  for(i=0; i < nnodes; i++) {
+    if (nodes[i].dir) free_dir(nodes[i].dir);
+    free(nodes[i].path);
+  }
+  nnodes = nnames = 0;
+}
+
+static u_long walk(char *path)
+{
+  struct _info **dir;
+  char *sub;
+  u_long count;
+  int i, n;
+
+  if ((dir = read_dir(&opts, path, &n, FALSE)) == NULL) return 0;
+  for(count=i=0; i < n; i++) {
+    count++;
+    if (dir[i]->isdir && !dir[i]->lnk) {
+      sub = xmalloc(strlen(path) + strlen(dir[i]->name) + 2);
+      sprintf(sub, "%s/%s", path, dir[i]->name);
+      count += walk(sub);
+      free(sub);
+    }
+  }
+  free_dir(dir);
+  return count;
+}
+
+static void bench_read_dir(char *root)
+{
+  double t, best = 0;
+  u_long entries = 0, calls = 0;
+  int i;
+
+  for(i=0; i < iterations; i++) {
+    reset_globals();
+    opts.aflag = TRUE;
+    ncalls = 0;
+    t = now();
+    entries = walk(root);
+    t = now() - t;
+    calls = ncalls;
+    if (!i || t < best) best = t;
+  }
+  result("read_dir", best, entries, calls, 0);
+}
+
+static void bench_patmatch(void)
+{
+  static char *pats[] = {
+    "*.c", "*.[ch]", "f0*1*", "*.tar.gz|*.tmp|*.log", "[!f]*", "**/d0*", "?0000?*", NULL
+  };
+  double t, best = 0;
+  u_long matches = 0;
+  int i, j, k;
+
+  for(i=0; i < iterations; i++) {
+    t = now();
+    for(j=0; pats[j]; j++)
+      for(k=0; k < nnames; k++) matches += patmatch(names[k], pats[j], FALSE, FALSE) == 1;
+    t = now() - t;
+    if (!i || t < best) best = t;
+  }
+  for(j=0; pats[j]; j++);
+  result("patmatch", best, (u_long)nnames * j, NOCALLS, 0);
+}
+
+static u_long filter_node(int *pos)
+{
+  struct node *nd = &nodes[(*pos)++];
+  struct ignorefile *ig;
+  char *path;
+  u_long count = 0;
+  int i;
+
+  if ((ig = new_ignorefile(nd->path)) != NULL) push_filterstack(ig);
+  for(i=0; nd->dir && i < nd->n; i++) {
+    path = xmalloc(strlen(nd->path) + strlen(nd->dir[i]->name) + 2);
+    sprintf(path, "%s/%s", nd->path, nd->dir[i]->name);
+    filtercheck(&opts, path, nd->dir[i]->name, nd->dir[i]->isdir);
+    free(path);
+    count++;
+    /* load() recursed in the same order: */
+    if (nd->dir[i]->isdir && !nd->dir[i]->lnk) count += filter_node(pos);
+  }
+  if (ig) pop_filterstack();
+  return count;
+}
+
+static void bench_filtercheck(void)
+{
+  double t, best = 0;
+  u_long entries = 0, calls = 0;
+  int i, pos;
+
+  for(i=0; i < iterations; i++) {
+    ncalls = 0;
+    pos = 0;
+    t = now();
+    entries = filter_node(&pos);
+    t = now() - t;
+    calls = ncalls;
+    if (!i || t < best) best = t;
+  }
+  result("filtercheck", best, entries, calls, 0);
+}
+
+static void bench_sort(char *name, int (*cmp)())
+{
+  struct _info **copy = NULL;
+  double t, best = 0;
+  u_long entries = 0;
+  int i, j, max = 0;
+
+  for(i=0; i < nnodes; i++) if (nodes[i].n > max) max = nodes[i].n;
+  copy = xmalloc(sizeof(struct _info *) * (max+1));
+
+  for(i=0; i < iterations; i++) {
+    reset_globals();
+    entries = 0;
+    t = now();
+    for(j=0; j < nnodes; j++) {
+      if (!nodes[j].dir) continue;
+      memcpy(copy, nodes[j].dir, sizeof(struct _info *) * nodes[j].n);
+      sortdir(&opts, copy, nodes[j].n, cmp);
+      entries += nodes[j].n;
+    }
+    t = now() - t;
+    if (!i || t < best) best = t;
+  }
+  free(copy);
+  result(name, best, entries, NOCALLS, 0);
+}
+
+enum { UNIX, JSON, XML, HTML };
+
+static void bench_backend(char *root, char *name, int backend, char *flags)
+{
+  char *dirname[2] = { root, NULL };
+  double t, best = 0;
+  u_long calls = 0;
+  unsigned long long bytes = 0;
+  bool needfulltree;
+  char *f;
+  int i;
+
+  for(i=0; i < iterations; i++) {
+    reset_globals();
+    for(f=flags; f && *f; f++) {
+      switch(*f) {
+	case 'p': opts.pflag = TRUE; break;
+	case 'u': opts.uflag = TRUE; break;
+	case 'g': opts.gflag = TRUE; break;
+	case 's': opts.sflag = TRUE; break;
+	case 'D': opts.Dflag = TRUE; break;
+	case 'a': opts.aflag = TRUE; break;
+	case 'G': opts.gitignore = TRUE; break;
+	case 'U': duflag = opts.sflag = TRUE; break;
+      }
+    }
+    switch(backend) {
+      case UNIX:
+	opts.lc = (struct listingcalls){
+	  null_intro, null_outtro, unix_printinfo, unix_printfile, unix_error, unix_newline,
+	  null_close, unix_report
+	};
+	break;
+      case JSON:
+	Jflag = TRUE;
+	opts.lc = (struct listingcalls){
+	  json_intro, json_outtro, json_printinfo, json_printfile, json_error, json_newline,
+	  json_close, json_report
+	};
+	break;
+      case XML:
+	Xflag = TRUE;
+	opts.lc = (struct listingcalls){
+	  xml_intro, xml_outtro, xml_printinfo, xml_printfile, xml_error, xml_newline,
+	  xml_close, xml_report
+	};
+	break;
+      case HTML:
+	Hflag = TRUE;
+	host = "http://localhost";
+	sp = "&nbsp;";
+	opts.lc = (struct listingcalls){
+	  html_intro, html_outtro, html_printinfo, html_printfile, html_error, html_newline,
+	  html_close, html_report
+	};
+	break;
+    }
+    fields_compile(&opts);
+    unix_compile();
+    realreport = opts.lc.report;
+    opts.lc.report = capture_report;
+    needfulltree = duflag;
+
+    ncalls = 0;
+    nbytes = 0;
+    t = now();
+    emit_tree(&opts, dirname, needfulltree);
+    fflush(outfile);
+    t = now() - t;
+    calls = ncalls;
+    bytes = nbytes;
+    if (!i || t < best) best = t;
+  }
+  result(name, best, seen.files + seen.dirs, calls, bytes);
+}
+
+static void benchusage(void)
+{
+  fprintf(stderr,"usage: treebench [-i iterations] dir...\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  char *root;
+  int c, i;
+
+  while ((c = getopt(argc, argv, "i:")) != -1) {
+    switch(c) {
+      case 'i':
+	if ((iterations = atoi(optarg)) < 1) benchusage();
+	break;
+      default:
+	benchusage();
+    }
+  }
+  if (optind == argc) benchusage();
+
+  dirs = xmalloc(sizeof(int) * (maxdirs=PATH_MAX));
+  setlocale(LC_CTYPE, "");
+  setlocale(LC_COLLATE, "");
+  charset = "UTF-8";
+  initlinedraw(0);
+#ifdef MB_CUR_MAX
+  mb_cur_max = (int)MB_CUR_MAX;
+#else
+  mb_cur_max = 1;
+#endif
+
+  sink = fopencookie(NULL, "w", (cookie_io_functions_t){ NULL, sink_write, NULL, NULL });
+  setvbuf(sink, NULL, _IOFBF, BUFSIZ);
+
+  printf("%-10s %-14s %10s %12s %10s %12s\n", "shape", "benchmark", "entries", "entries/s", "calls/ent", "MiB/s");
+  for(i=optind; i < argc; i++) {
+    root = argv[i];
+    shape = strrchr(root, '/')? strrchr(root, '/')+1 : root;
+
+    bench_read_dir(root);
+
+    reset_globals();
+    opts.aflag = TRUE;
+    load(root);
+    bench_patmatch();
+    bench_filtercheck();
+    bench_sort("sort-name", alnumsort);
+    bench_sort("sort-version", versort);
+    bench_sort("sort-size", fsizesort);
+    bench_sort("sort-mtime", mtimesort);
+    bench_sort("sort-ctime", ctimesort);
+    bench_sort("sort-dirsfirst", dirsfirst);
+    unload();
+
+    bench_backend(root, "unix", UNIX, NULL);
+    bench_backend(root, "unix-pugsD", UNIX, "pugsD");
+    bench_backend(root, "unix-du", UNIX, "U");
+    bench_backend(root, "unix-gitignore", UNIX, "G");
+    bench_backend(root, "json", JSON, NULL);
+    bench_backend(root, "xml", XML, NULL);
+    bench_backend(root, "html", HTML, NULL);
+  }
+  return 0;
+}
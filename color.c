@@ -70,7 +70,7 @@ const struct linedraw *linedraw;
 char **split(char *str, char *delim, int *nwrds);
 int cmd(char *s);
 
-extern FILE *outfile;
+extern _Thread_local FILE *outfile;
 extern bool Hflag, force_color, nocolor;
 extern const char *charset;
 
@@ -0,0 +1,353 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+extern int nthreads;
+extern _Thread_local FILE *outfile;
+
+/**
+ * --compress, or -o file.gz / file.zst: outfile is replaced by a stream that
+ * cuts the output into blocks which a pool of threads compresses, each as a
+ * gzip member or zstd frame of its own (a run of those is still one valid
+ * .gz or .zst file).  Blocks are written out in the order they were cut,
+ * by whichever thread finishes the one due next.  The walk only waits once
+ * twice as many blocks as there are threads are in flight.  compress_finish()
+ * stops and joins the threads.
+ */
+#define CZ_BLOCK	(1024 * 1024)
+
+enum { CZ_NONE, CZ_GZIP, CZ_ZSTD };
+
+static char *cznames[] = { "none", "gzip", "zstd", NULL };
+
+char *compression = NULL;	/* --compress[=method], "" if no method given */
+
+struct czblock {
+  char *in, *out;
+  size_t inlen, outlen, outsize;
+  bool done;
+  struct czblock *next;		/* in order of output */
+  struct czblock *jnext;	/* waiting to be compressed */
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work, room;
+  struct czblock *head, *tail;	/* blocks in flight, in output order */
+  struct czblock *jobs, *jtail;
+  struct czblock *fill, *free;
+  int method, threads, inflight, maxinflight, err;
+  pthread_t *tids;
+  bool writing, any, stop;
+  FILE *realout;
+} cz = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/**
+ * The method for a --compress= argument, exits if it's not one tree knows or
+ * was built with.
+ */
+static int czmethod(char *name)
+{
+  int m;
+
+  for(m = 0; cznames[m]; m++)
+    if (!strcmp(cznames[m], name)) break;
+  if (cznames[m] == NULL) {
+    fprintf(stderr,"tree: unknown compression method for --compress: `%s'\n", name);
+    exit(1);
+  }
+#ifndef HAVE_ZLIB
+  if (m == CZ_GZIP) m = -1;
+#endif
+#ifndef HAVE_ZSTD
+  if (m == CZ_ZSTD) m = -1;
+#endif
+  if (m < 0) {
+    fprintf(stderr,"tree: this tree was built without %s support.\n", name);
+    exit(1);
+  }
+  return m;
+}
+
+/**
+ * The method the name of the -o file asks for.
+ */
+static int czsuffix(char *filename)
+{
+  int len = filename? strlen(filename) : 0;
+
+  if (len > 3 && !strcmp(filename+len-3, ".gz")) return czmethod("gzip");
+  if (len > 4 && !strcmp(filename+len-4, ".zst")) return czmethod("zstd");
+  return CZ_NONE;
+}
+
+static void czcompress(struct czblock *b)
+{
+  size_t bound = b->inlen + b->inlen/8 + 1024;
+#ifdef HAVE_ZLIB
+  z_stream zs;
+#endif
+
+#ifdef HAVE_ZSTD
+  if (cz.method == CZ_ZSTD) bound = ZSTD_compressBound(b->inlen);
+#endif
+  if (bound > b->outsize) {
+    free(b->out);
+    b->out = xmalloc(b->outsize = bound);
+  }
+  b->outlen = 0;
+
+  switch(cz.method) {
+#ifdef HAVE_ZLIB
+    case CZ_GZIP:
+      memset(&zs, 0, sizeof(zs));
+      if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK) break;
+      zs.next_in = (Bytef *)b->in;
+      zs.avail_in = b->inlen;
+      zs.next_out = (Bytef *)b->out;
+      zs.avail_out = b->outsize;
+      if (deflate(&zs, Z_FINISH) == Z_STREAM_END) b->outlen = zs.total_out;
+      deflateEnd(&zs);
+      break;
+#endif
+#ifdef HAVE_ZSTD
+    case CZ_ZSTD:
+      bound = ZSTD_compress(b->out, b->outsize, b->in, b->inlen, 3);
+      if (!ZSTD_isError(bound)) b->outlen = bound;
+      break;
+#endif
+  }
+  if (b->outlen == 0 && b->inlen) {
+    fprintf(stderr,"tree: unable to compress the output.\n");
+    exit(1);
+  }
+}
+
+/**
+ * Marks b compressed and writes out every block at the head that is, unless
+ * another thread is already doing so (the caller holds the lock).
+ */
+static void czdone(struct czblock *b)
+{
+  int err;
+
+  b->done = TRUE;
+  if (cz.writing) return;
+  cz.writing = TRUE;
+  while ((b = cz.head) != NULL && b->done) {
+    if ((cz.head = b->next) == NULL) cz.tail = NULL;
+    err = cz.err;
+    pthread_mutex_unlock(&cz.lock);
+
+    if (!err && fwrite(b->out, 1, b->outlen, cz.realout) != b->outlen) err = errno? errno : EIO;
+
+    pthread_mutex_lock(&cz.lock);
+    if (err) cz.err = err;
+    b->next = cz.free;
+    cz.free = b;
+    cz.inflight--;
+    pthread_cond_broadcast(&cz.room);
+  }
+  cz.writing = FALSE;
+}
+
+static void *czworker(void *arg)
+{
+  struct czblock *b;
+
+  pthread_mutex_lock(&cz.lock);
+  for(;;) {
+    while (cz.jobs == NULL && !cz.stop) pthread_cond_wait(&cz.work, &cz.lock);
+    if (cz.stop) break;
+    b = cz.jobs;
+    if ((cz.jobs = b->jnext) == NULL) cz.jtail = NULL;
+    pthread_mutex_unlock(&cz.lock);
+
+    czcompress(b);
+
+    pthread_mutex_lock(&cz.lock);
+    czdone(b);
+  }
+  pthread_mutex_unlock(&cz.lock);
+  return NULL;
+}
+
+static struct czblock *czblock(void)
+{
+  struct czblock *b;
+
+  pthread_mutex_lock(&cz.lock);
+  if ((b = cz.free) != NULL) cz.free = b->next;
+  pthread_mutex_unlock(&cz.lock);
+  if (b == NULL) {
+    b = xmalloc(sizeof(struct czblock));
+    b->in = xmalloc(CZ_BLOCK);
+    b->out = NULL;
+    b->outsize = 0;
+  }
+  b->inlen = 0;
+  b->done = FALSE;
+  b->next = b->jnext = NULL;
+  return b;
+}
+
+/**
+ * Queues the block being filled for compression, waiting for room first.
+ * Returns 0 or the error that stopped the output.
+ */
+static int czsubmit(void)
+{
+  struct czblock *b = cz.fill;
+  int err;
+
+  cz.fill = NULL;
+  cz.any = TRUE;
+  pthread_mutex_lock(&cz.lock);
+  while (cz.inflight >= cz.maxinflight) pthread_cond_wait(&cz.room, &cz.lock);
+  cz.inflight++;
+  if (cz.tail) cz.tail->next = b;
+  else cz.head = b;
+  cz.tail = b;
+  if (cz.threads) {
+    if (cz.jtail) cz.jtail->jnext = b;
+    else cz.jobs = b;
+    cz.jtail = b;
+    pthread_cond_signal(&cz.work);
+  } else {
+    pthread_mutex_unlock(&cz.lock);
+    czcompress(b);
+    pthread_mutex_lock(&cz.lock);
+    czdone(b);
+  }
+  err = cz.err;
+  pthread_mutex_unlock(&cz.lock);
+  return err;
+}
+
+#ifdef __linux__
+static int failed = 0;	/* cz.err as last seen by the walk */
+
+static ssize_t cz_write(void *cookie, const char *buf, size_t size)
+{
+  size_t n, left = size;
+
+  while (left) {
+    if (failed) {
+      errno = failed;
+      return -1;
+    }
+    if (cz.fill == NULL) cz.fill = czblock();
+    n = CZ_BLOCK - cz.fill->inlen;
+    if (n > left) n = left;
+    memcpy(cz.fill->in + cz.fill->inlen, buf, n);
+    cz.fill->inlen += n;
+    buf += n;
+    left -= n;
+    if (cz.fill->inlen == CZ_BLOCK) failed = czsubmit();
+  }
+  return size;
+}
+#endif
+
+/**
+ * Interposes the compressor in front of outfile if --compress or the name
+ * of the -o file (filename) asks for it, and starts its threads.
+ */
+void compress_start(char *filename)
+{
+#ifdef __linux__
+  long n = nthreads > 1? nthreads : sysconf(_SC_NPROCESSORS_ONLN);
+  FILE *fp;
+  int i;
+
+  if (compression && *compression) cz.method = czmethod(compression);
+  else if ((cz.method = czsuffix(filename)) == CZ_NONE && compression) cz.method = czmethod("gzip");
+  if (cz.method == CZ_NONE) return;
+
+  if (isatty(fileno(outfile))) {
+    fprintf(stderr,"tree: compressed output not written to a terminal, use -o.\n");
+    exit(1);
+  }
+
+  fp = fopencookie(NULL, "w", (cookie_io_functions_t){ NULL, cz_write, NULL, NULL });
+  if (fp == NULL) {
+    fprintf(stderr,"tree: unable to start the compressor.\n");
+    exit(1);
+  }
+  setvbuf(fp, NULL, _IOFBF, BUFSIZ);
+  fflush(outfile);
+  cz.realout = outfile;
+  outfile = fp;
+
+  if (n > 16) n = 16;
+  cz.tids = xmalloc(sizeof(pthread_t) * n);
+  for(cz.threads = i = 0; i < n && n > 1; i++)
+    if (pthread_create(&cz.tids[cz.threads], NULL, czworker, NULL) == 0) cz.threads++;
+  cz.maxinflight = cz.threads? cz.threads * 2 : 1;
+#else
+  if ((compression && *compression) || czsuffix(filename) != CZ_NONE) {
+    fprintf(stderr,"tree: compressed output is not supported on this system.\n");
+    exit(1);
+  }
+#endif
+}
+
+/**
+ * Compresses what's left, waits for every block to be written and puts
+ * outfile back.  Returns FALSE if any of the output could not be written.
+ */
+bool compress_finish(void)
+{
+  int i;
+
+  if (cz.realout == NULL) return TRUE;
+  fflush(outfile);
+  /* An empty listing is still a (empty) .gz or .zst file: */
+  if (cz.fill || !cz.any) {
+    if (cz.fill == NULL) cz.fill = czblock();
+    czsubmit();
+  }
+  pthread_mutex_lock(&cz.lock);
+  while (cz.inflight) pthread_cond_wait(&cz.room, &cz.lock);
+  cz.stop = TRUE;
+  pthread_cond_broadcast(&cz.work);
+  pthread_mutex_unlock(&cz.lock);
+  for(i = 0; i < cz.threads; i++) pthread_join(cz.tids[i], NULL);
+  free(cz.tids);
+  cz.tids = NULL;
+  cz.threads = 0;
+
+  fclose(outfile);
+  outfile = cz.realout;
+  cz.realout = NULL;
+  if (fflush(outfile) && !cz.err) cz.err = errno;
+
+  if (cz.err) {
+    fprintf(stderr,"tree: error writing output: %s\n", strerror(cz.err));
+    return FALSE;
+  }
+  return TRUE;
+}
@@ -0,0 +1,240 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+extern bool progressflag;
+extern int nthreads;
+extern struct walkopts opts;
+extern _Thread_local FILE *outfile;
+
+/**
+ * --deadline MS: The trees are read breadth first, by a pool of threads, into
+ * an index like --serve's (see serve_add()) until everything that's to be
+ * listed has been read or MS milliseconds have gone by, whichever comes first.
+ * Then tree lists them as usual, from the index, and a directory that hadn't
+ * been read by then is listed without its contents and marked as not scanned.
+ * A thread stuck on a slow mount holds up nothing but itself.  With --refine
+ * MS the threads go on reading, and the tree is listed again every MS
+ * milliseconds until a listing has nothing left out.
+ */
+struct dlanc {
+  dev_t dev;
+  ino_t ino;
+  struct dlanc *up;
+};
+
+struct dljob {
+  char *path;
+  dev_t dev, rootdev;
+  int lev;
+  struct dlanc *anc;	/* the directory and the ones above it, for -l loops */
+  struct dljob *next;
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work, idle;
+  struct dljob *head, **tail;
+  int busy, threads, level;	/* level: -L, which the walk changes for --site */
+  bool stop, done;
+  struct timespec until;
+} dl = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+int deadline = 0, refine = 0;	/* milliseconds, 0 if not given */
+u_long unscanned = 0;		/* directories the last listing left out */
+
+/**
+ * Queues the directory path (dl.lock is held), unless it's one of the
+ * directories above it, reached again through a symbolic link.
+ */
+static void dlpush(char *path, dev_t dev, ino_t ino, dev_t rootdev, int lev, struct dlanc *up)
+{
+  struct dljob *j;
+  struct dlanc *a;
+
+  for(a = up; a; a = a->up)
+    if (a->ino == ino && a->dev == dev) {
+      free(path);
+      return;
+    }
+  j = xmalloc(sizeof(struct dljob));
+  j->anc = xmalloc(sizeof(struct dlanc));
+  j->anc->dev = dev;
+  j->anc->ino = ino;
+  j->anc->up = up;
+  j->path = path;
+  j->dev = dev;
+  j->rootdev = rootdev;
+  j->lev = lev;
+  j->next = NULL;
+  *dl.tail = j;
+  dl.tail = &j->next;
+  if (progressflag) progress_queue(1);
+}
+
+/**
+ * Reads one directory into the index and queues the subdirectories the walk
+ * would go into.
+ */
+static void dlread(struct dljob *j)
+{
+  struct servent *e;
+  u_long files = 0;
+  off_t bytes = 0;
+  dev_t dev;
+  int n, i, len = strlen(j->path), cls;
+  char *sub, *name;
+
+  io_dev(j->dev, AT_FDCWD, j->path);
+  cls = io_acquire();
+  e = serve_add(j->path, &n, &dev);
+  io_release(cls);
+  if (e && progressflag) {
+    for(i = 0; i < n; i++) {
+      if (!S_ISDIR(e[i].lst.st_mode)) files++;
+      bytes += e[i].lst.st_size;
+    }
+    progress_dir(j->path, files, bytes);
+  }
+  if (e == NULL || (dl.level >= 0 && j->lev >= dl.level)) return;
+
+  pthread_mutex_lock(&dl.lock);
+  for(i = 0; i < n; i++) {
+    if (!S_ISDIR(e[i].st.st_mode) || (S_ISLNK(e[i].lst.st_mode) && !opts.lflag)) continue;
+    if (e[i].name[0] == '.' && !opts.aflag) continue;
+    if (opts.xdev && e[i].st.st_dev != j->rootdev) continue;
+    /* The walk goes into a symbolic link by its target: */
+    name = e[i].lnk? e[i].lnk : e[i].name;
+    if (*name == '/') sub = scopy(name);
+    else {
+      sub = xmalloc(len + strlen(name) + 2);
+      sprintf(sub, "%s%s%s", j->path, j->path[len-1] == '/'? "" : "/", name);
+    }
+    dlpush(sub, e[i].st.st_dev, e[i].st.st_ino, j->rootdev, j->lev + 1, j->anc);
+  }
+  pthread_cond_broadcast(&dl.work);
+  pthread_mutex_unlock(&dl.lock);
+}
+
+static void *dlworker(void *arg)
+{
+  struct dljob *j;
+
+  pthread_mutex_lock(&dl.lock);
+  for(;;) {
+    while (dl.head == NULL || dl.stop) pthread_cond_wait(&dl.work, &dl.lock);
+    j = dl.head;
+    if ((dl.head = j->next) == NULL) dl.tail = &dl.head;
+    dl.busy++;
+    if (progressflag) progress_queue(-1);
+    pthread_mutex_unlock(&dl.lock);
+
+    dlread(j);
+    free(j->path);
+    free(j);
+
+    pthread_mutex_lock(&dl.lock);
+    if (--dl.busy == 0 && dl.head == NULL) pthread_cond_signal(&dl.idle);
+  }
+  return NULL;
+}
+
+/**
+ * Waits until everything queued has been read or ms milliseconds have gone
+ * by.  Without --refine the threads are stopped then.
+ */
+static void dlwait(int ms)
+{
+  clock_gettime(CLOCK_MONOTONIC, &dl.until);
+  dl.until.tv_sec += ms / 1000;
+  dl.until.tv_nsec += (ms % 1000) * 1000000L;
+  if (dl.until.tv_nsec >= 1000000000L) {
+    dl.until.tv_sec++;
+    dl.until.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&dl.lock);
+  while (dl.head || dl.busy)
+    if (pthread_cond_timedwait(&dl.idle, &dl.lock, &dl.until) == ETIMEDOUT) break;
+  dl.done = !dl.head && !dl.busy;
+  if (!refine) dl.stop = TRUE;
+  pthread_mutex_unlock(&dl.lock);
+}
+
+/**
+ * Starts reading the trees named and waits for the deadline.
+ */
+void deadline_start(char **roots)
+{
+  pthread_condattr_t attr;
+  pthread_t t;
+  struct stat st;
+  long n = nthreads > 1? nthreads : sysconf(_SC_NPROCESSORS_ONLN);
+  int i;
+
+  /* A query is answered from the server's index, which has it all: */
+  if (!serve_local()) return;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&dl.idle, &attr);
+  pthread_condattr_destroy(&attr);
+
+  dl.tail = &dl.head;
+  dl.level = opts.level;
+  for(i = 0; roots[i]; i++) {
+    if (stat(roots[i], &st) < 0 || !S_ISDIR(st.st_mode)) continue;
+    if (dl.head == NULL) io_dev(st.st_dev, AT_FDCWD, roots[i]);
+    dlpush(scopy(roots[i]), st.st_dev, st.st_ino, st.st_dev, 0, NULL);
+  }
+
+  if (n > 16) n = 16;
+  if (nthreads <= 1 && n > io_threads()) n = io_threads();
+  for(dl.threads = i = 0; i < n; i++)
+    if (pthread_create(&t, NULL, dlworker, NULL) == 0) dl.threads++;
+  if (dl.threads == 0) {
+    fprintf(stderr,"tree: unable to start threads for --deadline.\n");
+    exit(1);
+  }
+  dlwait(deadline);
+}
+
+/**
+ * TRUE, counting it, if the directory at path is to be listed as not scanned.
+ */
+bool deadline_cut(char *path)
+{
+  if (!deadline || !serve_missing(path)) return FALSE;
+  unscanned++;
+  return TRUE;
+}
+
+/**
+ * After a listing, with --refine, waits for the next one and returns TRUE,
+ * or FALSE if the listing had nothing left out or everything had been read
+ * before it.
+ */
+bool deadline_refine(void)
+{
+  if (!refine || !unscanned || dl.done) return FALSE;
+  fflush(outfile);
+  dlwait(refine);
+  unscanned = 0;
+  return TRUE;
+}
@@ -0,0 +1,527 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+/**
+ * --diff OLD: Compare the file-system against a listing previously saved with
+ * 'tree -J' (use -s and -p when saving to also detect size and permission
+ * changes.)  Both sides are sorted with the same comparator and merged one
+ * directory at a time, only the added, removed and modified entries (and the
+ * directories leading to them) are kept and handed to listdir() as a full tree.
+ */
+
+extern bool duflag;
+extern _Thread_local int *dirs, maxdirs;
+
+extern const int ifmt[];
+extern const char *ftype[];
+
+static struct _info **oldroots = NULL;
+static int oldroot = 0;
+static bool oldhassize = FALSE, oldhasmode = FALSE;
+
+static FILE *dfp;
+static int dline = 1;
+
+static void diff_syntax(char *what)
+{
+  fprintf(stderr,"tree: --diff: %s at line %d.\n", what, dline);
+  exit(1);
+}
+
+static int dgetc(void)
+{
+  int c = getc(dfp);
+  if (c == '\n') dline++;
+  return c;
+}
+
+static int dskip(void)
+{
+  int c;
+  while((c = dgetc()) != EOF && isspace(c));
+  return c;
+}
+
+/**
+ * The four hex digits of a \u escape.
+ */
+static int dhex4(void)
+{
+  int c, u, i;
+
+  for(u=i=0; i < 4; i++) {
+    if (!isxdigit(c = dgetc())) diff_syntax("bad \\u escape");
+    u = (u << 4) | (isdigit(c)? c - '0' : (tolower(c) - 'a') + 10);
+  }
+  return u;
+}
+
+/**
+ * The code point of a \u escape, whose \u has been read, joining a UTF-16
+ * surrogate pair into one.
+ */
+static long dunicode(void)
+{
+  long u = dhex4(), lo;
+
+  if (u >= 0xDC00 && u <= 0xDFFF) diff_syntax("bad \\u escape");
+  if (u < 0xD800 || u > 0xDBFF) return u;
+  if (dgetc() != '\\' || dgetc() != 'u') diff_syntax("bad \\u escape");
+  if ((lo = dhex4()) < 0xDC00 || lo > 0xDFFF) diff_syntax("bad \\u escape");
+  return 0x10000 + ((u - 0xD800) << 10) + (lo - 0xDC00);
+}
+
+static char *dstring(void)
+{
+  static char *buf = NULL;
+  static int bufsize = 0;
+  int c, n = 0;
+  long u;
+
+  if (buf == NULL) buf = xmalloc(bufsize = PATH_MAX);
+
+  while((c = dgetc()) != '"') {
+    if (c == EOF) diff_syntax("unterminated string");
+    if (c == '\\') {
+      switch((c = dgetc())) {
+	case 'b': c = '\b'; break;
+	case 't': c = '\t'; break;
+	case 'n': c = '\n'; break;
+	case 'f': c = '\f'; break;
+	case 'r': c = '\r'; break;
+	case 'u':
+	  /* Names are kept as UTF-8, which is what tree -J leaves unescaped: */
+	  if (n+4 >= bufsize-1) buf = xrealloc(buf, bufsize += PATH_MAX);
+	  if ((u = dunicode()) < 0x80) c = u;
+	  else {
+	    if (u < 0x800) buf[n++] = 0xC0 | (u >> 6);
+	    else {
+	      if (u < 0x10000) buf[n++] = 0xE0 | (u >> 12);
+	      else {
+		buf[n++] = 0xF0 | (u >> 18);
+		buf[n++] = 0x80 | ((u >> 12) & 0x3F);
+	      }
+	      buf[n++] = 0x80 | ((u >> 6) & 0x3F);
+	    }
+	    c = 0x80 | (u & 0x3F);
+	  }
+	  break;
+	case EOF: diff_syntax("unterminated string");
+      }
+    }
+    if (n == bufsize-1) buf = xrealloc(buf, bufsize += PATH_MAX);
+    buf[n++] = c;
+  }
+  buf[n] = 0;
+  return buf;
+}
+
+struct dlist {
+  struct _info **list;
+  int n, size;
+};
+
+static void dvalue(int c, struct dlist *l);
+
+static void dappend(struct dlist *l, struct _info *ent)
+{
+  if (l->n == l->size-1) l->list = xrealloc(l->list, sizeof(struct _info *) * (l->size += MINC));
+  l->list[l->n++] = ent;
+  l->list[l->n] = NULL;
+}
+
+/**
+ * Reads an array of objects.  tree -J writes error objects right after the
+ * entry they belong to without a separating comma, so commas are optional.
+ */
+static struct _info **darray(void)
+{
+  struct dlist l;
+  int c;
+
+  l.list = xmalloc(sizeof(struct _info *) * (l.size = MINIT));
+  l.list[l.n = 0] = NULL;
+
+  while((c = dskip()) != ']') {
+    if (c == ',') continue;
+    if (c == EOF) diff_syntax("unterminated array");
+    dvalue(c, &l);
+  }
+  return l.list;
+}
+
+/**
+ * Returns the entry an object describes or NULL if it isn't one (the report or
+ * an error.)
+ */
+static struct _info *dobject(void)
+{
+  struct _info *ent = xmalloc(sizeof(struct _info));
+  struct dlist junk = {NULL, 0, 0};
+  bool skip = FALSE;
+  char *key, *s;
+  int c, t;
+
+  memset(ent, 0, sizeof(struct _info));
+  ent->size = -1;
+
+  while((c = dskip()) != '}') {
+    if (c == ',') continue;
+    if (c != '"') diff_syntax("expected a key");
+    s = dstring();
+    key = scopy(s);
+    if (dskip() != ':') diff_syntax("expected ':'");
+    c = dskip();
+
+    if (!strcmp(key, "contents") && c == '[') {
+      ent->child = darray();
+      ent->isdir = TRUE;
+    } else if (c == '"') {
+      s = dstring();
+      if (!strcmp(key, "type")) {
+	for(t=0; ftype[t] && strcmp(ftype[t], s); t++);
+	if (ftype[t] && ifmt[t]) ent->mode |= ifmt[t];
+	else skip = TRUE;
+	if ((ent->mode & S_IFMT) == S_IFDIR) ent->isdir = TRUE;
+      } else if (!strcmp(key, "name")) ent->name = scopy(s);
+      else if (!strcmp(key, "target")) ent->lnk = scopy(s);
+      else if (!strcmp(key, "mode")) {
+	ent->mode |= strtoul(s, NULL, 8) & ~S_IFMT;
+	oldhasmode = TRUE;
+      } else if (!strcmp(key, "error")) skip = TRUE;
+    } else if (c == '-' || isdigit(c)) {
+      long long v = 0;
+      bool neg = (c == '-');
+      if (neg) c = dgetc();
+      for(; isdigit(c); c = dgetc()) v = v * 10 + (c - '0');
+      ungetc(c, dfp);
+      if (!strcmp(key, "size")) {
+	ent->size = neg? -v : v;
+	oldhassize = TRUE;
+      }
+    } else dvalue(c, &junk);
+    free(key);
+  }
+  if (skip || ent->name == NULL) {
+    diff_freeent(ent);
+    return NULL;
+  }
+  return ent;
+}
+
+/**
+ * Parses one value and appends it to l if it is a file-system entry, anything
+ * else is thrown away.
+ */
+static void dvalue(int c, struct dlist *l)
+{
+  struct _info *ent;
+
+  switch(c) {
+    case '{':
+      if ((ent = dobject()) == NULL) break;
+      if (l->list) dappend(l, ent);
+      else diff_freeent(ent);
+      break;
+    case '[':
+      diff_free(darray());
+      break;
+    case '"':
+      dstring();
+      break;
+    default:
+      if (!isalnum(c) && c != '-' && c != '.') diff_syntax("unexpected character");
+      while(isalnum(c = dgetc()) || c == '.' || c == '+' || c == '-');
+      ungetc(c, dfp);
+      break;
+  }
+}
+
+/**
+ * Loads the listing to compare against, one list of entries per directory
+ * given on the command line, in order.
+ */
+void diff_load(char *filename)
+{
+  if (!strcmp(filename, "-")) dfp = stdin;
+  else if ((dfp = fopen(filename, "r")) == NULL) {
+    fprintf(stderr,"tree: unable to open '%s' for --diff.\n", filename);
+    exit(1);
+  }
+  if (dskip() != '[') diff_syntax("not a tree JSON listing");
+  oldroots = darray();
+  if (dfp != stdin) fclose(dfp);
+}
+
+/**
+ * Frees an entry along with everything below it.
+ */
+void diff_freeent(struct _info *ent)
+{
+  if (ent->child) diff_free(ent->child);
+  if (ent->name) free(ent->name);
+  if (ent->lnk) free(ent->lnk);
+  free(ent);
+}
+
+void diff_free(struct _info **d)
+{
+  int i;
+
+  if (d == NULL) return;
+  for(i=0; d[i]; i++) diff_freeent(d[i]);
+  free(d);
+}
+
+/**
+ * Both lists have to be in the same order for the merge, use the normal name
+ * sort, but never let two different names compare as equal.
+ */
+static int diffsort(struct _info **a, struct _info **b)
+{
+  int v = alnumsort(a, b);
+  return v? v : strcmp((*a)->name, (*b)->name);
+}
+
+/**
+ * Apply the same name based filters to the old listing that read_dir() applies
+ * to the file-system, so that a listing saved with different options doesn't
+ * report everything as removed.
+ */
+static bool diff_keep(struct walkopts *w, struct _info *ent)
+{
+  if (w->dflag && !ent->isdir && (ent->mode & S_IFMT) != S_IFLNK) return FALSE;
+  if (!w->aflag && ent->name[0] == '.') return FALSE;
+  if (!ent->isdir && w->pattern && !patinclude(w, ent->name, 0)) return FALSE;
+  if (w->ipattern && patignore(w, ent->name, ent->isdir)) return FALSE;
+  return TRUE;
+}
+
+/**
+ * Mark an old entry and everything below it as removed, returns the size
+ * difference this makes.
+ */
+static off_t diff_removed(struct walkopts *w, struct _info *ent)
+{
+  off_t delta = 0;
+  int i, j;
+
+  ent->diff = DIFF_REMOVED;
+  if (ent->child) {
+    for(i=j=0; ent->child[i]; i++) {
+      if (diff_keep(w, ent->child[i])) {
+	delta += diff_removed(w, ent->child[j++] = ent->child[i]);
+      } else diff_freeent(ent->child[i]);
+    }
+    ent->child[j] = NULL;
+    if (j == 0) {
+      free(ent->child);
+      ent->child = NULL;
+    }
+  } else if (!ent->isdir && ent->size > 0) delta = -ent->size;
+  return ent->delta = delta;
+}
+
+static bool diff_changed(struct _info *new, struct _info *old)
+{
+  if ((new->mode & S_IFMT) != (old->mode & S_IFMT)) return TRUE;
+  if (oldhasmode && (new->mode & ~S_IFMT) != (old->mode & ~S_IFMT)) return TRUE;
+  if (!new->isdir && oldhassize && old->size >= 0 && new->size != old->size) return TRUE;
+  if (new->lnk && old->lnk && strcmp(new->lnk, old->lnk)) return TRUE;
+  return FALSE;
+}
+
+static struct _info **diff_walk(struct walkopts *w, char *d, u_long lev, dev_t dev, struct _info **old, off_t *delta, off_t *size, char **err);
+
+static void diff_add(struct _info ***out, int *n, int *size, struct _info *ent)
+{
+  if (*n == *size-1) *out = xrealloc(*out, sizeof(struct _info *) * (*size += MINC));
+  (*out)[(*n)++] = ent;
+}
+
+/**
+ * Merge one directory level.  new and old must both be sorted by diffsort().
+ * The entries of both lists are either moved to the returned list or freed,
+ * the lists themselves are left for the caller to free.
+ */
+static struct _info **diff_merge(struct walkopts *w, char *d, u_long lev, dev_t dev, struct _info **new, struct _info **old, off_t *delta, off_t *total)
+{
+  struct _info **out, *nent, *oent;
+  int n = 0, size = MINIT, v, i = 0, j = 0;
+  char *path = NULL;
+  long pathsize = 0;
+
+  out = xmalloc(sizeof(struct _info *) * size);
+
+  while ((new && new[i]) || (old && old[j])) {
+    nent = new? new[i] : NULL;
+    oent = old? old[j] : NULL;
+    if (oent && !diff_keep(w, oent)) {
+      diff_freeent(oent);
+      j++;
+      continue;
+    }
+    if (nent == NULL) v = 1;
+    else if (oent == NULL) v = -1;
+    else v = diffsort(&nent, &oent);
+
+    /* With -d we can't tell if an old symlink pointed to a directory: */
+    if (v > 0 && w->dflag && (oent->mode & S_IFMT) == S_IFLNK) {
+      diff_freeent(oent);
+      j++;
+      continue;
+    }
+
+    /* Something that changed type is a remove plus an add: */
+    if (v > 0 || (v == 0 && (nent->mode & S_IFMT) != (oent->mode & S_IFMT))) {
+      *delta += diff_removed(w, oent);
+      diff_add(&out, &n, &size, oent);
+      j++;
+      if (v > 0) continue;
+      oent = NULL;
+      v = -1;
+    }
+
+    i++;
+    if (nent->isdir && !nent->lnk && !(w->xdev && dev != nent->dev)) {
+      if (strlen(d)+strlen(nent->name)+2 > pathsize) path = xrealloc(path, pathsize = (strlen(d)+strlen(nent->name)+PATH_MAX));
+      sprintf(path, "%s/%s", d, nent->name);
+      saveino(nent->inode, nent->dev);
+      nent->child = diff_walk(w, path, lev+1, dev, v? NULL : oent->child, &nent->delta, &nent->size, &nent->err);
+      if (!v) oent->child = NULL;
+      if (nent->err) (*w->errors)++;
+    } else if (!nent->isdir) nent->delta = nent->size;
+    /* --du: everything in the new tree counts, listed or not: */
+    if (duflag) *total += nent->size;
+
+    if (v < 0) {
+      nent->diff = DIFF_ADDED;
+      *delta += nent->delta;
+      diff_add(&out, &n, &size, nent);
+      continue;
+    }
+
+    j++;
+    if (!nent->isdir) nent->delta = (oldhassize && oent->size >= 0)? nent->size - oent->size : 0;
+    if (nent->child || diff_changed(nent, oent)) {
+      nent->diff = DIFF_MODIFIED;
+      *delta += nent->delta;
+      diff_add(&out, &n, &size, nent);
+    } else diff_freeent(nent);
+    diff_freeent(oent);
+  }
+  if (path) free(path);
+
+  if (n == 0) {
+    free(out);
+    return NULL;
+  }
+  out[n] = NULL;
+  return out;
+}
+
+static struct _info **diff_walk(struct walkopts *w, char *d, u_long lev, dev_t dev, struct _info **old, off_t *delta, off_t *size, char **err)
+{
+  struct ignorefile *ig = NULL;
+  struct infofile *inf = NULL;
+  struct _info **new, **out;
+  int (*cmp)() = diffsort;
+  int n, o, ph;
+
+  *err = NULL;
+  if (w->level >= 0 && lev > w->level) {
+    diff_free(old);
+    return NULL;
+  }
+
+  push_files(w, d, &ig, &inf);
+  new = read_dir(w, d, &n, inf != NULL);
+  if (new == NULL && n) *err = scopy("error opening dir");
+
+  ph = stats_enter(PH_SORT);
+  if (new) {
+    stats_count[ST_QSORT]++;
+    sortdir(w, new, n, cmp);
+  }
+  if (old) {
+    for(o=0; old[o]; o++);
+    stats_count[ST_QSORT]++;
+    sortdir(w, old, o, cmp);
+  }
+  stats_leave(ph);
+
+  if (lev >= maxdirs-1) {
+    dirs = xrealloc(dirs,sizeof(int) * (maxdirs += 1024));
+  }
+
+  out = diff_merge(w, d, lev, dev, new, old, delta, size);
+
+  if (new) free(new);
+  if (old) free(old);
+  if (ig != NULL) pop_filterstack();
+  if (inf != NULL) pop_infostack();
+  return out;
+}
+
+/**
+ * getfulltree() replacement for --diff, each call at level 0 is the next
+ * directory given on the command line and is compared against the next
+ * top-level entry of the old listing.  With --du *size gets the total of the
+ * new tree, unchanged entries included, as unix_getfulltree() gives it.
+ */
+struct _info **diff_getfulltree(struct walkopts *w, char *d, u_long lev, dev_t dev, off_t *size, char **err)
+{
+  struct _info *oroot = NULL, **out;
+  struct stat sb;
+  off_t delta = 0;
+
+  if (w->xdev && lev == 0) {
+    stats_count[ST_STAT]++;
+    stat(d,&sb);
+    dev = sb.st_dev;
+  }
+  if (oldroots && oldroots[oldroot]) oroot = oldroots[oldroot++];
+
+  out = diff_walk(w, d, lev, dev, oroot? oroot->child : NULL, &delta, size, err);
+
+  if (oroot) {
+    oroot->child = NULL;
+    diff_freeent(oroot);
+  }
+  return out;
+}
+
+/**
+ * Formats a size difference as " +123" (or " -1.2K" with -h / --si).
+ */
+int pdelta(char *buf, off_t delta)
+{
+  char sbuf[64], *s;
+
+  psize(sbuf, delta < 0? -delta : delta);
+  for(s = sbuf; *s == ' '; s++);
+  return sprintf(buf, " %c%s", delta < 0? '-' : '+', s);
+}
+
+char *diffname(int diff)
+{
+  static char *names[] = {"", "added", "removed", "modified"};
+  return names[diff];
+}
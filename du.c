@@ -0,0 +1,295 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+#include <fcntl.h>
+
+extern bool progressflag;
+extern struct walkopts opts;
+extern int nthreads;
+
+/**
+ * --DU: What --du can't see, directories past -L and entries left out by -a,
+ * -P, -I, --gitignore, -d, --filelimit or --prune, is summed here.  Nothing is
+ * filtered and no _info is made, each directory is read through its fd and
+ * its entries fstatat()'d, and symbolic links are never followed.  Sizes are
+ * st_size as for --du.  A file with more than one link is sized once, the
+ * first time its (device, inode) is seen.  Directories to read go on a shared
+ * stack that a pool of threads works through; du_size() waits until the stack
+ * is empty and every thread is idle, du_finish() stops the threads.  How many
+ * threads there are, and how many of them read from one file system at once,
+ * is up to the file system (see io.c).
+ */
+struct dujob {
+  char *path;
+  dev_t dev;	/* 0 if not known */
+  struct dujob *next;
+};
+
+/* A hard linked file seen, an open addressing table slot (ino 0 is empty): */
+struct dulink {
+  dev_t dev;
+  ino_t ino;
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work, idle;
+  struct dujob *stack;
+  int busy, threads;
+  pthread_t *tids;
+  off_t total;
+  u_long files, dirs;
+  dev_t dev;
+  bool started, stop;
+  struct dulink *links;
+  u_long nlinks, maxlinks;	/* maxlinks is 0 or a power of two */
+} du = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+#define LINKHASH(dev,ino,mask)	((u_long)(((unsigned long long)(ino) ^ ((unsigned long long)(dev) << 32)) * 0x9E3779B97F4A7C15ULL >> 20) & (mask))
+
+static struct dulink *dulinkslot(struct dulink *t, u_long max, dev_t dev, ino_t ino)
+{
+  u_long i = LINKHASH(dev, ino, max-1);
+
+  while (t[i].ino && !(t[i].ino == ino && t[i].dev == dev)) i = (i+1) & (max-1);
+  return &t[i];
+}
+
+/**
+ * Whether st is a file with other links that was already counted, noting it
+ * if not.  Directories are never hard linked, and are reached only once.
+ */
+static bool duseen(struct stat *st)
+{
+  struct dulink *s, *old;
+  u_long i, max;
+  bool seen;
+
+  if (st->st_nlink < 2 || S_ISDIR(st->st_mode)) return FALSE;
+  pthread_mutex_lock(&du.lock);
+  if (2 * (du.nlinks + 1) > du.maxlinks) {
+    old = du.links;
+    max = du.maxlinks;
+    du.maxlinks = max? max * 2 : 1024;
+    du.links = xmalloc(sizeof(struct dulink) * du.maxlinks);
+    memset(du.links, 0, sizeof(struct dulink) * du.maxlinks);
+    for(i = 0; i < max; i++)
+      if (old[i].ino) *dulinkslot(du.links, du.maxlinks, old[i].dev, old[i].ino) = old[i];
+    if (old) free(old);
+  }
+  s = dulinkslot(du.links, du.maxlinks, st->st_dev, st->st_ino);
+  if (!(seen = (s->ino != 0))) {
+    s->dev = st->st_dev;
+    s->ino = st->st_ino;
+    du.nlinks++;
+  }
+  pthread_mutex_unlock(&du.lock);
+  return seen;
+}
+
+static void dupush(char *path, dev_t dev)
+{
+  struct dujob *j = xmalloc(sizeof(struct dujob));
+
+  j->path = path;
+  j->dev = dev;
+  j->next = du.stack;
+  du.stack = j;
+  if (progressflag) progress_queue(1);
+}
+
+/**
+ * Reads one directory, returns the sum of its entries' sizes, counts them
+ * into *files and *dirs and pushes its subdirectories (the caller holds no
+ * lock).
+ */
+static off_t duread(char *path, dev_t dev, u_long *files, u_long *dirs)
+{
+  struct dirent *ent;
+  struct stat st;
+  off_t sum = 0;
+  u_long nfiles = 0;
+  DIR *d;
+  int fd, len = strlen(path), cls, r;
+  double io;
+  char *sub;
+
+  if (dev) io_dev(dev, AT_FDCWD, path);
+  cls = io_acquire();
+  io = io_begin();
+  fd = open(path, O_RDONLY | O_DIRECTORY);
+  io_end(io);
+  if (fd < 0 || (d = fdopendir(fd)) == NULL) {
+    if (fd >= 0) close(fd);
+    io_release(cls);
+    return 0;
+  }
+  if (!dev && fstat(fd, &st) == 0) io_dev(st.st_dev, fd, ".");
+  while ((ent = readdir(d)) != NULL) {
+    if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) continue;
+    io = io_begin();
+    r = fstatat(fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW);
+    io_end(io);
+    if (r < 0) continue;
+    if (!duseen(&st)) sum += st.st_size;
+    if (!S_ISDIR(st.st_mode)) nfiles++;
+    else (*dirs)++;
+    if (!S_ISDIR(st.st_mode) || (opts.xdev && st.st_dev != du.dev)) continue;
+    sub = xmalloc(len + strlen(ent->d_name) + 2);
+    sprintf(sub, "%s%s%s", path, path[len-1] == '/'? "" : "/", ent->d_name);
+    pthread_mutex_lock(&du.lock);
+    dupush(sub, st.st_dev);
+    pthread_cond_signal(&du.work);
+    pthread_mutex_unlock(&du.lock);
+  }
+  closedir(d);
+  io_release(cls);
+  *files += nfiles;
+  if (progressflag) progress_dir(path, nfiles, sum);
+  return sum;
+}
+
+static void *duworker(void *arg)
+{
+  struct dujob *j;
+  u_long files, dirs;
+  off_t sum;
+
+  pthread_mutex_lock(&du.lock);
+  for(;;) {
+    while (du.stack == NULL && !du.stop) pthread_cond_wait(&du.work, &du.lock);
+    if (du.stop) break;
+    j = du.stack;
+    du.stack = j->next;
+    du.busy++;
+    if (progressflag) progress_queue(-1);
+    pthread_mutex_unlock(&du.lock);
+
+    files = dirs = 0;
+    sum = duread(j->path, j->dev, &files, &dirs);
+    free(j->path);
+    free(j);
+
+    pthread_mutex_lock(&du.lock);
+    du.total += sum;
+    du.files += files;
+    du.dirs += dirs;
+    if (--du.busy == 0 && du.stack == NULL) pthread_cond_signal(&du.idle);
+  }
+  pthread_mutex_unlock(&du.lock);
+  return NULL;
+}
+
+static void dustart(void)
+{
+  long n = nthreads > 1? nthreads : sysconf(_SC_NPROCESSORS_ONLN);
+  int i;
+
+  du.started = TRUE;
+  if (n > 16) n = 16;
+  if (nthreads <= 1 && n > io_threads()) n = io_threads();
+  du.tids = xmalloc(sizeof(pthread_t) * n);
+  for(du.threads = i = 0; i < n && n > 1; i++)
+    if (pthread_create(&du.tids[du.threads], NULL, duworker, NULL) == 0) du.threads++;
+}
+
+/**
+ * Stops and joins the threads, once the last du_size() has returned.
+ */
+void du_finish(void)
+{
+  int i;
+
+  if (!du.started) return;
+  pthread_mutex_lock(&du.lock);
+  du.stop = TRUE;
+  pthread_cond_broadcast(&du.work);
+  pthread_mutex_unlock(&du.lock);
+  for(i = 0; i < du.threads; i++) pthread_join(du.tids[i], NULL);
+  free(du.tids);
+  du.tids = NULL;
+  du.threads = 0;
+  du.started = du.stop = FALSE;
+}
+
+/**
+ * Sets the device the walk stays on for -x.
+ */
+void du_root(dev_t dev)
+{
+  du.dev = dev;
+}
+
+/**
+ * Total size of everything under the directory path.  How many files and
+ * directories that was is left for du_counts().
+ */
+off_t du_size(char *path)
+{
+  struct dujob *j;
+  off_t total;
+
+  if (!du.started) dustart();
+
+  pthread_mutex_lock(&du.lock);
+  du.total = 0;
+  du.files = du.dirs = 0;
+  dupush(scopy(path), 0);
+  if (du.threads) {
+    pthread_cond_broadcast(&du.work);
+    while (du.busy || du.stack) pthread_cond_wait(&du.idle, &du.lock);
+  } else {
+    while ((j = du.stack) != NULL) {
+      du.stack = j->next;
+      if (progressflag) progress_queue(-1);
+      pthread_mutex_unlock(&du.lock);
+      du.total += duread(j->path, j->dev, &du.files, &du.dirs);
+      free(j->path);
+      free(j);
+      pthread_mutex_lock(&du.lock);
+    }
+  }
+  total = du.total;
+  pthread_mutex_unlock(&du.lock);
+  return total;
+}
+
+/**
+ * The files and directories (not counting path itself) the last du_size()
+ * found.
+ */
+void du_counts(u_long *files, u_long *dirs)
+{
+  *files = du.files;
+  *dirs = du.dirs;
+}
+
+/**
+ * Size of an entry that read_dir() left out, and of everything under it.
+ */
+off_t du_entry(int dirfd, char *name, char *path)
+{
+  struct stat st;
+
+  if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) return 0;
+  if (duseen(&st)) return 0;
+  if (S_ISDIR(st.st_mode) && !(opts.xdev && st.st_dev != du.dev)) return st.st_size + du_size(path);
+  return st.st_size;
+}
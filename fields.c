@@ -0,0 +1,203 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+extern bool cflag, hflag, siflag;
+extern _Thread_local FILE *outfile;
+
+/**
+ * The metadata shown for each entry ([inode dev prot user group size date]
+ * and its JSON and XML attribute forms) is written by a list of field
+ * writers that fields_compile() picks once from a walk's options, rather than by
+ * testing each option and going through printf() for every entry.  A writer
+ * appends its field at p and returns the end.  Numbers and strings are copied
+ * by hand; only the -h/--si size and the date still go through their
+ * formatters.
+ */
+/**
+ * Appends v right aligned in width columns.
+ */
+static char *putnum(char *p, long long v, int width)
+{
+  char t[24];
+  unsigned long long u = v < 0? -(unsigned long long)v : (unsigned long long)v;
+  int n = 0;
+
+  do t[n++] = '0' + u % 10; while (u /= 10);
+  if (v < 0) t[n++] = '-';
+  for(; width > n; width--) *p++ = ' ';
+  while (n) *p++ = t[--n];
+  return p;
+}
+
+/**
+ * Appends at most max characters of s, padded with spaces to width.
+ */
+static char *putstr(char *p, const char *s, int width, int max)
+{
+  for(; *s && max; max--, width--) *p++ = *s++;
+  for(; width > 0; width--) *p++ = ' ';
+  return p;
+}
+
+static char *putlit(char *p, const char *s)
+{
+  while (*s) *p++ = *s++;
+  return p;
+}
+
+static char *putmode(char *p, struct _info *ent)
+{
+#ifdef __EMX__
+  int m = ent->attr;
+#else
+  int m = ent->mode & (S_IRWXU|S_IRWXG|S_IRWXO|S_ISUID|S_ISGID|S_ISVTX);
+#endif
+  int i;
+
+  for(i=3; i >= 0; i--) p[i] = '0' + (m & 7), m >>= 3;
+  return p + 4;
+}
+
+static char *entprot(struct _info *ent)
+{
+#ifdef __EMX__
+  return prot(ent->attr);
+#else
+  return prot(ent->mode);
+#endif
+}
+
+static char *entdate(struct _info *ent)
+{
+  return do_date(cflag? ent->ctime : ent->mtime);
+}
+
+/* The [...] fields of the unix and HTML listings: */
+static char *f_inode(char *p, struct _info *ent) { *p++ = ' '; return putnum(p, ent->linode, 7); }
+static char *f_dev(char *p, struct _info *ent) { *p++ = ' '; return putnum(p, (int)ent->ldev, 3); }
+static char *f_prot(char *p, struct _info *ent) { *p++ = ' '; return putlit(p, entprot(ent)); }
+static char *f_user(char *p, struct _info *ent) { *p++ = ' '; return putstr(p, uidtoname(ent->uid), 8, 32); }
+static char *f_group(char *p, struct _info *ent) { *p++ = ' '; return putstr(p, gidtoname(ent->gid), 8, 32); }
+static char *f_size(char *p, struct _info *ent) { *p++ = ' '; return putnum(p, ent->size, sizeof(off_t) == sizeof(long long)? 11 : 9); }
+static char *f_hsize(char *p, struct _info *ent) { return p + psize(p, ent->size); }
+static char *f_date(char *p, struct _info *ent) { *p++ = ' '; return putlit(p, entdate(ent)); }
+
+/* JSON members: */
+static char *j_inode(char *p, struct _info *ent) { return putnum(putlit(p, ",\"inode\":"), ent->inode, 0); }
+static char *j_dev(char *p, struct _info *ent) { return putnum(putlit(p, ",\"dev\":"), (int)ent->dev, 0); }
+static char *j_prot(char *p, struct _info *ent)
+{
+  p = putmode(putlit(p, ",\"mode\":\""), ent);
+  return putlit(putlit(putlit(p, "\",\"prot\":\""), entprot(ent)), "\"");
+}
+static char *j_user(char *p, struct _info *ent) { return putlit(putlit(putlit(p, ",\"user\":\""), uidtoname(ent->uid)), "\""); }
+static char *j_group(char *p, struct _info *ent) { return putlit(putlit(putlit(p, ",\"group\":\""), gidtoname(ent->gid)), "\""); }
+static char *j_size(char *p, struct _info *ent) { return putnum(putlit(p, ",\"size\":"), ent->size, 0); }
+static char *j_hsize(char *p, struct _info *ent)
+{
+  char nbuf[64], *s;
+
+  psize(nbuf, ent->size);
+  for(s = nbuf; isspace(*s); s++);
+  return putlit(putlit(putlit(p, ",\"size\":\""), s), "\"");
+}
+static char *j_date(char *p, struct _info *ent) { return putlit(putlit(putlit(p, ",\"time\":\""), entdate(ent)), "\""); }
+
+/* XML attributes: */
+static char *x_inode(char *p, struct _info *ent) { return putlit(putnum(putlit(p, " inode=\""), ent->inode, 0), "\""); }
+static char *x_dev(char *p, struct _info *ent) { return putlit(putnum(putlit(p, " dev=\""), (int)ent->dev, 0), "\""); }
+static char *x_prot(char *p, struct _info *ent)
+{
+  p = putmode(putlit(p, " mode=\""), ent);
+  return putlit(putlit(putlit(p, "\" prot=\""), entprot(ent)), "\"");
+}
+static char *x_user(char *p, struct _info *ent) { return putlit(putlit(putlit(p, " user=\""), uidtoname(ent->uid)), "\""); }
+static char *x_group(char *p, struct _info *ent) { return putlit(putlit(putlit(p, " group=\""), gidtoname(ent->gid)), "\""); }
+static char *x_size(char *p, struct _info *ent) { return putlit(putnum(putlit(p, " size=\""), ent->size, 0), "\""); }
+static char *x_date(char *p, struct _info *ent) { return putlit(putlit(putlit(p, " time=\""), entdate(ent)), "\""); }
+
+/**
+ * Builds w's field lists from its options, in the order they're shown.
+ */
+void fields_compile(struct walkopts *w)
+{
+  field_t *infofields = w->infofields, *jsonfields = w->jsonfields, *xmlfields = w->xmlfields;
+  int n = 0;
+
+  if (w->inodeflag) infofields[n] = f_inode, jsonfields[n] = j_inode, xmlfields[n++] = x_inode;
+  if (w->devflag) infofields[n] = f_dev, jsonfields[n] = j_dev, xmlfields[n++] = x_dev;
+  if (w->pflag) infofields[n] = f_prot, jsonfields[n] = j_prot, xmlfields[n++] = x_prot;
+  if (w->uflag) infofields[n] = f_user, jsonfields[n] = j_user, xmlfields[n++] = x_user;
+  if (w->gflag) infofields[n] = f_group, jsonfields[n] = j_group, xmlfields[n++] = x_group;
+  if (w->sflag) {
+    infofields[n] = (hflag || siflag)? f_hsize : f_size;
+    jsonfields[n] = (hflag || siflag)? j_hsize : j_size;
+    xmlfields[n++] = x_size;
+  }
+  if (w->Dflag) infofields[n] = f_date, jsonfields[n] = j_date, xmlfields[n++] = x_date;
+  infofields[n] = jsonfields[n] = xmlfields[n] = NULL;
+}
+
+static char *runfields(field_t *f, char *p, struct _info *ent)
+{
+  for(; *f; f++) p = (*f)(p, ent);
+  return p;
+}
+
+/**
+ * The fields shown in [...] before the name, "" if there are none.
+ */
+char *fillinfo(struct walkopts *w, char *buf, struct _info *ent)
+{
+  char *p = runfields(w->infofields, buf, ent);
+
+  if (ent->diff) {
+    *p++ = ' ';
+    *p++ = "?+-~"[ent->diff];
+    p += pdelta(p, ent->delta);
+  }
+  *p = 0;
+
+  if (buf[0] == ' ') {
+    buf[0] = '[';
+    *p++ = ']';
+    *p = 0;
+  }
+
+  return buf;
+}
+
+void json_fillinfo(struct walkopts *w, struct _info *ent)
+{
+  char buf[1024], *p = runfields(w->jsonfields, buf, ent);
+
+  if (ent->diff) p += sprintf(p, ",\"diff\":\"%s\",\"delta\":%lld", diffname(ent->diff), (long long int)ent->delta);
+  if (ent->truncated) p += sprintf(p, ",\"truncated\":true");
+  fwrite(buf, 1, p - buf, outfile);
+}
+
+void xml_fillinfo(struct walkopts *w, struct _info *ent)
+{
+  char buf[1024], *p = runfields(w->xmlfields, buf, ent);
+
+  if (ent->diff) p += sprintf(p, " diff=\"%s\" delta=\"%lld\"", diffname(ent->diff), (long long int)ent->delta);
+  if (ent->truncated) p += sprintf(p, " truncated=\"true\"");
+  fwrite(buf, 1, p - buf, outfile);
+}
@@ -18,14 +18,12 @@
  */
 #include "tree.h"
 
-extern bool dflag, Fflag, aflag, fflag, pruneflag;
-extern bool noindent, force_color, flimit, matchdirs;
-extern bool reverse;
-extern int pattern, ipattern;
+extern bool Fflag, fflag, pruneflag;
+extern bool noindent, force_color;
+extern int npreds;
 
-extern int (*topsort)();
-extern FILE *outfile;
-extern int Level, *dirs, maxdirs;
+extern _Thread_local FILE *outfile;
+extern _Thread_local int *dirs, maxdirs;
 
 extern bool colorize;
 extern char *endcode;
@@ -104,32 +102,54 @@ void freefiletree(struct _info *ent)
   }
 }
 
+/**
+ * The predicates see a listed path's lstat() if it exists (relative to the
+ * current directory), otherwise only the file type the listing gives.
+ */
+static bool fpred(struct _info *ent, char *path)
+{
+  struct stat st;
+
+  if (lstat(path, &st) < 0) {
+    memset(&st, 0, sizeof(st));
+    st.st_mode = ent->mode;
+  }
+  return pred_match(&st);
+}
+
 /**
  * Recursively prune (unset show flag) files/directories of matches/ignored
- * patterns:
+ * patterns.  path is the path of the entries' directory, for the predicates.
  */
-struct _info **fprune(struct _info *head, bool matched, bool root)
+struct _info **fprune(struct walkopts *w, struct _info *head, char *path, bool matched, bool root)
 {
   struct _info **dir, *new = NULL, *end = NULL, *ent, *t;
   int show, count = 0;
+  char *sub = NULL;
 
   for(ent = head; ent != NULL;) {
     if (ent->tchild) ent->isdir = 1;
+    if (npreds) {
+      sub = xrealloc(sub, (path? strlen(path) + 1 : 0) + strlen(ent->name) + 1);
+      if (path) sprintf(sub, "%s/%s", path, ent->name);
+      else strcpy(sub, ent->name);
+    }
 
     show = 1;
-    if (dflag && !ent->isdir) show = 0;
-    if (!aflag && !root && ent->name[0] == '.') show = 0;
+    if (w->dflag && !ent->isdir) show = 0;
+    if (!w->aflag && !root && ent->name[0] == '.') show = 0;
     if (show && !matched) {
       if (!ent->isdir) {
-	if (pattern && !patinclude(ent->name, 0)) show = 0;
-	if (ipattern && patignore(ent->name, 0)) show = 0;
+	if (w->pattern && !patinclude(w, ent->name, 0)) show = 0;
+	if (w->ipattern && patignore(w, ent->name, 0)) show = 0;
+	if (npreds && show && !fpred(ent, sub)) show = 0;
       }
-      if (ent->isdir && show && matchdirs && pattern) {
-	if (patinclude(ent->name, 1)) matched = TRUE;
+      if (ent->isdir && show && w->matchdirs && w->pattern) {
+	if (patinclude(w, ent->name, 1)) matched = TRUE;
       }
     }
     if (pruneflag && !matched && ent->isdir && ent->tchild == NULL) show = 0;
-    if (show && ent->tchild != NULL) ent->child = fprune(ent->tchild, matched, FALSE);
+    if (show && ent->tchild != NULL) ent->child = fprune(w, ent->tchild, sub, matched, FALSE);
 
     t = ent;
     ent = ent->next;
@@ -143,6 +163,7 @@ struct _info **fprune(struct _info *head, bool matched, bool root)
     }
   }
   if (end) end->next = NULL;
+  if (sub) free(sub);
 
   dir = xmalloc(sizeof(struct _info *) * (count+1));
   for(count = 0, ent = new; ent != NULL; ent = ent->next, count++) {
@@ -150,12 +171,17 @@ struct _info **fprune(struct _info *head, bool matched, bool root)
   }
   dir[count] = NULL;
 
-  if (topsort) qsort(dir,count,sizeof(struct _info *),topsort);
+  if (w->topsort) {
+    int ph = stats_enter(PH_SORT);
+    stats_count[ST_QSORT]++;
+    sortdir(w, dir, count, w->topsort);
+    stats_leave(ph);
+  }
 
   return dir;
 }
 
-struct _info **file_getfulltree(char *d, u_long lev, dev_t dev, off_t *size, char **err)
+struct _info **file_getfulltree(struct walkopts *w, char *d, u_long lev, dev_t dev, off_t *size, char **err)
 {
   FILE *fp = (strcmp(d,".")? fopen(d,"r") : stdin);
   char *path, *spath, *s;
@@ -203,5 +229,5 @@ struct _info **file_getfulltree(char *d, u_long lev, dev_t dev, off_t *size, cha
   if (fp != stdin) fclose(fp);
 
   // Prune accumulated directory tree:
-  return fprune(root, FALSE, TRUE);
+  return fprune(w, root, NULL, FALSE, TRUE);
 }
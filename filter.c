@@ -18,9 +18,9 @@
  */
 #include "tree.h"
 
-struct ignorefile *filterstack = NULL;
+_Thread_local struct ignorefile *filterstack = NULL;
 
-static char fpattern[PATH_MAX];
+static _Thread_local char fpattern[PATH_MAX];
 
 void gittrim(char *s)
 {
@@ -122,23 +122,24 @@ struct ignorefile *pop_filterstack(void)
 /**
  * true if remove filter matches and no reverse filter matches.
  */
-int filtercheck(char *path, char *name, int isdir)
+static int dofiltercheck(struct walkopts *w, char *path, char *name, int isdir)
 {
   int filter = 0;
   struct ignorefile *ig;
   struct pattern *p;
 
+  stats_count[ST_FILTERCHECK]++;
   for(ig = filterstack; !filter && ig; ig = ig->next) {
     int fpos = sprintf(fpattern, "%s/", ig->path);
 
     for(p = ig->remove; p != NULL; p = p->next) {
-      if (patmatch(path, p->pattern, isdir) == 1) {
+      if (patmatch(path, p->pattern, isdir, w->ignorecase) == 1) {
 	filter = 1;
 	break;
       }
       if (p->pattern[0] == '/') continue;
       sprintf(fpattern + fpos, "%s", p->pattern);
-      if (patmatch(path, fpattern, isdir) == 1) {
+      if (patmatch(path, fpattern, isdir, w->ignorecase) == 1) {
 	filter = 1;
 	break;
       }
@@ -150,14 +151,24 @@ int filtercheck(char *path, char *name, int isdir)
     int fpos = sprintf(fpattern, "%s/", ig->path);
 
     for(p = ig->reverse; p != NULL; p = p->next) {
-      if (patmatch(path, p->pattern, isdir) == 1) return 0;
+      if (patmatch(path, p->pattern, isdir, w->ignorecase) == 1) return 0;
 
       if (p->pattern[0] == '/') continue;
       sprintf(fpattern + fpos, "%s", p->pattern);
 
-      if (patmatch(path, fpattern, isdir) == 1) return 0;
+      if (patmatch(path, fpattern, isdir, w->ignorecase) == 1) return 0;
     }
   }
 
   return 1;
 }
+
+int filtercheck(struct walkopts *w, char *path, char *name, int isdir)
+{
+  int filter;
+
+  TREE_PROBE1(filter_entry, path);
+  filter = dofiltercheck(w, path, name, isdir);
+  TREE_PROBE2(filter_return, path, filter);
+  return filter;
+}
@@ -18,98 +18,298 @@
  */
 #include "tree.h"
 
-/* Faster uid/gid -> name lookup with hash(tm)(r)(c) tables! */
-#define HASH(x)		((x)&255)
-struct xtable *gtable[256], *utable[256];
+/**
+ * uid/gid -> name lookup.  Open addressing tables with linear probing, keyed by
+ * a multiplicative hash of the id.  Ids that don't resolve are cached as well
+ * (negative entries, shown as the number) so no id is ever looked up twice.
+ * --preload-ids fills the tables from the passwd and group databases up
+ * front, and if they were enumerated through NSS, anything not found is taken
+ * to be unknown without asking again.  Lookups only take a read lock, a miss
+ * resolves the id with no lock held (getpwuid_r()/getgrgid_r()) and then takes
+ * the write lock to add it.  Names are never freed, so the returned pointers
+ * remain valid after the lock is dropped.
+ */
+struct idslot {
+  char *name;		/* NULL for an empty slot */
+  unsigned int id;
+  bool negative;
+};
+
+struct idtable {
+  struct idslot *slot;
+  u_long size, used;	/* size is always a power of two */
+  int bits;
+  bool complete;	/* Enumerated, a miss means the id is unknown */
+  pthread_rwlock_t lock;
+};
+
+static struct idtable users = { NULL, 0, 0, 0, FALSE, PTHREAD_RWLOCK_INITIALIZER };
+static struct idtable groups = { NULL, 0, 0, 0, FALSE, PTHREAD_RWLOCK_INITIALIZER };
+
+#define IDHASH(id,bits)	((u_long)(((unsigned long long)(id) * 0x9E3779B97F4A7C15ULL) >> (64 - (bits))))
 
 #define inohash(x)	((x)&255)
 struct inotable *itable[256];
+/* Renderer threads (--threads) share the inode table: */
+static pthread_mutex_t itlock = PTHREAD_MUTEX_INITIALIZER;
+/* ...unless the thread is walking a root of its own, see inotable_partition(): */
+static _Thread_local struct inotable **ipart = NULL;
 
-char *uidtoname(uid_t uid)
+static struct inotable **itable_lock(void)
 {
-  struct xtable *o, *p, *t;
-  struct passwd *ent;
-  char ubuf[32];
-  int uent = HASH(uid);
-  
-  for(o = p = utable[uent]; p ; p=p->nxt) {
-    if (uid == p->xid) return p->name;
-    else if (uid < p->xid) break;
-    o = p;
+  if (ipart) return ipart;
+  pthread_mutex_lock(&itlock);
+  return itable;
+}
+
+static void itable_unlock(void)
+{
+  if (!ipart) pthread_mutex_unlock(&itlock);
+}
+
+static struct idslot *idfind(struct idtable *t, unsigned int id)
+{
+  u_long i;
+
+  if (t->size == 0) return NULL;
+  for(i = IDHASH(id, t->bits); t->slot[i].name; i = (i+1) & (t->size-1))
+    if (t->slot[i].id == id) return &t->slot[i];
+  return NULL;
+}
+
+static void idinsert(struct idtable *t, struct idslot s)
+{
+  u_long i;
+
+  for(i = IDHASH(s.id, t->bits); t->slot[i].name; i = (i+1) & (t->size-1));
+  t->slot[i] = s;
+  t->used++;
+}
+
+static void idgrow(struct idtable *t)
+{
+  struct idslot *old = t->slot;
+  u_long i, oldsize = t->size;
+
+  t->bits = t->bits? t->bits+1 : 8;
+  t->size = 1UL << t->bits;
+  t->slot = xmalloc(sizeof(struct idslot) * t->size);
+  memset(t->slot, 0, sizeof(struct idslot) * t->size);
+  t->used = 0;
+  for(i=0; i < oldsize; i++)
+    if (old[i].name) idinsert(t, old[i]);
+  if (old) free(old);
+}
+
+/**
+ * Adds id to the table (the caller holds the write lock) unless it's already
+ * there, in which case the existing name wins.  Takes ownership of name.
+ */
+static char *idadd(struct idtable *t, unsigned int id, char *name, bool negative)
+{
+  struct idslot *s;
+
+  if ((s = idfind(t, id)) != NULL) {
+    free(name);
+    return s->name;
   }
-  /* Not found, do a real lookup and add to table */
-  t = xmalloc(sizeof(struct xtable));
-  if ((ent = getpwuid(uid)) != NULL) t->name = scopy(ent->pw_name);
-  else {
-    snprintf(ubuf,30,"%d",uid);
-    ubuf[31] = 0;
-    t->name = scopy(ubuf);
+  if ((t->used+1) * 4 > t->size * 3) idgrow(t);
+  idinsert(t, (struct idslot){ name, id, negative });
+  return name;
+}
+
+/**
+ * Reentrant NSS lookup, returns a copy of the name or NULL if there's none.
+ */
+static char *nsslookup(unsigned int id, bool user)
+{
+  struct passwd pw, *pwp = NULL;
+  struct group gr, *grp = NULL;
+  size_t size = 1024;
+  char *buf = NULL, *name = NULL;
+  int r, ph = stats_enter(PH_NAMES);
+
+  stats_count[user? ST_GETPWUID : ST_GETGRGID]++;
+  do {
+    buf = xrealloc(buf, size *= 2);
+    if (user) r = getpwuid_r(id, &pw, buf, size, &pwp);
+    else r = getgrgid_r(id, &gr, buf, size, &grp);
+  } while (r == ERANGE && size < 1024*1024);
+
+  if (user && pwp) name = scopy(pwp->pw_name);
+  if (!user && grp) name = scopy(grp->gr_name);
+  free(buf);
+  stats_leave(ph);
+  return name;
+}
+
+static char *idtoname(struct idtable *t, unsigned int id, bool user)
+{
+  struct idslot *s;
+  char *name, nbuf[32];
+  bool complete;
+
+  pthread_rwlock_rdlock(&t->lock);
+  s = idfind(t, id);
+  name = s? s->name : NULL;
+  complete = t->complete;
+  pthread_rwlock_unlock(&t->lock);
+
+  if (name) {
+    stats_count[user? ST_UID_HIT : ST_GID_HIT]++;
+    return name;
+  }
+
+  /* Not found, do a real lookup (unless we know there's no point) and add to table */
+  if (!complete) name = nsslookup(id, user);
+  if (name == NULL) {
+    snprintf(nbuf, sizeof(nbuf), "%u", id);
+    name = scopy(nbuf);
+    pthread_rwlock_wrlock(&t->lock);
+    name = idadd(t, id, name, TRUE);
+  } else {
+    pthread_rwlock_wrlock(&t->lock);
+    name = idadd(t, id, name, FALSE);
   }
-  t->xid = uid;
-  t->nxt = p;
-  if (p == utable[uent]) utable[uent] = t;
-  else o->nxt = t;
-  return t->name;
+  pthread_rwlock_unlock(&t->lock);
+  return name;
+}
+
+char *uidtoname(uid_t uid)
+{
+  return idtoname(&users, uid, TRUE);
 }
 
 char *gidtoname(gid_t gid)
 {
-  struct xtable *o, *p, *t;
-  struct group *ent;
-  char gbuf[32];
-  int gent = HASH(gid);
-  
-  for(o = p = gtable[gent]; p ; p=p->nxt) {
-    if (gid == p->xid) return p->name;
-    else if (gid < p->xid) break;
-    o = p;
+  return idtoname(&groups, gid, FALSE);
+}
+
+/**
+ * Reads name:x:id: lines from one of the local database files.
+ */
+static void idloadfile(struct idtable *t, char *file)
+{
+  char line[4096], *name, *p, *end;
+  unsigned long id;
+  FILE *fp;
+
+  if ((fp = fopen(file, "r")) == NULL) return;
+  while (fgets(line, sizeof(line), fp)) {
+    name = line;
+    if (*name == '#' || *name == '+' || *name == '-') continue;
+    if ((p = strchr(name, ':')) == NULL) continue;
+    *p++ = 0;
+    if ((p = strchr(p, ':')) == NULL) continue;
+    id = strtoul(++p, &end, 10);
+    if (end == p || *end != ':' || !*name) continue;
+    idadd(t, id, scopy(name), FALSE);
   }
-  /* Not found, do a real lookup and add to table */
-  t = xmalloc(sizeof(struct xtable));
-  if ((ent = getgrgid(gid)) != NULL) t->name = scopy(ent->gr_name);
-  else {
-    snprintf(gbuf,30,"%d",gid);
-    gbuf[31] = 0;
-    t->name = scopy(gbuf);
+  fclose(fp);
+}
+
+/**
+ * Fills both tables.  PRELOAD_FILES parses /etc/passwd and /etc/group and
+ * PRELOAD_NSS enumerates the databases once with getpwent()/getgrent(), misses
+ * are still looked up.  Only with PRELOAD_NSS_COMPLETE are the enumerated
+ * tables taken to be complete (sssd and LDAP often enumerate only part, or
+ * nothing).
+ */
+void preload_ids(int mode)
+{
+  struct passwd *pw;
+  struct group *gr;
+
+  pthread_rwlock_wrlock(&users.lock);
+  pthread_rwlock_wrlock(&groups.lock);
+  if (mode == PRELOAD_FILES) {
+    idloadfile(&users, "/etc/passwd");
+    idloadfile(&groups, "/etc/group");
+  } else {
+    setpwent();
+    while ((pw = getpwent()) != NULL) idadd(&users, pw->pw_uid, scopy(pw->pw_name), FALSE);
+    endpwent();
+    setgrent();
+    while ((gr = getgrent()) != NULL) idadd(&groups, gr->gr_gid, scopy(gr->gr_name), FALSE);
+    endgrent();
+    users.complete = groups.complete = (mode == PRELOAD_NSS_COMPLETE);
   }
-  t->xid = gid;
-  t->nxt = p;
-  if (p == gtable[gent]) gtable[gent] = t;
-  else o->nxt = t;
-  return t->name;
+  pthread_rwlock_unlock(&groups.lock);
+  pthread_rwlock_unlock(&users.lock);
 }
 
 /* Record inode numbers of followed sym-links to avoid refollowing them */
 void saveino(ino_t inode, dev_t device)
 {
-  struct inotable *it, *ip, *pp;
+  struct inotable **table = itable_lock(), *it, *ip, *pp;
   int hp = inohash(inode);
 
-  for(pp = ip = itable[hp];ip;ip = ip->nxt) {
+  for(pp = ip = table[hp];ip;ip = ip->nxt) {
     if (ip->inode > inode) break;
     if (ip->inode == inode && ip->device >= device) break;
     pp = ip;
   }
 
-  if (ip && ip->inode == inode && ip->device == device) return;
+  if (ip && ip->inode == inode && ip->device == device) {
+    itable_unlock();
+    return;
+  }
 
   it = xmalloc(sizeof(struct inotable));
   it->inode = inode;
   it->device = device;
   it->nxt = ip;
-  if (ip == itable[hp]) itable[hp] = it;
+  if (ip == table[hp]) table[hp] = it;
   else pp->nxt = it;
+  itable_unlock();
 }
 
 int findino(ino_t inode, dev_t device)
 {
-  struct inotable *it;
+  struct inotable **table = itable_lock(), *it;
+  int found;
 
-  for(it=itable[inohash(inode)]; it; it=it->nxt) {
+  for(it=table[inohash(inode)]; it; it=it->nxt) {
     if (it->inode > inode) break;
     if (it->inode == inode && it->device >= device) break;
   }
 
-  if (it && it->inode == inode && it->device == device) return TRUE;
-  return FALSE;
+  found = (it && it->inode == inode && it->device == device);
+  itable_unlock();
+
+  stats_count[found? ST_INO_HIT : ST_INO_MISS]++;
+  return found;
+}
+
+/* Forgets the recorded inodes, for the next walk */
+void free_inotable(void)
+{
+  struct inotable **table = itable_lock(), *it, *nxt;
+  int i;
+
+  for(i = 0; i < 256; i++) {
+    for(it = table[i]; it; it = nxt) {
+      nxt = it->nxt;
+      free(it);
+    }
+    table[i] = NULL;
+  }
+  itable_unlock();
+}
+
+/**
+ * Gives this thread an inode table of its own for a root it walks alone
+ * (own), or frees it and goes back to the shared one.
+ */
+void inotable_partition(bool own)
+{
+  if (ipart) {
+    free_inotable();
+    free(ipart);
+    ipart = NULL;
+  }
+  if (own) {
+    ipart = xmalloc(sizeof(struct inotable *) * 256);
+    memset(ipart, 0, sizeof(struct inotable *) * 256);
+  }
 }
@@ -19,20 +19,65 @@
 #include "tree.h"
 
 extern char *version, *hversion;
-extern bool dflag, lflag, pflag, sflag, Fflag, aflag, fflag, uflag, gflag;
-extern bool Dflag, inodeflag, devflag, Rflag, duflag, hflag, siflag;
-extern bool noindent, force_color, xdev, nolinks, flimit, metafirst, noreport;
+extern bool Fflag, fflag, Rflag, duflag, hflag, siflag;
+extern double samplerate;
+extern int deadline;
+extern u_long unscanned;
+extern bool noindent, force_color, nolinks, metafirst, noreport, summaryflag;
 extern char *host, *sp, *title;
 extern const char *charset;
 
-extern FILE *outfile;
-extern int Level, *dirs, maxdirs;
+extern _Thread_local FILE *outfile;
+extern _Thread_local int *dirs, maxdirs;
 
 extern bool colorize, linktargetcolor;
 extern char *endcode;
 extern const struct linedraw *linedraw;
 
-int htmldirlen = 0;
+extern bool siteflag;
+extern int lazylevel;
+extern _Thread_local int sitedepth;
+
+_Thread_local int htmldirlen = 0;
+
+/* --lazy: Opens (fetching it the first time) or closes a directory: */
+static const char *lazyscript =
+	" <script>\n"
+	"  document.addEventListener(\"click\", function(e) {\n"
+	"    var a = e.target.closest(\"a[data-lazy]\"), br, s;\n"
+	"    if (!a) return;\n"
+	"    e.preventDefault();\n"
+	"    for(br = a.nextSibling; br && br.nodeName != \"BR\"; br = br.nextSibling);\n"
+	"    if (!br) return;\n"
+	"    if ((s = br.nextSibling) && s.className == \"LAZY\") {\n"
+	"      s.hidden = !s.hidden;\n"
+	"      return;\n"
+	"    }\n"
+	"    s = document.createElement(\"span\");\n"
+	"    s.className = \"LAZY\";\n"
+	"    br.parentNode.insertBefore(s, br.nextSibling);\n"
+	"    fetch(a.getAttribute(\"data-lazy\")).then(function(r) { return r.json(); })\n"
+	"      .then(function(j) { s.innerHTML = j.html; })\n"
+	"      .catch(function(err) { s.textContent = \"[\" + err + \"]\"; });\n"
+	"  });\n"
+	" </script>\n";
+
+static const char *style =
+	"  BODY { font-family : monospace, sans-serif;  color: black;}\n"
+	"  P { font-family : monospace, sans-serif; color: black; margin:0px; padding: 0px;}\n"
+	"  A:visited { text-decoration : none; margin : 0px; padding : 0px;}\n"
+	"  A:link    { text-decoration : none; margin : 0px; padding : 0px;}\n"
+	"  A:hover   { text-decoration: underline; background-color : yellow; margin : 0px; padding : 0px;}\n"
+	"  A:active  { margin : 0px; padding : 0px;}\n"
+	"  .VERSION { font-size: small; font-family : arial, sans-serif; }\n"
+	"  .NORM  { color: black;  }\n"
+	"  .FIFO  { color: purple; }\n"
+	"  .CHAR  { color: yellow; }\n"
+	"  .DIR   { color: blue;   }\n"
+	"  .BLOCK { color: yellow; }\n"
+	"  .LINK  { color: aqua;   }\n"
+	"  .SOCK  { color: fuchsia;}\n"
+	"  .EXEC  { color: green;  }\n";
 
 char *class(struct _info *info)
 {
@@ -104,27 +149,35 @@ void html_intro(void)
 	" <meta http-equiv=\"Content-Type\" content=\"text/html; charset=%s\">\n"
 	" <meta name=\"Author\" content=\"Made by 'tree'\">\n"
 	" <meta name=\"GENERATOR\" content=\"%s\">\n"
-	" <title>%s</title>\n"
-	" <style type=\"text/css\">\n"
-	"  BODY { font-family : monospace, sans-serif;  color: black;}\n"
-	"  P { font-family : monospace, sans-serif; color: black; margin:0px; padding: 0px;}\n"
-	"  A:visited { text-decoration : none; margin : 0px; padding : 0px;}\n"
-	"  A:link    { text-decoration : none; margin : 0px; padding : 0px;}\n"
-	"  A:hover   { text-decoration: underline; background-color : yellow; margin : 0px; padding : 0px;}\n"
-	"  A:active  { margin : 0px; padding : 0px;}\n"
-	"  .VERSION { font-size: small; font-family : arial, sans-serif; }\n"
-	"  .NORM  { color: black;  }\n"
-	"  .FIFO  { color: purple; }\n"
-	"  .CHAR  { color: yellow; }\n"
-	"  .DIR   { color: blue;   }\n"
-	"  .BLOCK { color: yellow; }\n"
-	"  .LINK  { color: aqua;   }\n"
-	"  .SOCK  { color: fuchsia;}\n"
-	"  .EXEC  { color: green;  }\n"
-	" </style>\n"
+	" <title>%s</title>\n",charset ? charset : "iso-8859-1", version, title);
+  if (siteflag) {
+    fprintf(outfile," <link rel=\"stylesheet\" type=\"text/css\" href=\"");
+    for(int i=0; i < sitedepth; i++) fprintf(outfile,"../");
+    fprintf(outfile,"00Tree.css\">\n");
+  } else fprintf(outfile," <style type=\"text/css\">\n%s </style>\n", style);
+  fprintf(outfile,
+	"%s"
 	"</head>\n"
 	"<body>\n"
-	"\t<h1>%s</h1><p>\n",charset ? charset : "iso-8859-1", version, title, title);
+	"\t<h1>%s</h1><p>\n", lazylevel? lazyscript : "", title);
+}
+
+/**
+ * Writes the style sheet the --site pages share to dir/00Tree.css.
+ */
+void html_stylesheet(char *dir)
+{
+  char *path = xmalloc(strlen(dir) + 12);
+  FILE *fp;
+
+  sprintf(path, "%s/00Tree.css", dir);
+  if ((fp = fopen(path, "w")) == NULL) {
+    fprintf(stderr,"tree: invalid filename '%s'\n", path);
+    exit(1);
+  }
+  fputs(style, fp);
+  fclose(fp);
+  free(path);
 }
 
 void html_outtro(void)
@@ -146,11 +199,11 @@ void html_print(char *s)
   fprintf(outfile,"%s%s", sp, sp);
 }
 
-int html_printinfo(char *dirname, struct _info *file, int level)
+int html_printinfo(struct walkopts *w, char *dirname, struct _info *file, int level)
 {
   char info[512];
 
-  fillinfo(info,file);
+  fillinfo(w,info,file);
   if (metafirst) {
     if (info[0] == '[') {
       html_print(info);
@@ -168,9 +221,12 @@ int html_printinfo(char *dirname, struct _info *file, int level)
   return 0;
 }
 
-// descend == add 00Tree.html to the link
-int html_printfile(char *dirname, char *filename, struct _info *file, int descend)
+// descend == add 00Tree.html to the link, LAZYDESCEND == add where its listing is
+int html_printfile(struct walkopts *w, char *dirname, char *filename, struct _info *file, int descend)
 {
+  bool lazy = (descend >= LAZYDESCEND);
+
+  if (lazy) descend -= LAZYDESCEND;
   // Switch to using 'a' elements only. Omit href attribute if not a link
   fprintf(outfile,"<a");
   if (file) {
@@ -197,6 +253,14 @@ int html_printfile(char *dirname, char *filename, struct _info *file, int descen
 	fprintf(outfile,"%s\"",(descend > 1? "/00Tree.html" : ""));
       }
     }
+    if (lazy && dirname != NULL) {
+      int len = strlen(dirname);
+      fprintf(outfile," data-lazy=\"%s",host);
+      url_encode(outfile, dirname + (len >= htmldirlen? htmldirlen : 0));
+      putc('/',outfile);
+      url_encode(outfile, filename);
+      fprintf(outfile,"/00Tree.json\"");
+    }
   }
   fprintf(outfile, ">");
 
@@ -204,6 +268,7 @@ int html_printfile(char *dirname, char *filename, struct _info *file, int descen
   else html_encode(outfile, host);
 
   fprintf(outfile,"</a>");
+  if (file && file->truncated) fprintf(outfile, "  [not scanned]");
   return 0;
 }
 
@@ -223,20 +288,28 @@ void html_close(struct _info *file, int level, int needcomma)
   fprintf(outfile, "</%s><br>\n", file->tag);
 }
 
-void html_report(struct totals tot)
+void html_report(struct walkopts *w, struct totals tot)
 {
   char buf[256];
 
+  if (samplerate) tot = sample_totals(tot);
   fprintf(outfile,"<br><br><p>\n\n");
 
   if (duflag) {
     psize(buf, tot.size);
     fprintf(outfile,"%s%s used in ", buf, hflag || siflag? "" : " bytes");
   }
-  if (dflag)
+  if (w->dflag)
     fprintf(outfile,"%ld director%s\n",tot.dirs,(tot.dirs==1? "y":"ies"));
   else
     fprintf(outfile,"%ld director%s, %ld file%s\n",tot.dirs,(tot.dirs==1? "y":"ies"),tot.files,(tot.files==1? "":"s"));
 
+  if (samplerate) sample_print(outfile);
+  if (deadline && unscanned) fprintf(outfile,"(%lu director%s not scanned by the deadline)\n", unscanned, unscanned==1? "y":"ies");
   fprintf(outfile, "\n</p>\n");
+  if (summaryflag) {
+    fprintf(outfile, "<pre>");
+    summary_print(outfile, TRUE);
+    fprintf(outfile, "</pre>\n");
+  }
 }
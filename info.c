@@ -27,10 +27,10 @@
  * 	info messages
  * 	more info
  */
-extern FILE *outfile;
+extern _Thread_local FILE *outfile;
 extern const struct linedraw *linedraw;
 
-struct infofile *infostack = NULL;
+_Thread_local struct infofile *infostack = NULL;
 
 struct comment *new_comment(struct pattern *phead, char **line, int lines)
 {
@@ -141,7 +141,7 @@ struct infofile *pop_infostack(void)
  * Returns an info pointer if a path matches a pattern.
  * top == 1 if called in a directory with a .info file.
  */
-struct comment *infocheck(char *path, char *name, int top, int isdir)
+struct comment *infocheck(struct walkopts *w, char *path, char *name, int top, int isdir)
 {
   struct infofile *inf = infostack;
   struct comment *com;
@@ -152,8 +152,8 @@ struct comment *infocheck(char *path, char *name, int top, int isdir)
   for(inf = infostack; inf != NULL; inf = inf->next) {
     for(com = inf->comments; com != NULL; com = com->next) {
       for(p = com->pattern; p != NULL; p = p->next) {
-	if (patmatch(path, p->pattern, isdir) == 1) return com;
-	if (top && patmatch(name, p->pattern, isdir) == 1) return com;
+	if (patmatch(path, p->pattern, isdir, w->ignorecase) == 1) return com;
+	if (top && patmatch(name, p->pattern, isdir, w->ignorecase) == 1) return com;
       }
     }
     top = 0;
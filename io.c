@@ -0,0 +1,272 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
+/**
+ * File system aware throttling.  Each file system tree reads from is put in a
+ * class by its type, found with statfs() the first time one of its devices is
+ * seen: the root, and any directory or mount point below it on another device.
+ * A class limits how many threads --DU uses on it and how many directories
+ * they read at once, and may limit the rate of operations (opening a
+ * directory, or looking at an entry) with a token bucket, one for each
+ * device.  --io-rate N caps every file system at N operations a second.
+ * Network file systems are adaptive: their rate starts low and is raised a
+ * step each interval while the average latency of an operation stays near the
+ * best seen, and halved when it rises to twice that (and by at least half a
+ * millisecond), so tree backs off a loaded server by itself.
+ * Local file systems are only timed and throttled with --io-rate.
+ */
+#define IO_LOCAL	0
+#define IO_NETWORK	1
+#define IO_CLASSES	2
+
+#define IO_TICK		0.1	/* seconds between AIMD adjustments */
+#define IO_MINRATE	50.0
+#define IO_SLOWER	0.0005	/* seconds slower than the best to count as slower */
+
+struct ioclass {
+  char *name;
+  int threads, depth;	/* --DU threads, directories read at once (0: any) */
+  double start;		/* first rate if adaptive, 0 if not */
+  int busy;
+  pthread_cond_t free;
+};
+
+/* A device's token bucket and AIMD state: */
+struct iobucket {
+  double rate, tokens, last, tick, lat, latmin;
+  u_long nlat;
+};
+
+static struct ioclass classes[IO_CLASSES] = {
+  {"local", 16, 0, 0, .free = PTHREAD_COND_INITIALIZER},
+  {"network", 4, 4, 2000, .free = PTHREAD_COND_INITIALIZER},
+};
+
+double iorate = 0;	/* --io-rate, 0 for no cap */
+
+static pthread_mutex_t iolock = PTHREAD_MUTEX_INITIALIZER;
+static struct iomount {
+  dev_t dev;
+  int cls;
+  struct iobucket b;
+} *mounts = NULL;
+static int nmounts = 0;
+/* For threads that haven't said which device they're on: */
+static struct iobucket nodev;
+
+/* The file system this thread is working in, and its index in mounts: */
+static _Thread_local dev_t curdev = 0;
+static _Thread_local int curcls = IO_LOCAL, curmount = -1;
+
+static double io_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * The class of the file system of name in dfd (or of path name if dfd is
+ * AT_FDCWD).
+ */
+static int io_fstype(int dfd, char *name)
+{
+#ifdef __linux__
+  struct statfs sf;
+  int fd = openat(dfd, name, O_PATH | O_NOFOLLOW), r;
+
+  if (fd < 0) return IO_LOCAL;
+  r = fstatfs(fd, &sf);
+  close(fd);
+  if (r < 0) return IO_LOCAL;
+  switch((unsigned long)sf.f_type) {
+    case 0x6969:	/* NFS */
+    case 0x517B:	/* SMB */
+    case 0xFF534D42:	/* CIFS */
+    case 0xFE534D42:	/* SMB2 */
+    case 0x00C36400:	/* Ceph */
+    case 0x65735546:	/* FUSE (sshfs, s3fs, ...) */
+    case 0x5346414F:	/* AFS */
+    case 0x6B414653:	/* kAFS */
+    case 0x01021997:	/* 9P */
+    case 0x0BD00BD0:	/* Lustre */
+    case 0x47504653:	/* GPFS */
+    case 0x73757245:	/* Coda */
+    case 0x564C:	/* NCP */
+      return IO_NETWORK;
+  }
+#endif
+  return IO_LOCAL;
+}
+
+/**
+ * Notes that this thread is now working on device dev, where name in dfd is
+ * something on it, classifying the device if it hasn't been seen before.
+ */
+void io_dev(dev_t dev, int dfd, char *name)
+{
+  int i, cls;
+
+  if (dev == curdev && curmount >= 0) return;
+
+  pthread_mutex_lock(&iolock);
+  for(i = 0; i < nmounts && mounts[i].dev != dev; i++);
+  if (i < nmounts) cls = mounts[i].cls;
+  else {
+    pthread_mutex_unlock(&iolock);
+    cls = io_fstype(dfd, name);
+    pthread_mutex_lock(&iolock);
+    /* Another thread may have classified it meanwhile: */
+    for(i = 0; i < nmounts && mounts[i].dev != dev; i++);
+    if (i == nmounts) {
+      mounts = xrealloc(mounts, sizeof(struct iomount) * (nmounts+1));
+      memset(&mounts[nmounts], 0, sizeof(struct iomount));
+      mounts[nmounts].dev = dev;
+      mounts[nmounts++].cls = cls;
+    } else cls = mounts[i].cls;
+  }
+  pthread_mutex_unlock(&iolock);
+
+  curdev = dev;
+  curcls = cls;
+  curmount = i;
+}
+
+/**
+ * The current device's bucket, the caller holds iolock (mounts may move).
+ */
+static struct iobucket *io_bucket(void)
+{
+  return curmount < 0? &nodev : &mounts[curmount].b;
+}
+
+/**
+ * The number of threads --DU should use on the current file system.
+ */
+int io_threads(void)
+{
+  return classes[curcls].threads;
+}
+
+/**
+ * Waits until the current file system may take another operation.  Returns
+ * the time to give to io_end() if the operation is to be timed, or 0.
+ */
+double io_begin(void)
+{
+  struct ioclass *c = &classes[curcls];
+  struct iobucket *b;
+  double t, wait = 0, cap;
+
+  if (!c->start && !iorate) return 0;
+
+  pthread_mutex_lock(&iolock);
+  b = io_bucket();
+  t = io_now();
+  if (b->rate == 0) {
+    b->rate = c->start? c->start : iorate;
+    if (iorate && b->rate > iorate) b->rate = iorate;
+    b->tokens = 1;
+    b->last = b->tick = t;
+  }
+  /* Refill, allowing a burst of a tenth of a second: */
+  cap = b->rate * IO_TICK;
+  if (cap < 1) cap = 1;
+  b->tokens += (t - b->last) * b->rate;
+  if (b->tokens > cap) b->tokens = cap;
+  b->last = t;
+  if (--b->tokens < 0) wait = -b->tokens / b->rate;
+  pthread_mutex_unlock(&iolock);
+
+  if (wait > 0) {
+    struct timespec ts = { (time_t)wait, (long)((wait - (time_t)wait) * 1e9) };
+    nanosleep(&ts, NULL);
+  }
+  return c->start? io_now() : 0;
+}
+
+/**
+ * Accounts the latency of an adaptive file system's operation started at t0,
+ * and adjusts its rate once an interval.
+ */
+void io_end(double t0)
+{
+  struct ioclass *c = &classes[curcls];
+  struct iobucket *b;
+  double t, avg;
+
+  if (t0 == 0) return;
+  t = io_now();
+
+  pthread_mutex_lock(&iolock);
+  b = io_bucket();
+  b->lat += t - t0;
+  b->nlat++;
+  if (t - b->tick >= IO_TICK) {
+    avg = b->lat / b->nlat;
+    /* The best seen drifts up slowly, in case the server was idle then: */
+    b->latmin *= 1.01;
+    if (b->latmin == 0 || avg < b->latmin) b->latmin = avg;
+    if (avg > 2 * b->latmin && avg - b->latmin > IO_SLOWER) {
+      b->rate /= 2;
+      if (b->rate < IO_MINRATE) b->rate = IO_MINRATE;
+    } else {
+      b->rate += c->start / 4;
+      if (iorate && b->rate > iorate) b->rate = iorate;
+    }
+    b->lat = 0;
+    b->nlat = 0;
+    b->tick = t;
+  }
+  pthread_mutex_unlock(&iolock);
+}
+
+/**
+ * Waits for and takes one of the current file system's directory slots,
+ * returns what to give back to io_release().
+ */
+int io_acquire(void)
+{
+  struct ioclass *c = &classes[curcls];
+
+  if (c->depth) {
+    pthread_mutex_lock(&iolock);
+    while (c->busy >= c->depth) pthread_cond_wait(&c->free, &iolock);
+    c->busy++;
+    pthread_mutex_unlock(&iolock);
+  }
+  return curcls;
+}
+
+void io_release(int cls)
+{
+  struct ioclass *c = &classes[cls];
+
+  if (!c->depth) return;
+  pthread_mutex_lock(&iolock);
+  c->busy--;
+  pthread_cond_signal(&c->free);
+  pthread_mutex_unlock(&iolock);
+}
@@ -18,15 +18,17 @@
  */
 #include "tree.h"
 
-extern bool dflag, lflag, pflag, sflag, Fflag, aflag, fflag, uflag, gflag;
-extern bool Dflag, inodeflag, devflag, Rflag, cflag, hflag, siflag, duflag;
-extern bool noindent, force_color, xdev, nolinks, flimit, noreport;
+extern bool Fflag, fflag, Rflag, cflag, hflag, siflag, duflag;
+extern double samplerate;
+extern int deadline;
+extern u_long unscanned;
+extern bool noindent, force_color, nolinks, noreport, statsflag, profdirs, summaryflag;
 
 extern const int ifmt[];
 extern const char fmt[], *ftype[];
 
-extern FILE *outfile;
-extern int Level, *dirs, maxdirs, errors;
+extern _Thread_local FILE *outfile;
+extern _Thread_local int *dirs, maxdirs;
 
 extern char *endcode;
 
@@ -60,7 +62,7 @@ void json_encode(FILE *fd, char *s)
       if (ctrl[(unsigned char)*s] != '-') fprintf(fd, "\\%c", ctrl[(unsigned char)*s]);
       else fprintf(fd, "\\u%04x", (unsigned char)*s);
     } else if (*s == '"' || *s == '\\') fprintf(fd, "\\%c", *s);
-    else fprintf(fd, "%c", *s);
+    else putc(*s, fd);
   }
 }
 
@@ -73,35 +75,6 @@ void json_indent(int maxlevel)
     fprintf(outfile, "  ");
 }
 
-void json_fillinfo(struct _info *ent)
-{
-  #ifdef __USE_FILE_OFFSET64
-  if (inodeflag) fprintf(outfile,",\"inode\":%lld",(long long)ent->inode);
-  #else
-  if (inodeflag) fprintf(outfile,",\"inode\":%ld",(long int)ent->inode);
-  #endif
-  if (devflag) fprintf(outfile, ",\"dev\":%d", (int)ent->dev);
-  #ifdef __EMX__
-  if (pflag) fprintf(outfile, ",\"mode\":\"%04o\",\"prot\":\"%s\"",ent->attr, prot(ent->attr));
-  #else
-  if (pflag) fprintf(outfile, ",\"mode\":\"%04o\",\"prot\":\"%s\"", ent->mode & (S_IRWXU|S_IRWXG|S_IRWXO|S_ISUID|S_ISGID|S_ISVTX), prot(ent->mode));
-  #endif
-  if (uflag) fprintf(outfile, ",\"user\":\"%s\"", uidtoname(ent->uid));
-  if (gflag) fprintf(outfile, ",\"group\":\"%s\"", gidtoname(ent->gid));
-  if (sflag) {
-    if (hflag || siflag) {
-      char nbuf[64];
-      int i;
-      psize(nbuf,ent->size);
-      for(i=0; isspace(nbuf[i]); i++);	// trim() hack
-      fprintf(outfile, ",\"size\":\"%s\"", nbuf+i);
-    } else
-      fprintf(outfile, ",\"size\":%lld", (long long int)ent->size);
-  }
-  if (Dflag) fprintf(outfile, ",\"time\":\"%s\"", do_date(cflag? ent->ctime : ent->mtime));
-}
-
-
 void json_intro(void)
 {
   extern char *_nl;
@@ -114,7 +87,7 @@ void json_outtro(void)
   fprintf(outfile, "%s]\n", noindent? "" : _nl);
 }
 
-int json_printinfo(char *dirname, struct _info *file, int level)
+int json_printinfo(struct walkopts *w, char *dirname, struct _info *file, int level)
 {
   mode_t mt;
   int t;
@@ -131,7 +104,7 @@ int json_printinfo(char *dirname, struct _info *file, int level)
   return 0;
 }
 
-int json_printfile(char *dirname, char *filename, struct _info *file, int descend)
+int json_printfile(struct walkopts *w, char *dirname, char *filename, struct _info *file, int descend)
 {
   fprintf(outfile, ",\"name\":\"");
   json_encode(outfile, filename);
@@ -151,7 +124,7 @@ int json_printfile(char *dirname, char *filename, struct _info *file, int descen
     json_encode(outfile, file->lnk);
     fputc('"',outfile);
   }
-  if (file) json_fillinfo(file);
+  if (file) json_fillinfo(w, file);
 
   if (!descend) fputc('}',outfile);
   else fprintf(outfile, ",\"contents\":[");
@@ -178,11 +151,17 @@ void json_close(struct _info *file, int level, int needcomma)
   fprintf(outfile,"]}%s%s", needcomma? ",":"", noindent? "":"\n");
 }
 
-void json_report(struct totals tot)
+void json_report(struct walkopts *w, struct totals tot)
 {
+  if (samplerate) tot = sample_totals(tot);
   fprintf(outfile, ",%s{\"type\":\"report\"",noindent?"":"\n  ");
   if (duflag) fprintf(outfile,",\"size\":%lld", (long long int)tot.size);
   fprintf(outfile,",\"directories\":%ld", tot.dirs);
-  if (!dflag) fprintf(outfile,",\"files\":%ld", tot.files);
+  if (!w->dflag) fprintf(outfile,",\"files\":%ld", tot.files);
+  if (samplerate) sample_json();
+  if (deadline) fprintf(outfile,",\"truncated\":%lu", unscanned);
   fprintf(outfile, "}");
+  if (summaryflag) summary_json();
+  if (statsflag) stats_json();
+  if (profdirs) profile_json();
 }
@@ -0,0 +1,318 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+#include "libtree.h"
+
+extern bool colorize;
+extern int mb_cur_max;
+extern const char *charset;
+extern _Thread_local FILE *outfile;
+extern _Thread_local int *dirs, maxdirs;
+
+/**
+ * The library's side of libtree.h.  A struct tree holds the walk options for
+ * its calls, and each call runs with its own copy of them, its own inode
+ * table and error count, on the caller's thread.  The walk is read_dir()
+ * applied the way listentry() would, so the entries, their order and what is
+ * filtered out are what tree lists.
+ */
+struct tree {
+  struct walkopts w;
+};
+
+static pthread_once_t libonce = PTHREAD_ONCE_INIT;
+
+static void libinit(void)
+{
+  charset = getcharset();
+  if (charset == NULL && (!strcmp(nl_langinfo(CODESET), "UTF-8") || !strcmp(nl_langinfo(CODESET), "utf8")))
+    charset = "UTF-8";
+#ifdef MB_CUR_MAX
+  mb_cur_max = (int)MB_CUR_MAX;
+#else
+  mb_cur_max = 1;
+#endif
+  initlinedraw(0);
+  colorize = FALSE;
+  unix_compile();
+}
+
+static char **copypats(const char **p, int *n)
+{
+  char **c;
+
+  for(*n = 0; p && p[*n]; (*n)++);
+  if (*n == 0) return NULL;
+  c = xmalloc(sizeof(char *) * (*n + 1));
+  for(*n = 0; p[*n]; (*n)++) c[*n] = scopy(p[*n]);
+  c[*n] = NULL;
+  return c;
+}
+
+static void freepats(char **p)
+{
+  int i;
+
+  if (p == NULL) return;
+  for(i = 0; p[i]; i++) free(p[i]);
+  free(p);
+}
+
+struct tree *tree_new(const struct tree_options *opt)
+{
+  static int (*sorts[])() = { alnumsort, versort, fsizesort, mtimesort, ctimesort, NULL };
+  struct tree_options o = { 0 };
+  struct tree *t = xmalloc(sizeof(struct tree));
+  struct walkopts *w = &t->w;
+
+  if (opt) o = *opt;
+  if (o.sort < TREE_SORT_NAME || o.sort > TREE_SORT_NONE) o.sort = TREE_SORT_NAME;
+
+  memset(t, 0, sizeof(struct tree));
+  w->level = o.level > 0? o.level - 1 : -1;
+  w->aflag = o.all;
+  w->dflag = o.dirsonly;
+  w->lflag = o.follow;
+  w->xdev = o.xdev;
+  w->gitignore = o.gitignore;
+  w->ignorecase = o.ignorecase;
+  w->reverse = o.reverse;
+  w->patterns = copypats(o.include, &w->pattern);
+  w->ipatterns = copypats(o.exclude, &w->ipattern);
+  w->basesort = sorts[o.sort];
+  w->topsort = (o.dirsfirst && w->basesort)? dirsfirst : w->basesort;
+
+  w->inodeflag = (o.fields & TREE_FIELD_INODE) != 0;
+  w->devflag = (o.fields & TREE_FIELD_DEVICE) != 0;
+  w->pflag = (o.fields & TREE_FIELD_PERM) != 0;
+  w->uflag = (o.fields & TREE_FIELD_USER) != 0;
+  w->gflag = (o.fields & TREE_FIELD_GROUP) != 0;
+  w->sflag = (o.fields & TREE_FIELD_SIZE) != 0;
+  w->Dflag = (o.fields & TREE_FIELD_DATE) != 0;
+  fields_compile(w);
+  return t;
+}
+
+void tree_free(struct tree *t)
+{
+  if (t == NULL) return;
+  freepats(t->w.patterns);
+  freepats(t->w.ipatterns);
+  free(t);
+}
+
+/**
+ * Sets up a call's copy of t's options on this thread, with errors counted
+ * in *errs.  end() undoes it.
+ */
+static void begin(struct tree *t, struct walkopts *w, _Atomic int *errs)
+{
+  pthread_once(&libonce, libinit);
+  *w = t->w;
+  *errs = 0;
+  w->errors = errs;
+  inotable_partition(TRUE);
+}
+
+static void end(void)
+{
+  walk_release();
+  inotable_partition(FALSE);
+}
+
+static void fillentry(struct tree_entry *e, struct _info *info, char *path, int depth)
+{
+  e->name = info->name;
+  e->path = path;
+  e->depth = depth;
+  e->isdir = info->isdir;
+  e->mode = info->mode;
+  e->uid = info->uid;
+  e->gid = info->gid;
+  e->size = info->size;
+  e->atime = info->atime;
+  e->mtime = info->mtime;
+  e->ctime = info->ctime;
+  e->inode = info->inode;
+  e->dev = info->dev;
+  e->link = info->lnk;
+  e->orphan = info->orphan;
+  e->error = NULL;
+}
+
+/**
+ * Reads path for listing its entries, as listentry() does.  Returns NULL with
+ * *err set if it can't be, or NULL if it's empty.
+ */
+static struct _info **readsub(struct walkopts *w, char *path, struct ignorefile **ig, char **err)
+{
+  struct infofile *inf = NULL;
+  struct _info **dir;
+  int n;
+
+  *ig = NULL;
+  *err = NULL;
+  push_files(w, path, ig, &inf);
+  dir = read_dir(w, path, &n, FALSE);
+  if (dir == NULL && n) {
+    *err = "error opening dir";
+    (*w->errors)++;
+  }
+  if (dir && w->topsort) sortdir(w, dir, n, w->topsort);
+  return dir;
+}
+
+/**
+ * Calls back for each entry of dir (the listing of path) and descends.
+ * Returns TREE_STOP if the callback did.
+ */
+static int walkdir(struct walkopts *w, char *path, struct _info **dir, int depth, dev_t dev, tree_visit visit, void *arg)
+{
+  struct tree_entry e;
+  struct ignorefile *ig;
+  struct _info **sub;
+  char *subpath, *err, *target;
+  int r = TREE_CONTINUE, len = strlen(path);
+  bool descend, found;
+
+  for(; *dir && r != TREE_STOP; dir++) {
+    subpath = xmalloc(len + strlen((*dir)->name) + 2);
+    sprintf(subpath, "%s%s%s", path, path[len-1] == '/'? "" : "/", (*dir)->name);
+    fillentry(&e, *dir, subpath, depth);
+
+    sub = NULL;
+    ig = NULL;
+    descend = FALSE;
+    if ((*dir)->isdir) {
+      found = findino((*dir)->inode, (*dir)->dev);
+      if (!found) saveino((*dir)->inode, (*dir)->dev);
+      descend = !(w->xdev && dev != (*dir)->dev) && (!(*dir)->lnk || w->lflag) && (w->level < 0 || depth <= w->level);
+      if (descend && (*dir)->lnk && found) {
+	e.error = "recursive, not followed";
+	descend = FALSE;
+      }
+    }
+    if (descend) {
+      target = subpath;
+      if ((*dir)->lnk) {
+	target = xmalloc(len + strlen((*dir)->lnk) + 2);
+	if (*(*dir)->lnk == '/') strcpy(target, (*dir)->lnk);
+	else sprintf(target, "%s/%s", path, (*dir)->lnk);
+      }
+      sub = readsub(w, target, &ig, &err);
+      if (target != subpath) free(target);
+      e.error = err;
+    }
+
+    r = visit(&e, arg);
+    if (sub && r == TREE_CONTINUE) r = walkdir(w, subpath, sub, depth+1, dev, visit, arg);
+    if (sub) free_dir(sub);
+    if (ig) pop_filterstack();
+    free(subpath);
+  }
+  return r == TREE_STOP? TREE_STOP : TREE_CONTINUE;
+}
+
+/**
+ * Calls visit for root and everything below it, depth first in tree's order.
+ * Returns 0, TREE_STOP if visit stopped the walk, or -1 if root can't be
+ * looked at.
+ */
+int tree_walk(struct tree *t, const char *root, tree_visit visit, void *arg)
+{
+  struct walkopts w;
+  struct tree_entry e;
+  struct ignorefile *ig = NULL;
+  struct _info **dir = NULL, *info;
+  struct stat st;
+  char *path, *err = NULL;
+  _Atomic int errs;
+  int r;
+
+  begin(t, &w, &errs);
+
+  path = scopy(root);
+  if (lstat(path, &st) < 0) r = -1;
+  else {
+    saveino(st.st_ino, st.st_dev);
+    info = stat2info(&st);
+    info->name = path;
+    if (S_ISDIR(st.st_mode)) dir = readsub(&w, path, &ig, &err);
+    fillentry(&e, info, path, 0);
+    e.error = err;
+    r = visit(&e, arg);
+    if (dir && r == TREE_CONTINUE) r = walkdir(&w, path, dir, 1, st.st_dev, visit, arg);
+    if (r != TREE_STOP) r = 0;
+    if (dir) free_dir(dir);
+    if (ig) pop_filterstack();
+  }
+  free(path);
+
+  end();
+  return r;
+}
+
+/**
+ * Writes the listing of root in the given format to out, as tree would.
+ * Returns 0, or -1 if anything couldn't be listed.
+ */
+int tree_render(struct tree *t, const char *root, FILE *out, int format)
+{
+  FILE *outsave = outfile;
+  struct walkopts w;
+  char *paths[2];
+  _Atomic int errs;
+
+  begin(t, &w, &errs);
+
+  switch(format) {
+    case TREE_JSON:
+      w.lc = (struct listingcalls){
+	json_intro, json_outtro, json_printinfo, json_printfile, json_error, json_newline,
+	json_close, json_report
+      };
+      break;
+    case TREE_XML:
+      w.lc = (struct listingcalls){
+	xml_intro, xml_outtro, xml_printinfo, xml_printfile, xml_error, xml_newline,
+	xml_close, xml_report
+      };
+      break;
+    default:
+      w.lc = (struct listingcalls){
+	null_intro, null_outtro, unix_printinfo, unix_printfile, unix_error, unix_newline,
+	null_close, unix_report
+      };
+  }
+  if (dirs == NULL) {
+    dirs = xmalloc(sizeof(int) * (maxdirs = PATH_MAX));
+    memset(dirs, 0, sizeof(int) * maxdirs);
+  }
+
+  outfile = out;
+  paths[0] = scopy(root);
+  paths[1] = NULL;
+  emit_tree(&w, paths, FALSE);
+  free(paths[0]);
+  fflush(out);
+  outfile = outsave;
+
+  end();
+  return errs? -1 : 0;
+}
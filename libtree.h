@@ -0,0 +1,120 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * libtree: tree's directory walker and renderers as a library (make lib,
+ * which builds libtree.a and libtree.so).  A struct tree holds the options
+ * for a walk; tree_walk() calls back for each entry as tree would list it,
+ * and tree_render() writes the listing tree(1) would print to a stream.
+ *
+ * Any number of struct trees may be used from any number of threads, and
+ * walks and renders may run at the same time: each call walks with its own
+ * copy of its tree's options.  A struct tree must not be freed while a call
+ * that uses it runs, and a callback must not call tree_walk() or
+ * tree_render() itself.
+ */
+#ifndef _LIBTREE_H
+#define _LIBTREE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* libtree.so is built with hidden visibility, only what's marked is exported: */
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define TREE_API	__attribute__((visibility("default")))
+#else
+#define TREE_API
+#endif
+
+/* tree_options.sort: */
+#define TREE_SORT_NAME		0
+#define TREE_SORT_VERSION	1
+#define TREE_SORT_SIZE		2
+#define TREE_SORT_MTIME		3
+#define TREE_SORT_CTIME		4
+#define TREE_SORT_NONE		5	/* -U */
+
+/* tree_options.fields, the metadata tree_render() shows: */
+#define TREE_FIELD_INODE	0x01	/* --inodes */
+#define TREE_FIELD_DEVICE	0x02	/* --device */
+#define TREE_FIELD_PERM		0x04	/* -p */
+#define TREE_FIELD_USER		0x08	/* -u */
+#define TREE_FIELD_GROUP	0x10	/* -g */
+#define TREE_FIELD_SIZE		0x20	/* -s */
+#define TREE_FIELD_DATE		0x40	/* -D */
+
+/* tree_render() formats: */
+#define TREE_TEXT	0
+#define TREE_JSON	1	/* -J */
+#define TREE_XML	2	/* -X */
+
+/* What a tree_visit callback returns: */
+#define TREE_CONTINUE	0
+#define TREE_SKIP	1	/* don't descend into this directory */
+#define TREE_STOP	2	/* end the walk */
+
+struct tree_options {
+  int level;		/* -L, 0 for no limit */
+  int all;		/* -a */
+  int dirsonly;		/* -d */
+  int follow;		/* -l */
+  int xdev;		/* -x */
+  int gitignore;	/* --gitignore */
+  int ignorecase;	/* --ignore-case */
+  const char **include;	/* -P patterns, NULL terminated, or NULL */
+  const char **exclude;	/* -I patterns, NULL terminated, or NULL */
+  int sort;		/* TREE_SORT_* */
+  int reverse;		/* -r */
+  int dirsfirst;	/* --dirsfirst */
+  int fields;		/* TREE_FIELD_* */
+};
+
+struct tree_entry {
+  const char *name;
+  const char *path;	/* the root, a '/' and the names down to this one */
+  int depth;		/* 0 for the root */
+  int isdir;
+  mode_t mode;		/* lstat() */
+  uid_t uid;
+  gid_t gid;
+  off_t size;
+  time_t atime, mtime, ctime;
+  ino_t inode;		/* stat(), so a link's target */
+  dev_t dev;
+  const char *link;	/* the target if a symbolic link, else NULL */
+  int orphan;		/* the link's target doesn't exist */
+  const char *error;	/* why a directory couldn't be listed, or NULL */
+};
+
+typedef int (*tree_visit)(const struct tree_entry *ent, void *arg);
+
+TREE_API struct tree *tree_new(const struct tree_options *opt);
+TREE_API void tree_free(struct tree *t);
+TREE_API int tree_walk(struct tree *t, const char *root, tree_visit visit, void *arg);
+TREE_API int tree_render(struct tree *t, const char *root, FILE *out, int format);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -18,21 +18,33 @@
  */
 #include "tree.h"
 
-extern bool dflag, lflag, pflag, sflag, Fflag, aflag, fflag, uflag, gflag;
-extern bool Dflag, Hflag, inodeflag, devflag, Rflag, duflag, pruneflag, metafirst;
-extern bool hflag, siflag, noreport, noindent, force_color, xdev, nolinks, flimit;
-
-extern struct _info **(*getfulltree)(char *d, u_long lev, dev_t dev, off_t *size, char **err);
-extern int (*topsort)();
-extern FILE *outfile;
-extern int Level, *dirs, maxdirs, errors;
-extern int htmldirlen;
+extern bool Fflag, fflag, Hflag, Rflag, duflag, pruneflag, metafirst;
+extern bool hflag, siflag, noreport, noindent, force_color, nolinks;
+extern int flimit;
+extern bool profannotate, statsflag, siteflag, summaryflag, rootthreads;
+extern _Thread_local struct ignorefile *filterstack;
+extern _Thread_local struct infofile *infostack;
+extern int nthreads, lazylevel;
+
+extern struct _info **(*getfulltree)(struct walkopts *w, char *d, u_long lev, dev_t dev, off_t *size, char **err);
+extern _Thread_local FILE *outfile;
+extern _Thread_local int *dirs, maxdirs;
+extern _Thread_local int htmldirlen;
 
 extern bool colorize, linktargetcolor;
 extern char *endcode;
 extern const struct linedraw *linedraw;
 
-static char errbuf[256];
+static _Thread_local char errbuf[256];
+
+static char *entrypath(char *dirname, int *plen);
+static struct totals listentry(struct walkopts *w, char *dirname, int plen, struct _info **dir, int lev, dev_t dev, bool hasfulltree, char *path);
+static void prune_next(struct walkopts *w, char *dirname, struct _info **dir, int lev, dev_t dev);
+static struct totals listparallel(struct walkopts *w, char *dirname, struct _info **dir, int n, int lev, dev_t dev);
+static struct totals listlazy(struct walkopts *w, char *dirname, struct _info **dir, int lev, dev_t dev, bool hasfulltree);
+static struct totals emitparallel(struct walkopts *w, char **dirname, bool needfulltree);
+
+static _Thread_local bool inroot = FALSE;	/* On one of emitparallel()'s threads */
 
 /**
  * Maybe TODO: Refactor the listing calls / when they are called.  A more thorough
@@ -40,8 +52,6 @@ static char errbuf[256];
  * had hoped it to be.
  */
 
-extern struct listingcalls lc;
-
 void null_intro(void)
 {
   return;
@@ -56,194 +66,633 @@ void null_close(struct _info *file, int level, int needcomma)
 {
 }
 
-void emit_tree(char **dirname, bool needfulltree)
+/**
+ * Walks and lists one of the directories given, more if others follow it.
+ */
+static struct totals emitroot(struct walkopts *w, char *dirname, bool needfulltree, bool more)
 {
   struct totals tot = { 0 };
   struct ignorefile *ig = NULL;
   struct infofile *inf = NULL;
   struct _info **dir = NULL, *info = NULL;
   char *err;
-  int i, j, n, needsclosed;
+  int j, n, needsclosed;
   struct stat st;
 
-  lc.intro();
-
-  for(i=0; dirname[i]; i++) {
-    if (fflag) {
-      j=strlen(dirname[i]);
-      do {
-	if (j > 1 && dirname[i][j-1] == '/') dirname[i][--j] = 0;
-      } while (j > 1 && dirname[i][j-1] == '/');
-    }
-    if (Hflag) htmldirlen = strlen(dirname[i]);
-
-    if ((n = lstat(dirname[i],&st)) >= 0) {
-      saveino(st.st_ino, st.st_dev);
-      info = stat2info(&st);
-      info->name = dirname[i];
-
-      if (needfulltree) {
-	dir = getfulltree(dirname[i], 0, st.st_dev, &(info->size), &err);
-	n = err? -1 : 0;
-      } else {
-	push_files(dirname[i], &ig, &inf);
-	dir = read_dir(dirname[i], &n, inf != NULL);
+  if (fflag) {
+    j=strlen(dirname);
+    do {
+      if (j > 1 && dirname[j-1] == '/') dirname[--j] = 0;
+    } while (j > 1 && dirname[j-1] == '/');
+  }
+  if (Hflag) htmldirlen = strlen(dirname);
+
+  stats_count[ST_LSTAT]++;
+  if ((n = lstat(dirname,&st)) >= 0) {
+    int mark = profile_last();
+    saveino(st.st_ino, st.st_dev);
+    io_dev(st.st_dev, AT_FDCWD, dirname);
+    info = stat2info(&st);
+    info->name = dirname;
+
+    if (needfulltree) {
+      /* --site reads past -L, for the pages below it: */
+      struct walkopts all = *w;
+      if (siteflag) all.level = -1;
+      dir = getfulltree(&all, dirname, 0, st.st_dev, &(info->size), &err);
+      n = err? -1 : 0;
+      if (siteflag && info->isdir) html_stylesheet(dirname);
+    } else {
+      push_files(w, dirname, &ig, &inf);
+      if (flimit > 0 && (n = filelimit_count(w, dirname)) > 0) dir = NULL;
+      else dir = read_dir(w, dirname, &n, inf != NULL);
+      if (pruneflag && dir && !(flimit > 0 && n > flimit)) {
+	prune_next(w, dirname, dir, 1, 0);
+	if (*dir == NULL) {
+	  free_dir(dir);
+	  dir = NULL;
+	  n = 0;
+	}
       }
+    }
+    if (profile_last() > mark) info->prof = mark+1;
+
+    w->lc.printinfo(w, dirname, info, 0);
+  } else info = NULL;
+
+  needsclosed = w->lc.printfile(w, NULL, dirname, info, dir != NULL || (flimit > 0 && n > flimit));
+
+  if (flimit > 0 && n > flimit) {
+    w->lc.error(filelimit_msg(errbuf, n));
+    w->lc.newline(info, 0, 0, more);
+    (*w->errors)++;
+    if (dir) free_dir(dir);
+    dir = NULL;
+  } else if (!dir && n) {
+    w->lc.error("error opening dir");
+    w->lc.newline(info, 0, 0, more);
+    (*w->errors)++;
+  } else {
+    w->lc.newline(info, 0, 0, 0);
+    if (dir) {
+      tot = listdir(w, dirname, dir, 1, 0, needfulltree);
+      if (siteflag) site_finish();
+      free_dir(dir);
+    } else tot = (struct totals){0, 0};
+  }
+  if (needsclosed) w->lc.close(info, 0, more);
 
-      lc.printinfo(dirname[i], info, 0);
-    } else info = NULL;
+  if (duflag) tot.size = info->size;
+  else tot.size += st.st_size;
 
-    needsclosed = lc.printfile(NULL, dirname[i], info, dir != NULL);
+  if (ig != NULL) ig = pop_filterstack();
+  if (inf != NULL) inf = pop_infostack();
+  return tot;
+}
 
-    if (!dir && n) {
-      lc.error("error opening dir");
-      lc.newline(info, 0, 0, dirname[i+1] != NULL);
-      errors++;
-    } else if (flimit > 0 && n > flimit) {
-      sprintf(errbuf,"%d entries exceeds filelimit, not opening dir", n);
-      lc.error(errbuf);
-      lc.newline(info, 0, 0, dirname[i+1] != NULL);
-      errors++;
-    } else {
-      lc.newline(info, 0, 0, 0);
-      if (dir) {
-	tot = listdir(dirname[i], dir, 1, 0, needfulltree);
-	free_dir(dir);
-      } else tot = (struct totals){0, 0};
-    }
-    if (needsclosed) lc.close(info, 0, dirname[i+1] != NULL);
+void emit_tree(struct walkopts *w, char **dirname, bool needfulltree)
+{
+  struct totals tot = { 0 }, sub;
+  int i;
 
-    if (duflag) tot.size = info->size;
-    else tot.size += st.st_size;
+  w->lc.intro();
 
-    if (ig != NULL) ig = pop_filterstack();
-    if (inf != NULL) inf = pop_infostack();
+  if (rootthreads && dirname[0] && dirname[1]) tot = emitparallel(w, dirname, needfulltree);
+  else for(i=0; dirname[i]; i++) {
+    sub = emitroot(w, dirname[i], needfulltree, dirname[i+1] != NULL);
+    tot.dirs += sub.dirs;
+    tot.files += sub.files;
+    tot.size += sub.size;
   }
+  walk_release();
 
-  if (!noreport) lc.report(tot);
+  if (!noreport) w->lc.report(w, tot);
 
-  lc.outtro();
+  w->lc.outtro();
 }
 
-struct totals listdir(char *dirname, struct _info **dir, int lev, dev_t dev, bool hasfulltree)
+struct totals listdir(struct walkopts *w, char *dirname, struct _info **dir, int lev, dev_t dev, bool hasfulltree)
 {
   struct totals tot = {0}, subtotal;
-  struct ignorefile *ig = NULL;
-  struct infofile *inf = NULL;
-  struct _info **subdir;
-  int descend, htmldescend = 0, found, n, dirlen = strlen(dirname), pathlen = dirlen + 257;
-  int needsclosed;
-  char *path, *newpath, *filename, *err = NULL;
-
-  int es = (dirname[strlen(dirname) - 1] == '/');
+  int n, plen;
+  char *path;
 
   for(n=0; dir[n]; n++);
-  if (topsort) qsort(dir, n, sizeof(struct _info *), topsort);
+  if (w->topsort) {
+    int ph = stats_enter(PH_SORT);
+    stats_count[ST_QSORT]++;
+    TREE_PROBE2(sort_entry, dirname, n);
+    sortdir(w, dir, n, w->topsort);
+    TREE_PROBE2(sort_return, dirname, n);
+    stats_leave(ph);
+  }
 
   dirs[lev] = *(dir+1)? 1 : 2;
 
-  path = xmalloc(sizeof(char) * pathlen);
+  if (lev == 1 && n > 1 && nthreads > 1 && hasfulltree && !Rflag && !statsflag && !inroot) {
+    tot = listparallel(w, dirname, dir, n, lev, dev);
+    dirs[lev] = 0;
+    return tot;
+  }
+
+  path = entrypath(dirname, &plen);
 
   for (;*dir != NULL; dir++) {
-    lc.printinfo(dirname, *dir, lev);
+    /* The entry and the one after it have to be known to survive --prune: */
+    if (pruneflag && !hasfulltree) {
+      prune_next(w, dirname, dir, lev, dev);
+      if (*dir == NULL) break;
+      prune_next(w, dirname, dir+1, lev, dev);
+      dirs[lev] = *(dir+1)? 1 : 2;
+    }
+    subtotal = listentry(w, dirname, plen, dir, lev, dev, hasfulltree, path);
+    tot.dirs += subtotal.dirs;
+    tot.files += subtotal.files;
+    tot.size += subtotal.size;
+  }
+
+  dirs[lev] = 0;
+  free(path);
+  return tot;
+}
 
-    if (es) sprintf(path,"%s%s",dirname,(*dir)->name);
-    else sprintf(path,"%s/%s",dirname,(*dir)->name);
-    if (fflag) filename = path;
-    else filename = (*dir)->name;
+/**
+ * A buffer for the paths of dirname's entries, holding dirname and a '/'; the
+ * entry's name goes at *plen.
+ */
+static char *entrypath(char *dirname, int *plen)
+{
+  int len = strlen(dirname);
+  char *path = xmalloc(len + 257);
 
-    descend = 0;
-    err = NULL;
+  memcpy(path, dirname, len);
+  if (len == 0 || dirname[len-1] != '/') path[len++] = '/';
+  *plen = len;
+  return path;
+}
 
-    if ((*dir)->isdir) {
-      tot.dirs++;
+/**
+ * Lists one entry of a directory and everything below it.  path is from
+ * entrypath(), the entry's name is copied in after the directory's.
+ */
+static struct totals listentry(struct walkopts *w, char *dirname, int plen, struct _info **dir, int lev, dev_t dev, bool hasfulltree, char *path)
+{
+  struct totals tot = {0}, subtotal;
+  struct ignorefile *ig = NULL;
+  struct infofile *inf = NULL;
+  struct _info **subdir;
+  int descend, htmldescend = 0, found, n;
+  int needsclosed;
+  char *newpath, *filename, *err = NULL;
 
-      found = findino((*dir)->inode,(*dir)->dev);
-      if (!found) saveino((*dir)->inode, (*dir)->dev);
+  w->lc.printinfo(w, dirname, *dir, lev);
 
-      if (!(xdev && dev != (*dir)->dev) && (!(*dir)->lnk || ((*dir)->lnk && lflag))) {
-	descend = 1;
-	newpath = path;
+  strcpy(path + plen, (*dir)->name);
+  if (fflag) filename = path;
+  else filename = (*dir)->name;
 
-	if ((*dir)->lnk) {
-	  if (*(*dir)->lnk == '/') newpath = (*dir)->lnk;
-	  else {
-	    if (fflag && !strcmp(dirname,"/")) sprintf(path,"%s%s",dirname,(*dir)->lnk);
-	    else sprintf(path,"%s/%s",dirname,(*dir)->lnk);
-	  }
-	  if (found) {
-	    err = "recursive, not followed";
-	    descend = 0;
-	  }
-	}
+  descend = 0;
+  err = NULL;
+
+  if ((*dir)->isdir) {
+    tot.dirs++;
+
+    found = findino((*dir)->inode,(*dir)->dev);
+    if (!found) saveino((*dir)->inode, (*dir)->dev);
+
+    if (!(w->xdev && dev != (*dir)->dev) && (!(*dir)->lnk || ((*dir)->lnk && w->lflag))) {
+      descend = 1;
+      newpath = path;
 
-	if ((Level >= 0) && (lev > Level)) {
-	  if (Rflag) {
-	    FILE *outsave = outfile;
-	    char *paths[2] = {newpath, NULL}, *output = xmalloc(strlen(newpath) + 13);
-	    int *dirsave = xmalloc(sizeof(int) * (lev + 2));
-
-	    memcpy(dirsave, dirs, sizeof(int) * (lev+1));
-	    sprintf(output, "%s/00Tree.html", newpath);
-	    setoutput(output);
-	    emit_tree(paths, hasfulltree);
-
-	    free(output);
-	    fclose(outfile);
-	    outfile = outsave;
-
-	    memcpy(dirs, dirsave, sizeof(int) * (lev+1));
-	    free(dirsave);
-	    htmldescend = 10;
-	  } else htmldescend = 0;
+      if ((*dir)->lnk) {
+	if (*(*dir)->lnk == '/') newpath = (*dir)->lnk;
+	else {
+	  if (fflag && !strcmp(dirname,"/")) sprintf(path,"%s%s",dirname,(*dir)->lnk);
+	  else sprintf(path,"%s/%s",dirname,(*dir)->lnk);
+	}
+	if (found) {
+	  err = "recursive, not followed";
 	  descend = 0;
 	}
+      }
+
+      if ((w->level >= 0) && (lev > w->level)) {
+	if (siteflag) {
+	  site_page(w, newpath, *dir, lev);
+	  htmldescend = 10;
+	} else if (Rflag) {
+	  FILE *outsave = outfile;
+	  char *paths[2] = {newpath, NULL}, *output = xmalloc(strlen(newpath) + 13);
+	  int *dirsave = xmalloc(sizeof(int) * (lev + 2));
+
+	  memcpy(dirsave, dirs, sizeof(int) * (lev+1));
+	  sprintf(output, "%s/00Tree.html", newpath);
+	  setoutput(output);
+	  emit_tree(w, paths, hasfulltree);
+
+	  free(output);
+	  fclose(outfile);
+	  outfile = outsave;
+
+	  memcpy(dirs, dirsave, sizeof(int) * (lev+1));
+	  free(dirsave);
+	  htmldescend = 10;
+	} else htmldescend = 0;
+	descend = 0;
+      }
 
-	if (descend) {
-	  if (hasfulltree) {
-	    subdir = (*dir)->child;
-	    err = (*dir)->err;
-	  } else {
-	    push_files(newpath, &ig, &inf);
-	    subdir = read_dir(newpath, &n, inf != NULL);
-	    if (!subdir && n) {
-	      err = "error opening dir";
-	      errors++;
-	    } if (flimit > 0 && n > flimit) {
-	      sprintf(err = errbuf,"%d entries exceeds filelimit, not opening dir", n);
-	      errors++;
-	      free_dir(subdir);
-	      subdir = NULL;
-	    }
+      if (descend) {
+	if (hasfulltree) {
+	  subdir = (*dir)->child;
+	  err = (*dir)->err;
+	} else if ((*dir)->child) {
+	  /* Already read by prune_next(): */
+	  subdir = (*dir)->child;
+	  (*dir)->child = NULL;
+	  push_filterstack(ig = (*dir)->ig);
+	  push_infostack(inf = (*dir)->inf);
+	} else {
+	  push_files(w, newpath, &ig, &inf);
+	  if (flimit > 0 && (n = filelimit_count(w, newpath)) > 0) subdir = NULL;
+	  else subdir = read_dir(w, newpath, &n, inf != NULL);
+	  if (profannotate) (*dir)->prof = profile_last();
+	  if (flimit > 0 && n > flimit) {
+	    err = filelimit_msg(errbuf, n);
+	    (*w->errors)++;
+	    if (subdir) free_dir(subdir);
+	    subdir = NULL;
+	  } else if (!subdir && n) {
+	    err = "error opening dir";
+	    (*w->errors)++;
 	  }
-	  if (subdir == NULL) descend = 0;
 	}
+	if (subdir == NULL) descend = 0;
       }
-    } else tot.files++;
+    }
+  } else tot.files++;
+
+  if (descend && lazylevel && lev >= lazylevel) htmldescend = LAZYDESCEND;
+  needsclosed = w->lc.printfile(w, dirname, filename, *dir, descend + htmldescend);
+  if (err) w->lc.error(err);
+
+  if (descend) {
+    w->lc.newline(*dir, lev, 0, 0);
 
-    needsclosed = lc.printfile(dirname, filename, *dir, descend + htmldescend);
-    if (err) lc.error(err);
+    if (htmldescend == LAZYDESCEND) subtotal = listlazy(w, newpath, subdir, lev+1, dev, hasfulltree);
+    else subtotal = listdir(w, newpath, subdir, lev+1, dev, hasfulltree);
+    tot.dirs += subtotal.dirs;
+    tot.files += subtotal.files;
+    tot.size += subtotal.size;
+    free_dir(subdir);
+  } else if (!needsclosed) w->lc.newline(*dir, lev, 0, *(dir+1)!=NULL);
 
-    if (descend) {
-      lc.newline(*dir, lev, 0, 0);
+  if (needsclosed) w->lc.close(*dir, descend? lev : -1, *(dir+1)!=NULL);
 
-      subtotal = listdir(newpath, subdir, lev+1, dev, hasfulltree);
-      tot.dirs += subtotal.dirs;
-      tot.files += subtotal.files;
-      tot.size += subtotal.size;
-      free_dir(subdir);
-    } else if (!needsclosed) lc.newline(*dir, lev, 0, *(dir+1)!=NULL);
+  if (*(dir+1) && !*(dir+2)) dirs[lev] = 2;
+  tot.size += (*dir)->size;
+  if (summaryflag) summary_entry(dirname, *dir, tot.size);
 
-    if (needsclosed) lc.close(*dir, descend? lev : -1, *(dir+1)!=NULL);
+  if (ig != NULL) ig = pop_filterstack();
+  if (inf != NULL) inf = pop_infostack();
 
-    if (*(dir+1) && !*(dir+2)) dirs[lev] = 2;
-    tot.size += (*dir)->size;
+  return tot;
+}
 
-    if (ig != NULL) ig = pop_filterstack();
-    if (inf != NULL) inf = pop_infostack();
+/**
+ * --lazy: Below the first lazylevel levels a directory's listing goes to a
+ * 00Tree.json in it instead of the page, as the HTML it would have been in a
+ * JSON string, and its link in the page (or in its parent's 00Tree.json) says
+ * where that is, for the page's script to fetch when the directory is opened.
+ * The HTML is rendered as usual, dirs[] and all, into a memory stream first.
+ */
+static struct totals listlazy(struct walkopts *w, char *dirname, struct _info **dir, int lev, dev_t dev, bool hasfulltree)
+{
+  FILE *outsave = outfile, *fp;
+  struct totals tot;
+  char *buf = NULL, *path = xmalloc(strlen(dirname) + 13);
+  size_t len;
+
+  if ((outfile = open_memstream(&buf, &len)) == NULL) {
+    fprintf(stderr,"tree: unable to allocate an output buffer.\n");
+    exit(1);
+  }
+  tot = listdir(w, dirname, dir, lev, dev, hasfulltree);
+  fclose(outfile);
+  outfile = outsave;
+
+  sprintf(path, "%s/00Tree.json", dirname);
+  if ((fp = fopen(path, "w")) == NULL) {
+    fprintf(stderr,"tree: unable to write %s: %s\n", path, strerror(errno));
+    (*w->errors)++;
+  } else {
+    fprintf(fp, "{\"html\":\"");
+    json_encode(fp, buf);
+    fprintf(fp, "\"}\n");
+    fclose(fp);
   }
+  free(buf);
+  free(path);
+  return tot;
+}
 
-  dirs[lev] = 0;
+/**
+ * Streaming --prune: rather than reading the whole tree first, entries are
+ * resolved just ahead of the listing.  A directory survives if anything under
+ * it does, so it's read (along with its entries up to the first survivor)
+ * when the listing gets to it or to the entry before it, and the read is kept
+ * on the entry for listentry(), along with its .gitignore and .info, which
+ * are taken off the stacks until then.  Pruned entries are removed from the
+ * list as unix_getfulltree() does, so what is held in memory at any time is
+ * the directories along the current path and the first surviving path under
+ * each of their next entries.
+ */
+static bool pruned(struct walkopts *w, char *dirname, struct _info *ent, int lev, dev_t dev)
+{
+  struct ignorefile *ig = NULL;
+  struct infofile *inf = NULL;
+  struct _info **sub;
+  char *path;
+  int n;
+
+  if (!ent->isdir || ent->child || (w->xdev && dev != ent->dev)) return FALSE;
+  if (ent->lnk || (w->level >= 0 && lev > w->level)) return TRUE;
+
+  path = xmalloc(strlen(dirname) + strlen(ent->name) + 2);
+  if (dirname[strlen(dirname)-1] == '/') sprintf(path,"%s%s",dirname,ent->name);
+  else sprintf(path,"%s/%s",dirname,ent->name);
+
+  push_files(w, path, &ig, &inf);
+  if (flimit > 0 && (n = filelimit_count(w, path)) > 0) sub = NULL;
+  else sub = read_dir(w, path, &n, inf != NULL);
+  if (profannotate) ent->prof = profile_last();
+  if (flimit > 0 && n > flimit) {
+    if (sub) free_dir(sub);
+    sub = NULL;
+  } else if (sub == NULL && n) (*w->errors)++;
+  if (sub) {
+    prune_next(w, path, sub, lev+1, dev);
+    if (*sub == NULL) {
+      free_dir(sub);
+      sub = NULL;
+    }
+  }
+  free(path);
+
+  if (sub == NULL) {
+    if (ig != NULL) pop_filterstack();
+    if (inf != NULL) pop_infostack();
+    return TRUE;
+  }
+  if (ig != NULL) filterstack = ig->next;
+  if (inf != NULL) infostack = inf->next;
+  ent->child = sub;
+  ent->ig = ig;
+  ent->inf = inf;
+  return FALSE;
+}
+
+/**
+ * Removes pruned entries from the front of dir, leaving it at the first
+ * surviving entry or the end of the list.
+ */
+static void prune_next(struct walkopts *w, char *dirname, struct _info **dir, int lev, dev_t dev)
+{
+  struct _info *sp, **p;
+
+  while (*dir && pruned(w, dirname, *dir, lev, dev)) {
+    sp = *dir;
+    for(p=dir; *p; p++) *p = *(p+1);
+    free(sp->name);
+    if (sp->lnk) free(sp->lnk);
+    free(sp);
+  }
+}
+
+/**
+ * --threads: Once the whole tree is in memory the entries of a top level
+ * directory can be rendered independently.  Each renderer thread has its own
+ * outfile (a memory stream), dirs[] and htmldirlen, and takes the next entry
+ * to render; this thread writes the finished buffers out in order, so the
+ * output is the same as rendering serially.  Renderers stay at most
+ * RENDER_AHEAD entries per thread ahead of the writer to bound the memory
+ * held in buffers.
+ */
+#define RENDER_AHEAD	4
+
+struct renderjob {
+  char *buf;
+  size_t len;
+  struct totals tot;
+  bool done;
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t done, room;
+  struct renderjob *jobs;
+  struct walkopts *w;
+  struct _info **dir;
+  char *dirname;
+  int n, lev, next, written, *dirs, maxdirs, htmldirlen;
+  dev_t dev;
+} render = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static void *renderer(void *arg)
+{
+  struct renderjob *job;
+  char *path;
+  int i, plen;
+
+  dirs = xmalloc(sizeof(int) * (maxdirs = render.maxdirs));
+  htmldirlen = render.htmldirlen;
+  path = entrypath(render.dirname, &plen);
+
+  pthread_mutex_lock(&render.lock);
+  for(;;) {
+    while (render.next < render.n && render.next >= render.written + nthreads * RENDER_AHEAD)
+      pthread_cond_wait(&render.room, &render.lock);
+    if (render.next >= render.n) break;
+    job = &render.jobs[i = render.next++];
+    pthread_mutex_unlock(&render.lock);
+
+    memcpy(dirs, render.dirs, sizeof(int) * maxdirs);
+    dirs[render.lev] = (i == render.n-1)? 2 : 1;
+    if ((outfile = open_memstream(&job->buf, &job->len)) == NULL) {
+      fprintf(stderr,"tree: unable to allocate an output buffer.\n");
+      exit(1);
+    }
+    job->tot = listentry(render.w, render.dirname, plen, render.dir + i, render.lev, render.dev, TRUE, path);
+    fclose(outfile);
+
+    pthread_mutex_lock(&render.lock);
+    job->done = TRUE;
+    pthread_cond_broadcast(&render.done);
+  }
+  pthread_mutex_unlock(&render.lock);
+
+  /* Give the fds back to the budget the other walking threads share: */
+  walk_release();
+  free(dirs);
   free(path);
+  return NULL;
+}
+
+static struct totals listparallel(struct walkopts *w, char *dirname, struct _info **dir, int n, int lev, dev_t dev)
+{
+  struct totals tot = {0};
+  pthread_t *threads = xmalloc(sizeof(pthread_t) * nthreads);
+  int i, t, started;
+
+  render.jobs = xmalloc(sizeof(struct renderjob) * n);
+  memset(render.jobs, 0, sizeof(struct renderjob) * n);
+  render.w = w;
+  render.dir = dir;
+  render.dirname = dirname;
+  render.n = n;
+  render.lev = lev;
+  render.dev = dev;
+  render.next = render.written = 0;
+  render.dirs = dirs;
+  render.maxdirs = maxdirs;
+  render.htmldirlen = htmldirlen;
+
+  for(started = t = 0; t < nthreads && t < n; t++)
+    if (pthread_create(&threads[started], NULL, renderer, NULL) == 0) started++;
+  if (!started) {
+    fprintf(stderr,"tree: unable to start renderer threads.\n");
+    exit(1);
+  }
+
+  for(i=0; i < n; i++) {
+    pthread_mutex_lock(&render.lock);
+    while (!render.jobs[i].done) pthread_cond_wait(&render.done, &render.lock);
+    pthread_mutex_unlock(&render.lock);
+
+    fwrite(render.jobs[i].buf, 1, render.jobs[i].len, outfile);
+    free(render.jobs[i].buf);
+    tot.dirs += render.jobs[i].tot.dirs;
+    tot.files += render.jobs[i].tot.files;
+    tot.size += render.jobs[i].tot.size;
+
+    pthread_mutex_lock(&render.lock);
+    render.written = i+1;
+    pthread_cond_broadcast(&render.room);
+    pthread_mutex_unlock(&render.lock);
+  }
+
+  for(t=0; t < started; t++) pthread_join(threads[t], NULL);
+  free(threads);
+  free(render.jobs);
+  return tot;
+}
+
+/**
+ * --threads with more than one directory given: each directory is walked and
+ * listed on a thread into a memory stream as emitroot() would, with .gitignore
+ * and .info stacks that start from this thread's and an inode table of its
+ * own, and this thread writes the buffers out in the order the directories
+ * were given and adds up their totals.  Threads stay at most ROOTS_AHEAD
+ * directories per thread ahead of the output.
+ */
+#define ROOTS_AHEAD	2
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t done, room;
+  struct renderjob *jobs;
+  struct walkopts *w;
+  char **dirname;
+  struct ignorefile *ig;
+  struct infofile *inf;
+  int n, next, written, threads;
+  bool needfulltree;
+} roots = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static void *rootworker(void *arg)
+{
+  struct renderjob *job;
+  int i;
+
+  dirs = xmalloc(sizeof(int) * (maxdirs = PATH_MAX));
+  filterstack = roots.ig;
+  infostack = roots.inf;
+  inroot = TRUE;
+
+  pthread_mutex_lock(&roots.lock);
+  for(;;) {
+    while (roots.next < roots.n && roots.next >= roots.written + roots.threads * ROOTS_AHEAD)
+      pthread_cond_wait(&roots.room, &roots.lock);
+    if (roots.next >= roots.n) break;
+    job = &roots.jobs[i = roots.next++];
+    pthread_mutex_unlock(&roots.lock);
+
+    memset(dirs, 0, sizeof(int) * maxdirs);
+    if ((outfile = open_memstream(&job->buf, &job->len)) == NULL) {
+      fprintf(stderr,"tree: unable to allocate an output buffer.\n");
+      exit(1);
+    }
+    inotable_partition(TRUE);
+    job->tot = emitroot(roots.w, roots.dirname[i], roots.needfulltree, roots.dirname[i+1] != NULL);
+    inotable_partition(FALSE);
+    walk_release();
+    fclose(outfile);
+
+    pthread_mutex_lock(&roots.lock);
+    job->done = TRUE;
+    pthread_cond_broadcast(&roots.done);
+  }
+  pthread_mutex_unlock(&roots.lock);
+
+  free(dirs);
+  return NULL;
+}
+
+static struct totals emitparallel(struct walkopts *w, char **dirname, bool needfulltree)
+{
+  struct totals tot = {0};
+  pthread_t *threads;
+  int i, t, n;
+
+  for(n = 0; dirname[n]; n++);
+  threads = xmalloc(sizeof(pthread_t) * nthreads);
+  roots.jobs = xmalloc(sizeof(struct renderjob) * n);
+  memset(roots.jobs, 0, sizeof(struct renderjob) * n);
+  roots.w = w;
+  roots.dirname = dirname;
+  roots.needfulltree = needfulltree;
+  roots.ig = filterstack;
+  roots.inf = infostack;
+  roots.n = n;
+  roots.next = roots.written = 0;
+
+  pthread_mutex_lock(&roots.lock);
+  for(roots.threads = t = 0; t < nthreads && t < n; t++)
+    if (pthread_create(&threads[roots.threads], NULL, rootworker, NULL) == 0) roots.threads++;
+  pthread_mutex_unlock(&roots.lock);
+  if (!roots.threads) {
+    fprintf(stderr,"tree: unable to start threads for the directories.\n");
+    exit(1);
+  }
+
+  for(i=0; i < n; i++) {
+    pthread_mutex_lock(&roots.lock);
+    while (!roots.jobs[i].done) pthread_cond_wait(&roots.done, &roots.lock);
+    pthread_mutex_unlock(&roots.lock);
+
+    fwrite(roots.jobs[i].buf, 1, roots.jobs[i].len, outfile);
+    free(roots.jobs[i].buf);
+    tot.dirs += roots.jobs[i].tot.dirs;
+    tot.files += roots.jobs[i].tot.files;
+    tot.size += roots.jobs[i].tot.size;
+
+    pthread_mutex_lock(&roots.lock);
+    roots.written = i+1;
+    pthread_cond_broadcast(&roots.room);
+    pthread_mutex_unlock(&roots.lock);
+  }
+
+  for(t=0; t < roots.threads; t++) pthread_join(threads[t], NULL);
+  free(threads);
+  free(roots.jobs);
   return tot;
 }
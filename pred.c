@@ -0,0 +1,360 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+/**
+ * find(1) style predicates (--type, --newer, --mtime, --size, --user,
+ * --group, --perm) joined by --not, --and (implied between two predicates)
+ * and --or, binding in that order.  They are parsed into a list of tokens as
+ * they're given and pred_compile() turns that into a program of tests, each
+ * with the test to go to next if it matches and if it doesn't, so that an
+ * --and stops at the first test that fails and an --or at the first that
+ * matches.  pred_match() runs the program on the lstat() of a file.  Like -P
+ * the predicates only apply to files; directories are always listed, --prune
+ * takes out those left empty.
+ */
+enum { PR_TYPE, PR_NEWER, PR_MTIME, PR_SIZE, PR_USER, PR_GROUP, PR_PERM, PR_NOT, PR_AND, PR_OR };
+
+#define PR_MATCH	-1
+#define PR_FAIL		-2
+
+struct pred {
+  u_char op;
+  signed char cmp;	/* +N: 1, -N: -1, N: 0.  For --perm -MODE: 1, /MODE: -1 */
+  u_long mask;		/* --type: 1 << file type, --perm: mode, --size: unit */
+  long long n;
+  int jt, jf;		/* next test if this one matches/fails, or the operands */
+};
+
+static struct {
+  char *name;
+  u_char op;
+  bool arg;
+} predopts[] = {
+  {"--type", PR_TYPE, TRUE},
+  {"--newer", PR_NEWER, TRUE},
+  {"--mtime", PR_MTIME, TRUE},
+  {"--size", PR_SIZE, TRUE},
+  {"--user", PR_USER, TRUE},
+  {"--group", PR_GROUP, TRUE},
+  {"--perm", PR_PERM, TRUE},
+  {"--not", PR_NOT, FALSE},
+  {"--and", PR_AND, FALSE},
+  {"--or", PR_OR, FALSE},
+  {NULL, 0, FALSE}
+};
+
+int npreds = 0;		/* Tests in the program, 0 if there are no predicates */
+
+static struct pred *toks = NULL, *prog = NULL;
+static int ntoks = 0, maxtoks = 0, nprog = 0;
+static time_t now;
+
+static void pred_error(char *opt, char *arg)
+{
+  fprintf(stderr,"tree: invalid argument to %s: `%s'\n", opt, arg);
+  exit(1);
+}
+
+/**
+ * [+-]N as used by --mtime and --size, returns a pointer past the number.
+ */
+static char *pred_num(struct pred *p, char *opt, char *arg)
+{
+  char *s = arg, *end;
+
+  p->cmp = (*s == '+')? 1 : (*s == '-')? -1 : 0;
+  if (p->cmp) s++;
+  if (!isdigit(*s)) pred_error(opt, arg);
+  p->n = strtoll(s, &end, 10);
+  return end;
+}
+
+static void pred_type(struct pred *p, char *opt, char *arg)
+{
+  char *s;
+  u_int m;
+
+  for(s = arg; *s; s++) {
+    switch(*s) {
+      case 'f': m = S_IFREG; break;
+      case 'd': m = S_IFDIR; break;
+      case 'l': m = S_IFLNK; break;
+      case 'p': m = S_IFIFO; break;
+      case 's': m = S_IFSOCK; break;
+      case 'b': m = S_IFBLK; break;
+      case 'c': m = S_IFCHR; break;
+#ifdef S_IFDOOR
+      case 'D': m = S_IFDOOR; break;
+#endif
+      case ',': continue;
+      default:
+	pred_error(opt, arg);
+	return;
+    }
+    p->mask |= 1UL << (m >> 12);
+  }
+  if (!p->mask) pred_error(opt, arg);
+}
+
+static void pred_size(struct pred *p, char *opt, char *arg)
+{
+  char *s = pred_num(p, opt, arg);
+
+  switch(*s) {
+    case 'c': p->mask = 1; break;
+    case 'w': p->mask = 2; break;
+    case '\0':
+    case 'b': p->mask = 512; break;
+    case 'k': p->mask = 1024; break;
+    case 'M': p->mask = 1024 * 1024; break;
+    case 'G': p->mask = 1024 * 1024 * 1024; break;
+    default: pred_error(opt, arg);
+  }
+  if (*s && s[1]) pred_error(opt, arg);
+}
+
+static void pred_perm(struct pred *p, char *opt, char *arg)
+{
+  char *s = arg, *end;
+
+  p->cmp = (*s == '-')? 1 : (*s == '/')? -1 : 0;
+  if (p->cmp) s++;
+  if (*s < '0' || *s > '7') pred_error(opt, arg);
+  p->mask = strtoul(s, &end, 8);
+  if (*end || p->mask > 07777) pred_error(opt, arg);
+}
+
+static void pred_id(struct pred *p, char *opt, char *arg)
+{
+  struct passwd *pw;
+  struct group *gr;
+  char *end;
+
+  if (p->op == PR_USER && (pw = getpwnam(arg)) != NULL) p->n = pw->pw_uid;
+  else if (p->op == PR_GROUP && (gr = getgrnam(arg)) != NULL) p->n = gr->gr_gid;
+  else {
+    p->n = strtoll(arg, &end, 10);
+    if (!isdigit(*arg) || *end) {
+      fprintf(stderr,"tree: unknown %s for %s: `%s'\n", p->op == PR_USER? "user":"group", opt, arg);
+      exit(1);
+    }
+  }
+}
+
+static void pred_add(int op, char *opt, char *arg)
+{
+  struct pred *p;
+  struct stat st;
+
+  /* Two predicates in a row (or a predicate and --not) are and'ed: */
+  if (op != PR_AND && op != PR_OR && ntoks && toks[ntoks-1].op < PR_NOT) pred_add(PR_AND, "--and", NULL);
+
+  if (ntoks == maxtoks) toks = xrealloc(toks, sizeof(struct pred) * (maxtoks += 16));
+  p = &toks[ntoks++];
+  memset(p, 0, sizeof(struct pred));
+  p->op = op;
+
+  switch(op) {
+    case PR_TYPE:
+      pred_type(p, opt, arg);
+      break;
+    case PR_NEWER:
+      if (stat(arg, &st) < 0) {
+	fprintf(stderr,"tree: unable to stat file for %s: `%s'\n", opt, arg);
+	exit(1);
+      }
+      p->n = st.st_mtime;
+      break;
+    case PR_MTIME:
+      if (*pred_num(p, opt, arg)) pred_error(opt, arg);
+      break;
+    case PR_SIZE:
+      pred_size(p, opt, arg);
+      break;
+    case PR_USER:
+    case PR_GROUP:
+      pred_id(p, opt, arg);
+      break;
+    case PR_PERM:
+      pred_perm(p, opt, arg);
+      break;
+  }
+}
+
+/**
+ * Parses the predicate option at argv[i], returns FALSE if it isn't one.
+ */
+bool pred_option(char *argv[], int i, int *j, int *n)
+{
+  char *arg;
+  int k;
+
+  for(k = 0; predopts[k].name; k++) {
+    if (!predopts[k].arg) {
+      if (strcmp(predopts[k].name, argv[i])) continue;
+      *j = strlen(argv[i])-1;
+      pred_add(predopts[k].op, predopts[k].name, NULL);
+      return TRUE;
+    }
+    if ((arg = long_arg(argv, i, j, n, predopts[k].name)) != NULL) {
+      pred_add(predopts[k].op, predopts[k].name, arg);
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/**
+ * Number of tests in the expression rooted at toks[t].
+ */
+static int pred_size_of(int t)
+{
+  switch(toks[t].op) {
+    case PR_NOT: return pred_size_of(toks[t].jt);
+    case PR_AND:
+    case PR_OR: return pred_size_of(toks[t].jt) + pred_size_of(toks[t].jf);
+    default: return 1;
+  }
+}
+
+/**
+ * Emits the tests of the expression rooted at toks[t] so that it goes to jt
+ * when the expression is true and to jf when it's false.
+ */
+static void pred_emit(int t, int jt, int jf)
+{
+  struct pred *p = &toks[t];
+
+  switch(p->op) {
+    case PR_NOT:
+      pred_emit(p->jt, jf, jt);
+      break;
+    case PR_AND:
+      pred_emit(p->jt, nprog + pred_size_of(p->jt), jf);
+      pred_emit(p->jf, jt, jf);
+      break;
+    case PR_OR:
+      pred_emit(p->jt, jt, nprog + pred_size_of(p->jt));
+      pred_emit(p->jf, jt, jf);
+      break;
+    default:
+      prog[nprog] = *p;
+      prog[nprog].jt = jt;
+      prog[nprog].jf = jf;
+      nprog++;
+  }
+}
+
+static int prec(int op)
+{
+  return op == PR_NOT? 3 : op == PR_AND? 2 : 1;
+}
+
+/**
+ * Builds the expression tree from the tokens (shunting-yard, the operands of
+ * --not, --and and --or are put in jt and jf), then the program from it.
+ */
+void pred_compile(void)
+{
+  int *ops, *vals, nops = 0, nvals = 0, t, o;
+  bool want = TRUE;
+
+  if (ntoks == 0) return;
+  ops = xmalloc(sizeof(int) * ntoks);
+  vals = xmalloc(sizeof(int) * ntoks);
+
+  for(t = 0; t <= ntoks; t++) {
+    if (t < ntoks && toks[t].op < PR_NOT) {
+      vals[nvals++] = t;
+      want = FALSE;
+      continue;
+    }
+    if (want) {
+      if (t < ntoks && toks[t].op == PR_NOT) {
+	ops[nops++] = t;
+	continue;
+      }
+      fprintf(stderr,"tree: %s\n", t == ntoks? "missing predicate at the end of the expression" :
+	      toks[t].op == PR_AND? "--and without a predicate before it" : "--or without a predicate before it");
+      exit(1);
+    }
+    /* Reduce operators that bind at least as tightly as this one: */
+    while (nops && (t == ntoks || prec(toks[ops[nops-1]].op) >= prec(toks[t].op))) {
+      o = ops[--nops];
+      if (toks[o].op == PR_NOT) toks[o].jt = vals[nvals-1];
+      else {
+	toks[o].jf = vals[--nvals];
+	toks[o].jt = vals[nvals-1];
+      }
+      vals[nvals-1] = o;
+    }
+    if (t < ntoks) {
+      ops[nops++] = t;
+      want = TRUE;
+    }
+  }
+
+  npreds = pred_size_of(vals[0]);
+  prog = xmalloc(sizeof(struct pred) * npreds);
+  pred_emit(vals[0], PR_MATCH, PR_FAIL);
+  now = time(NULL);
+
+  free(ops);
+  free(vals);
+}
+
+static bool pred_cmp(struct pred *p, long long v)
+{
+  return p->cmp > 0? v > p->n : p->cmp < 0? v < p->n : v == p->n;
+}
+
+static bool pred_test(struct pred *p, struct stat *st)
+{
+  switch(p->op) {
+    case PR_TYPE:
+      return (p->mask & (1UL << ((st->st_mode & S_IFMT) >> 12))) != 0;
+    case PR_NEWER:
+      return st->st_mtime > p->n;
+    case PR_MTIME:
+      return pred_cmp(p, (long long)(now - st->st_mtime) / (24*60*60));
+    case PR_SIZE:
+      return pred_cmp(p, ((long long)st->st_size + p->mask - 1) / (long long)p->mask);
+    case PR_USER:
+      return st->st_uid == p->n;
+    case PR_GROUP:
+      return st->st_gid == p->n;
+    case PR_PERM:
+      if (p->cmp > 0) return (st->st_mode & p->mask) == p->mask;
+      if (p->cmp < 0) return !p->mask || (st->st_mode & p->mask);
+      return (st->st_mode & 07777) == p->mask;
+  }
+  return FALSE;
+}
+
+/**
+ * Runs the predicates on a file's lstat().
+ */
+bool pred_match(struct stat *st)
+{
+  int i = 0;
+
+  while (i >= 0) i = pred_test(&prog[i], st)? prog[i].jt : prog[i].jf;
+  return i == PR_MATCH;
+}
@@ -0,0 +1,93 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * Static tracepoints (make USDT=1) for perf, bpftrace, SystemTap and the
+ * like, provider "tree":
+ *
+ *   dir_open(path)			read_dir() starting on a directory
+ *   dir_close(path, entries)		and done with it, entries is -1 if it
+ *					could not be opened
+ *   stat_entry(name)			getinfo() about to lstat() an entry
+ *   stat_return(name, ok)		and done, ok is 0 if it failed
+ *   patmatch_entry(name, pattern)	a pattern tried on a name
+ *   patmatch_return(name, pattern, r)	1 match, 0 no match, -1 bad pattern
+ *   filter_entry(path)			a path checked against .gitignore
+ *   filter_return(path, filtered)
+ *   sort_entry(dir, n)			listdir() sorting n entries
+ *   sort_return(dir, n)
+ *   write_entry(len)			--async-write flushing a buffer
+ *   write_return(len, err)		err is 0 or an errno
+ *
+ * Strings are passed as pointers.  <sys/sdt.h> isn't needed: on x86_64 and
+ * aarch64 the probe is a nop and a .note.stapsdt note saying where it is and
+ * where its arguments are, written here the same way sdt.h does it (without
+ * semaphores, the arguments are always computed).  Elsewhere sdt.h is used if
+ * there is one.  Without USDT, or on neither, the probes are nothing.
+ */
+#if defined(USDT) && defined(__GNUC__) && defined(__LP64__) && (defined(__x86_64__) || defined(__aarch64__))
+
+#ifdef __x86_64__
+#  define _PROBE_ARG(a)	"nor" ((long)(a))
+#else
+#  define _PROBE_ARG(a)	"r" ((long)(a))
+#endif
+
+#define _PROBE(name, args)						\
+  "990:	nop\n"								\
+  "	.pushsection .note.stapsdt,\"?\",\"note\"\n"			\
+  "	.balign 4\n"							\
+  "	.4byte 992f-991f, 994f-993f, 3\n"				\
+  "991:	.asciz \"stapsdt\"\n"						\
+  "992:	.balign 4\n"							\
+  "993:	.8byte 990b\n"							\
+  "	.8byte _.stapsdt.base\n"					\
+  "	.8byte 0\n"							\
+  "	.asciz \"tree\"\n"						\
+  "	.asciz \"" #name "\"\n"						\
+  "	.asciz \"" args "\"\n"						\
+  "994:	.balign 4\n"							\
+  "	.popsection\n"							\
+  "	.ifndef _.stapsdt.base\n"					\
+  "	.pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+  "	.weak _.stapsdt.base\n"						\
+  "	.hidden _.stapsdt.base\n"					\
+  "_.stapsdt.base: .space 1\n"						\
+  "	.size _.stapsdt.base, 1\n"					\
+  "	.popsection\n"							\
+  "	.endif\n"
+
+#define TREE_PROBE1(name,a)	__asm__ __volatile__ (_PROBE(name, "-8@%0") :: _PROBE_ARG(a))
+#define TREE_PROBE2(name,a,b)	__asm__ __volatile__ (_PROBE(name, "-8@%0 -8@%1") :: _PROBE_ARG(a), _PROBE_ARG(b))
+#define TREE_PROBE3(name,a,b,c)	__asm__ __volatile__ (_PROBE(name, "-8@%0 -8@%1 -8@%2") :: _PROBE_ARG(a), _PROBE_ARG(b), _PROBE_ARG(c))
+
+#elif defined(USDT) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define TREE_PROBE1(name,a)		DTRACE_PROBE1(tree, name, a)
+#    define TREE_PROBE2(name,a,b)	DTRACE_PROBE2(tree, name, a, b)
+#    define TREE_PROBE3(name,a,b,c)	DTRACE_PROBE3(tree, name, a, b, c)
+#  endif
+#endif
+
+#ifndef TREE_PROBE1
+#  define TREE_PROBE1(name,a)
+#  define TREE_PROBE2(name,a,b)
+#  define TREE_PROBE3(name,a,b,c)
+#endif
@@ -0,0 +1,230 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+extern bool profannotate, noindent;
+extern _Thread_local FILE *outfile;
+extern char *_nl;
+
+/**
+ * --profile-dirs: read_dir() reports how long each directory took to open,
+ * to read (readdir() and everything else but the per entry stat calls) and to
+ * stat, and how many entries it had.  The slowest N directories are kept in a
+ * min-heap and every directory goes into a log2 histogram of its total time.
+ * For --profile-annotate the timings are also kept per directory, and _info's
+ * prof field indexes them (+1, 0 is no profile).
+ */
+int proftop = 10;
+
+struct slowdir {
+  char *path;
+  struct dirprof p;
+};
+
+static struct slowdir *slow = NULL;
+static int nslow = 0;
+
+static struct dirprof *profs = NULL;
+static int nprofs = 0, maxprofs = 0;
+
+#define PROF_BUCKETS	32
+static u_long hist[PROF_BUCKETS];
+static u_long ndirs = 0;
+static double alltime = 0;
+static bool reported = FALSE;
+
+double profile_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void heapdown(int i)
+{
+  struct slowdir t;
+  int c;
+
+  for(;;) {
+    c = 2*i+1;
+    if (c >= nslow) break;
+    if (c+1 < nslow && slow[c+1].p.total < slow[c].p.total) c++;
+    if (slow[i].p.total <= slow[c].p.total) break;
+    t = slow[i]; slow[i] = slow[c]; slow[c] = t;
+    i = c;
+  }
+}
+
+static void heapup(int i)
+{
+  struct slowdir t;
+
+  for(; i && slow[(i-1)/2].p.total > slow[i].p.total; i = (i-1)/2) {
+    t = slow[i]; slow[i] = slow[(i-1)/2]; slow[(i-1)/2] = t;
+  }
+}
+
+/**
+ * Records the profile of one directory read.
+ */
+void profile_dir(char *path, double open, double read, double stat, u_long entries)
+{
+  struct dirprof p = { open, read, stat, open + read + stat, entries };
+  u_long us = (u_long)(p.total * 1e6);
+  int b;
+
+  ndirs++;
+  alltime += p.total;
+  for(b=0; us > 1 && b < PROF_BUCKETS-1; b++) us >>= 1;
+  hist[b]++;
+
+  if (profannotate) {
+    if (nprofs == maxprofs) profs = xrealloc(profs, sizeof(struct dirprof) * (maxprofs += 1024));
+    profs[nprofs++] = p;
+  }
+
+  if (proftop <= 0) return;
+  if (slow == NULL) slow = xmalloc(sizeof(struct slowdir) * proftop);
+  if (nslow < proftop) {
+    slow[nslow] = (struct slowdir){ scopy(path), p };
+    heapup(nslow++);
+  } else if (p.total > slow[0].p.total) {
+    free(slow[0].path);
+    slow[0] = (struct slowdir){ scopy(path), p };
+    heapdown(0);
+  }
+}
+
+/**
+ * The index of the last directory recorded, for --profile-annotate.
+ */
+int profile_last(void)
+{
+  return nprofs;
+}
+
+static char *ptime(char *buf, double secs)
+{
+  if (secs >= 1) sprintf(buf, "%.3fs", secs);
+  else sprintf(buf, "%.3fms", secs * 1e3);
+  return buf;
+}
+
+void profile_annotate(int prof)
+{
+  char buf[32];
+  struct dirprof *p = &profs[prof-1];
+
+  fprintf(outfile, "  [%s, %lu entr%s]", ptime(buf, p->total), p->entries, p->entries == 1? "y":"ies");
+}
+
+static int slowcmp(const void *a, const void *b)
+{
+  double x = ((struct slowdir *)a)->p.total, y = ((struct slowdir *)b)->p.total;
+  return x < y? 1 : x > y? -1 : 0;
+}
+
+/**
+ * The heap is sorted slowest first once the walk is done.
+ */
+static void sortslow(void)
+{
+  if (nslow) qsort(slow, nslow, sizeof(struct slowdir), slowcmp);
+}
+
+/**
+ * Histogram buckets to print, from the first to the last non-empty one.
+ */
+static int histrange(int *lo)
+{
+  int hi;
+
+  for(*lo=0; *lo < PROF_BUCKETS && !hist[*lo]; (*lo)++);
+  for(hi=PROF_BUCKETS-1; hi >= *lo && !hist[hi]; hi--);
+  return hi;
+}
+
+void profile_print(FILE *fp)
+{
+  char t[5][32];
+  u_long max = 0;
+  int i, lo, hi;
+
+  sortslow();
+  fprintf(fp, "tree: profiled %lu director%s in %s\n", ndirs, ndirs == 1? "y":"ies", ptime(t[0], alltime));
+  if (nslow) fprintf(fp, "  %-10s %-10s %-10s %-10s %8s  %s\n", "total", "open", "read", "stat", "entries", "directory");
+  for(i=0; i < nslow; i++)
+    fprintf(fp, "  %-10s %-10s %-10s %-10s %8lu  %s\n", ptime(t[0], slow[i].p.total), ptime(t[1], slow[i].p.open),
+	    ptime(t[2], slow[i].p.read), ptime(t[3], slow[i].p.stat), slow[i].p.entries, slow[i].path);
+
+  hi = histrange(&lo);
+  for(i=lo; i <= hi; i++) if (hist[i] > max) max = hist[i];
+  if (hi >= lo) fprintf(fp, "  latency histogram:\n");
+  for(i=lo; i <= hi; i++) {
+    fprintf(fp, "  < %-10s %8lu ", ptime(t[0], (2UL << i) / 1e6), hist[i]);
+    for(int j = (int)((hist[i] * 50 + max - 1) / max); j; j--) fputc('#', fp);
+    fputc('\n', fp);
+  }
+}
+
+void profile_json(void)
+{
+  int i, lo, hi;
+
+  sortslow();
+  fprintf(outfile, ",%s{\"type\":\"profile\",\"directories\":%lu,\"time\":%.6f,\"slowest\":[", noindent?"":"\n  ", ndirs, alltime);
+  for(i=0; i < nslow; i++) {
+    fprintf(outfile, "%s{\"name\":\"", i? ",":"");
+    json_encode(outfile, slow[i].path);
+    fprintf(outfile, "\",\"time\":%.6f,\"open\":%.6f,\"read\":%.6f,\"stat\":%.6f,\"entries\":%lu}",
+	    slow[i].p.total, slow[i].p.open, slow[i].p.read, slow[i].p.stat, slow[i].p.entries);
+  }
+  fprintf(outfile, "],\"histogram\":[");
+  hi = histrange(&lo);
+  for(i=lo; i <= hi; i++)
+    fprintf(outfile, "%s{\"lt\":%.6f,\"count\":%lu}", i > lo? ",":"", (2UL << i) / 1e6, hist[i]);
+  fprintf(outfile, "]}");
+  reported = TRUE;
+}
+
+void profile_xml(void)
+{
+  char *ind = noindent? "" : "    ";
+  int i, lo, hi;
+
+  sortslow();
+  fprintf(outfile, "%s<profile directories=\"%lu\" time=\"%.6f\">%s", noindent?"":"  ", ndirs, alltime, _nl);
+  for(i=0; i < nslow; i++) {
+    fprintf(outfile, "%s<slow time=\"%.6f\" open=\"%.6f\" read=\"%.6f\" stat=\"%.6f\" entries=\"%lu\">",
+	    ind, slow[i].p.total, slow[i].p.open, slow[i].p.read, slow[i].p.stat, slow[i].p.entries);
+    html_encode(outfile, slow[i].path);
+    fprintf(outfile, "</slow>%s", _nl);
+  }
+  hi = histrange(&lo);
+  for(i=lo; i <= hi; i++)
+    fprintf(outfile, "%s<bucket lt=\"%.6f\">%lu</bucket>%s", ind, (2UL << i) / 1e6, hist[i], _nl);
+  fprintf(outfile, "%s</profile>%s", noindent?"":"  ", _nl);
+  reported = TRUE;
+}
+
+void profile_finish(void)
+{
+  if (!reported) profile_print(stderr);
+}
@@ -0,0 +1,218 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+#include <stdatomic.h>
+#include <sys/statvfs.h>
+
+extern struct walkopts opts;
+
+/**
+ * --progress[=FD]: A thread writes a line to stderr (or fd FD) every second
+ * with how many directories and files have been looked at so far, the bytes
+ * they add up to, how many entries a second that was over the last second,
+ * the directories queued for --DU or --deadline, and the directory being
+ * read, so a walk that's stalled on a slow server shows it.  On a terminal
+ * the line is rewritten in place.  read_dir() and --DU feed the counters
+ * once per directory, and only when --progress is given.  If every directory
+ * named is the top of its file system and -L isn't given, the inodes in use
+ * on them are the most there can be to look at, which gives an estimate of
+ * the time left.
+ */
+#define PROGRESS_INTERVAL	1	/* seconds */
+
+bool progressflag = FALSE;
+int progressfd = 2;
+
+static struct {
+  atomic_ulong dirs, files, bytes;
+  atomic_long queued;
+  pthread_mutex_t lock;	/* for path */
+  pthread_cond_t stop;
+  pthread_t thread;
+  char path[PATH_MAX];
+  bool tty, stopping;
+  u_long total;		/* inodes in use, 0 if not known */
+  double start;
+} pg = { .lock = PTHREAD_MUTEX_INITIALIZER, .stop = PTHREAD_COND_INITIALIZER };
+
+static double pgnow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * A directory has been read, with files entries that aren't directories and
+ * bytes the size of all of them.  May be called from any thread.
+ */
+void progress_dir(char *path, u_long files, off_t bytes)
+{
+  atomic_fetch_add_explicit(&pg.dirs, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&pg.files, files, memory_order_relaxed);
+  atomic_fetch_add_explicit(&pg.bytes, bytes, memory_order_relaxed);
+  /* Whoever's reporting has the path, this one can go by: */
+  if (pthread_mutex_trylock(&pg.lock) == 0) {
+    snprintf(pg.path, sizeof(pg.path), "%s", path);
+    pthread_mutex_unlock(&pg.lock);
+  }
+}
+
+/**
+ * progress_dir() for what read_dir() read.
+ */
+void progress_read(char *path, struct _info **dl, int n)
+{
+  u_long files = 0;
+  off_t bytes = 0;
+  int i;
+
+  for(i = 0; i < n; i++) {
+    if (!dl[i]->isdir) files++;
+    bytes += dl[i]->size;
+  }
+  progress_dir(path, files, bytes);
+}
+
+/**
+ * n directories have been queued (or, if negative, taken off a queue).
+ */
+void progress_queue(long n)
+{
+  atomic_fetch_add_explicit(&pg.queued, n, memory_order_relaxed);
+}
+
+static char *human(char *buf, double n)
+{
+  char *units = "BKMGTPE";
+
+  while (n >= 1024 && units[1]) {
+    n /= 1024;
+    units++;
+  }
+  sprintf(buf, n < 10 && *units != 'B'? "%.1f%c" : "%.0f%c", n, *units);
+  return buf;
+}
+
+static void report(double elapsed, double rate, u_long seen)
+{
+  char line[PATH_MAX + 256], size[32], *p = line;
+  long q = atomic_load_explicit(&pg.queued, memory_order_relaxed), eta;
+  int width = pg.tty? 160 : PATH_MAX;
+
+  p += sprintf(p, "tree: %lu dirs, %lu files, %s, %.0f/s",
+	       (u_long)atomic_load_explicit(&pg.dirs, memory_order_relaxed),
+	       (u_long)atomic_load_explicit(&pg.files, memory_order_relaxed),
+	       human(size, atomic_load_explicit(&pg.bytes, memory_order_relaxed)), rate);
+  if (q > 0) p += sprintf(p, ", %ld queued", q);
+  if (pg.total > seen && seen && elapsed > 0) {
+    eta = (pg.total - seen) / (seen / elapsed);
+    p += sprintf(p, ", ~%ld:%02ld left", eta / 60, eta % 60);
+  }
+  pthread_mutex_lock(&pg.lock);
+  if (pg.path[0]) snprintf(p, width > p - line? width - (p - line) : 1, ", %s", pg.path);
+  pthread_mutex_unlock(&pg.lock);
+  dprintf(progressfd, pg.tty? "\r%s\033[K" : "%s\n", line);
+}
+
+static void *reporter(void *arg)
+{
+  struct timespec until;
+  double t, last = pg.start;
+  u_long seen, before = 0;
+
+  clock_gettime(CLOCK_REALTIME, &until);
+  pthread_mutex_lock(&pg.lock);
+  while (!pg.stopping) {
+    until.tv_sec += PROGRESS_INTERVAL;
+    if (pthread_cond_timedwait(&pg.stop, &pg.lock, &until) != ETIMEDOUT) continue;
+    pthread_mutex_unlock(&pg.lock);
+
+    t = pgnow();
+    seen = atomic_load_explicit(&pg.dirs, memory_order_relaxed) + atomic_load_explicit(&pg.files, memory_order_relaxed);
+    report(t - pg.start, (seen - before) / (t - last), seen);
+    before = seen;
+    last = t;
+
+    pthread_mutex_lock(&pg.lock);
+  }
+  pthread_mutex_unlock(&pg.lock);
+  return NULL;
+}
+
+/**
+ * The inodes in use on the file system of root if root is its top, else 0.
+ */
+static u_long inodes(char *root)
+{
+  struct statvfs sv;
+  struct stat st, up;
+  char *parent = xmalloc(strlen(root) + 4);
+  bool top;
+
+  sprintf(parent, "%s/..", root);
+  top = stat(root, &st) == 0 && stat(parent, &up) == 0 && (st.st_dev != up.st_dev || st.st_ino == up.st_ino);
+  free(parent);
+  if (!top || statvfs(root, &sv) < 0 || sv.f_files < sv.f_ffree) return 0;
+  return sv.f_files - sv.f_ffree;
+}
+
+void progress_start(char **roots)
+{
+  u_long n;
+  int i;
+
+  pg.tty = isatty(progressfd);
+  pg.start = pgnow();
+  if (opts.level < 0) {
+    for(i = 0; roots[i] && (n = inodes(roots[i])) > 0; i++) pg.total += n;
+    if (roots[i]) pg.total = 0;
+  }
+  if (pthread_create(&pg.thread, NULL, reporter, NULL)) {
+    fprintf(stderr,"tree: unable to start the --progress thread.\n");
+    progressflag = FALSE;
+  }
+}
+
+/**
+ * Stops the thread and writes the totals.
+ */
+void progress_finish(void)
+{
+  double elapsed;
+  u_long seen;
+
+  if (!progressflag) return;
+  pthread_mutex_lock(&pg.lock);
+  pg.stopping = TRUE;
+  pthread_cond_signal(&pg.stop);
+  pthread_mutex_unlock(&pg.lock);
+  pthread_join(pg.thread, NULL);
+
+  fflush(NULL);
+  elapsed = pgnow() - pg.start;
+  seen = atomic_load(&pg.dirs) + atomic_load(&pg.files);
+  pg.total = 0;
+  pg.path[0] = '\0';
+  atomic_store(&pg.queued, 0);
+  report(elapsed, elapsed > 0? seen / elapsed : 0, seen);
+  if (pg.tty) dprintf(progressfd, "\n");
+}
@@ -0,0 +1,139 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+#include <math.h>
+
+extern bool noindent, hflag, siflag;
+extern struct walkopts opts;
+extern _Thread_local FILE *outfile;
+extern char *_nl;
+
+/**
+ * --sample RATE: The tree is read and listed as usual to -L, sizes as for
+ * --du, but below that each directory at the last level is only looked into
+ * with probability RATE.  The ones picked are summed up exactly (du_size(),
+ * no _info is made) and stand for 1/RATE of their kind: their size counts
+ * that much in the listing, and the files and directories under them in the
+ * report.  This is a Horvitz-Thompson estimate, unbiased, and its variance is
+ * estimated from the same sample as (1-p)/p^2 times the sum of the squares of
+ * what was found, giving the 95% intervals shown.  That needs two or more
+ * picked to mean anything; with fewer the intervals are reported as unknown.
+ * What's listed, to -L, is exact.
+ */
+#define SAMPLE_Z	1.96	/* 95% */
+
+double samplerate = 0;
+
+static struct {
+  double size, files, dirs;	/* Estimates for what's past -L */
+  double vsize, vfiles, vdirs;	/* and their variances */
+  u_long units, picked;
+} est;
+
+static void add(double *e, double *v, double y)
+{
+  *e += y / samplerate;
+  *v += (1 - samplerate) / (samplerate * samplerate) * y * y;
+}
+
+/**
+ * The estimated size of what's under the directory path, which is past -L.
+ */
+off_t sample_dir(char *path)
+{
+  u_long files, dirs;
+  off_t size;
+
+  est.units++;
+  if (drand48() >= samplerate) return 0;
+  est.picked++;
+  size = du_size(path);
+  du_counts(&files, &dirs);
+  add(&est.size, &est.vsize, size);
+  add(&est.files, &est.vfiles, files);
+  add(&est.dirs, &est.vdirs, dirs);
+  return (off_t)(size / samplerate + 0.5);
+}
+
+/**
+ * The report's totals with the estimates for what wasn't listed added in
+ * (the size already has them, through the directories' sizes).
+ */
+struct totals sample_totals(struct totals tot)
+{
+  tot.files += (u_long)(est.files + 0.5);
+  tot.dirs += (u_long)(est.dirs + 0.5);
+  return tot;
+}
+
+static double margin(double v)
+{
+  return SAMPLE_Z * sqrt(v);
+}
+
+/**
+ * Whether the variances mean anything: a single pick has none to show, but
+ * a rate of 1 (or nothing past -L) is a census and exact.
+ */
+static bool known(void)
+{
+  return est.picked >= 2 || samplerate >= 1 || est.units == 0;
+}
+
+void sample_print(FILE *fp)
+{
+  char buf[64], *s = buf;
+
+  if (!known()) {
+    fprintf(fp, "(estimated from %lu of %lu directories below level %d, too few for 95%% intervals)\n",
+	    est.picked, est.units, opts.level+1);
+    return;
+  }
+  psize(buf, (off_t)(margin(est.vsize) + 0.5));
+  while (*s == ' ') s++;
+  fprintf(fp, "(estimated from %lu of %lu directories below level %d, 95%% intervals +/- %s%s",
+	  est.picked, est.units, opts.level+1, s, hflag || siflag? "" : " bytes");
+  fprintf(fp, ", +/- %.0f director%s", margin(est.vdirs), margin(est.vdirs) == 1? "y":"ies");
+  if (!opts.dflag) fprintf(fp, ", +/- %.0f files", margin(est.vfiles));
+  fprintf(fp, ")\n");
+}
+
+void sample_json(void)
+{
+  fprintf(outfile, ",\"estimate\":{\"rate\":%g,\"sampled\":%lu,\"of\":%lu,\"level\":%d,\"confidence\":0.95", samplerate, est.picked, est.units, opts.level+1);
+  if (!known()) fprintf(outfile, ",\"size\":null,\"directories\":null%s", opts.dflag? "" : ",\"files\":null");
+  else {
+    fprintf(outfile, ",\"size\":%.0f,\"directories\":%.0f", margin(est.vsize), margin(est.vdirs));
+    if (!opts.dflag) fprintf(outfile, ",\"files\":%.0f", margin(est.vfiles));
+  }
+  fprintf(outfile, "}");
+}
+
+void sample_xml(void)
+{
+  fprintf(outfile, "%s<estimate rate=\"%g\" sampled=\"%lu\" of=\"%lu\" level=\"%d\" confidence=\"0.95\"",
+	  noindent?"":"    ", samplerate, est.picked, est.units, opts.level+1);
+  /* The intervals are left out when unknown: */
+  if (known()) {
+    fprintf(outfile, " size=\"%.0f\" directories=\"%.0f\"", margin(est.vsize), margin(est.vdirs));
+    if (!opts.dflag) fprintf(outfile, " files=\"%.0f\"", margin(est.vfiles));
+  }
+  fprintf(outfile, "></estimate>%s", _nl);
+}
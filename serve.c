@@ -0,0 +1,818 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+extern struct walkopts opts;
+extern char **environ;
+
+/**
+ * --serve: The trees named are read once into an index of directories, each
+ * with its entries' lstat(), stat() and link target, and kept there while tree
+ * answers queries (--query) on a Unix socket.  A query is a tree command line:
+ * the client sends its arguments, working directory, environment and its
+ * stdin, stdout and stderr, and the server forks a process that runs tree's
+ * main() on them with the index in place of the file system.  read_dir() takes
+ * any directory it finds in the index from there (see serve_lookup()), so
+ * every option works as it would on the command line, and anything outside the
+ * index, or reached through a symbolic link, is read as usual.  The answer is
+ * written straight to the client's stdout and the exit status sent back last.
+ * On Linux the index is kept up to date with inotify: a directory with any
+ * change in it is read again, along with the entry for it in its parent, and
+ * subdirectories that appeared or went away are added to or dropped from the
+ * index.  Events are taken before each query is forked, so a query sees the
+ * changes made before it was sent.
+ */
+#define SERVE_WATCH	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_MODIFY | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+struct sdir {
+  char *path;
+  struct servent *ent;
+  int n, wd;
+  dev_t dev;
+  ino_t ino;
+  u_long gen;		/* last rescan() that found it still there */
+  bool dirty, failed;	/* failed: --deadline couldn't read it */
+  struct sdir *next;
+};
+
+static struct {
+  struct sdir **tab;
+  size_t size, count;
+  struct sdir **wds;	/* by inotify watch descriptor */
+  int maxwd, ifd;
+  char **roots;
+  bool warned, local;
+  pthread_mutex_t lock;	/* for a --deadline index, which is filled in while it's read */
+} ix = { .ifd = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+struct query {
+  pid_t pid;
+  int fd;
+};
+
+static struct query *queries = NULL;
+static int nqueries = 0, maxqueries = 0;
+static int sigpipe[2] = { -1, -1 };
+
+static char *querycwd = NULL;	/* Set in the process answering a query */
+
+static u_long hashpath(char *s)
+{
+  u_long h = 5381;
+
+  while (*s) h = h * 33 ^ (u_char)*s++;
+  return h;
+}
+
+static struct sdir **slot(char *path)
+{
+  struct sdir **s = &ix.tab[hashpath(path) & (ix.size-1)];
+
+  while (*s && strcmp((*s)->path, path)) s = &(*s)->next;
+  return s;
+}
+
+static void insert(struct sdir *sd)
+{
+  struct sdir **tab, *p, *next;
+  size_t i, size;
+
+  if (ix.count * 2 >= ix.size) {
+    size = ix.size * 2;
+    tab = xmalloc(sizeof(struct sdir *) * size);
+    memset(tab, 0, sizeof(struct sdir *) * size);
+    for(i = 0; i < ix.size; i++)
+      for(p = ix.tab[i]; p; p = next) {
+	next = p->next;
+	p->next = tab[hashpath(p->path) & (size-1)];
+	tab[hashpath(p->path) & (size-1)] = p;
+      }
+    free(ix.tab);
+    ix.tab = tab;
+    ix.size = size;
+  }
+  sd->next = ix.tab[hashpath(sd->path) & (ix.size-1)];
+  ix.tab[hashpath(sd->path) & (ix.size-1)] = sd;
+  ix.count++;
+}
+
+static char *subpath(char *dir, char *name)
+{
+  int len = strlen(dir);
+  char *path = xmalloc(len + strlen(name) + 2);
+
+  sprintf(path, "%s%s%s", dir, dir[len-1] == '/'? "" : "/", name);
+  return path;
+}
+
+static void freedir(struct sdir *sd)
+{
+  int i;
+
+  for(i = 0; i < sd->n; i++) {
+    free(sd->ent[i].name);
+    if (sd->ent[i].lnk) free(sd->ent[i].lnk);
+  }
+  free(sd->ent);
+  free(sd->path);
+  free(sd);
+}
+
+/**
+ * Reads the entries of one directory, NULL if it can't be read.
+ */
+static struct sdir *readone(char *path)
+{
+  struct sdir *sd;
+  struct servent *e;
+  struct dirent *de;
+  struct stat st;
+  char buf[PATH_MAX];
+  int fd, ne = 0, len;
+  DIR *d;
+
+  if ((fd = open(path, O_RDONLY | O_DIRECTORY)) < 0) return NULL;
+  if (fstat(fd, &st) < 0 || (d = fdopendir(fd)) == NULL) {
+    close(fd);
+    return NULL;
+  }
+  sd = xmalloc(sizeof(struct sdir));
+  memset(sd, 0, sizeof(struct sdir));
+  sd->path = scopy(path);
+  sd->wd = -1;
+  sd->dev = st.st_dev;
+  sd->ino = st.st_ino;
+
+  while ((de = readdir(d)) != NULL) {
+    if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+    if (sd->n == ne) sd->ent = xrealloc(sd->ent, sizeof(struct servent) * (ne += MINIT));
+    e = &sd->ent[sd->n];
+    if (fstatat(fd, de->d_name, &e->lst, AT_SYMLINK_NOFOLLOW) < 0) continue;
+    e->name = scopy(de->d_name);
+    e->lnk = NULL;
+    e->st = e->lst;
+    e->rs = 0;
+    if (S_ISLNK(e->lst.st_mode)) {
+      if ((e->rs = fstatat(fd, de->d_name, &e->st, 0)) < 0) memset(&e->st, 0, sizeof(struct stat));
+      len = readlinkat(fd, de->d_name, buf, sizeof(buf)-1);
+      buf[len < 0? 0 : len] = '\0';
+      e->lnk = scopy(buf);
+    }
+    sd->n++;
+  }
+  closedir(d);
+  return sd;
+}
+
+static void watch(struct sdir *sd)
+{
+#ifdef __linux__
+  int i;
+
+  if (ix.ifd < 0) return;
+  if ((sd->wd = inotify_add_watch(ix.ifd, sd->path, SERVE_WATCH)) < 0) {
+    if (!ix.warned) fprintf(stderr,"tree: unable to watch %s, not every change will be seen: %s\n", sd->path, strerror(errno));
+    ix.warned = TRUE;
+    return;
+  }
+  if (sd->wd >= ix.maxwd) {
+    i = ix.maxwd;
+    ix.wds = xrealloc(ix.wds, sizeof(struct sdir *) * (ix.maxwd = sd->wd + 1024));
+    memset(ix.wds + i, 0, sizeof(struct sdir *) * (ix.maxwd - i));
+  }
+  ix.wds[sd->wd] = sd;
+#endif
+}
+
+static void unwatch(struct sdir *sd)
+{
+#ifdef __linux__
+  if (sd->wd < 0) return;
+  inotify_rm_watch(ix.ifd, sd->wd);
+  ix.wds[sd->wd] = NULL;
+#endif
+}
+
+/**
+ * Indexes the directory path and everything under it, staying on its device
+ * with -x.
+ */
+static void indextree(char *path)
+{
+  struct sdir *sd;
+  struct servent *e;
+  char *sub;
+  int i;
+
+  if (*slot(path) != NULL || (sd = readone(path)) == NULL) return;
+  watch(sd);
+  insert(sd);
+  for(i = 0; i < sd->n; i++) {
+    e = &sd->ent[i];
+    if (!S_ISDIR(e->lst.st_mode) || (opts.xdev && e->lst.st_dev != sd->dev)) continue;
+    sub = subpath(path, e->name);
+    indextree(sub);
+    free(sub);
+  }
+}
+
+/**
+ * Drops path and everything under it from the index.
+ */
+static void drop(char *path)
+{
+  struct sdir **s, *sd;
+  size_t i, len = strlen(path);
+
+  for(i = 0; i < ix.size; i++)
+    for(s = &ix.tab[i]; (sd = *s) != NULL; ) {
+      if (strncmp(sd->path, path, len) || (sd->path[len] && sd->path[len] != '/')) {
+	s = &sd->next;
+	continue;
+      }
+      *s = sd->next;
+      ix.count--;
+      unwatch(sd);
+      freedir(sd);
+    }
+}
+
+/**
+ * Refreshes the entry for path in its parent's directory, if that's indexed.
+ */
+static void restat(char *path)
+{
+  struct sdir *sd;
+  struct servent *e;
+  char *dir = scopy(path), *name = strrchr(dir, '/');
+  int i;
+
+  if (name == NULL || name[1] == '\0') {
+    free(dir);
+    return;
+  }
+  *name++ = '\0';
+  if ((sd = *slot(*dir? dir : "/")) != NULL) {
+    for(i = 0; i < sd->n; i++) {
+      e = &sd->ent[i];
+      if (strcmp(e->name, name)) continue;
+      if (lstat(path, &e->lst) == 0 && !S_ISLNK(e->lst.st_mode)) e->st = e->lst;
+      break;
+    }
+  }
+  free(dir);
+}
+
+/**
+ * Reads the directory path again after a change in it.
+ */
+static void rescan(char *path)
+{
+  static u_long gen = 0;
+  struct sdir **s = slot(path), *old = *s, *sd, *sub;
+  struct servent *e;
+  char *p;
+  int i;
+
+  if (old == NULL) return;
+  if ((sd = readone(path)) == NULL) {
+    drop(path);
+    return;
+  }
+  sd->wd = old->wd;
+  if (sd->wd >= 0) ix.wds[sd->wd] = sd;
+  sd->next = old->next;
+  *s = sd;
+
+  /* Subdirectories still there (the same directory by inode) are kept: */
+  gen++;
+  for(i = 0; i < sd->n; i++) {
+    e = &sd->ent[i];
+    if (!S_ISDIR(e->lst.st_mode) || (opts.xdev && e->lst.st_dev != sd->dev)) continue;
+    p = subpath(path, e->name);
+    if ((sub = *slot(p)) != NULL && sub->ino == e->lst.st_ino && sub->dev == e->lst.st_dev) sub->gen = gen;
+    else {
+      if (sub) drop(p);
+      indextree(p);
+      if ((sub = *slot(p)) != NULL) sub->gen = gen;
+    }
+    free(p);
+  }
+  for(i = 0; i < old->n; i++) {
+    e = &old->ent[i];
+    if (!S_ISDIR(e->lst.st_mode)) continue;
+    p = subpath(path, e->name);
+    if ((sub = *slot(p)) != NULL && sub->gen != gen) drop(p);
+    free(p);
+  }
+  freedir(old);
+  restat(path);
+}
+
+static void indexroots(void)
+{
+  int i;
+
+  for(i = 0; ix.roots[i]; i++) indextree(ix.roots[i]);
+}
+
+/**
+ * Takes the inotify events waiting and reads again the directories they were
+ * for.  If events were lost the whole index is read again.
+ */
+static void events(void)
+{
+#ifdef __linux__
+  char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct inotify_event *ev;
+  struct sdir *sd;
+  char **dirty = NULL;
+  int ndirty = 0, maxdirty = 0, i;
+  bool overflow = FALSE;
+  ssize_t len;
+  char *p;
+
+  if (ix.ifd < 0) return;
+  while ((len = read(ix.ifd, buf, sizeof(buf))) > 0) {
+    for(p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+      ev = (struct inotify_event *)p;
+      if (ev->mask & IN_Q_OVERFLOW) overflow = TRUE;
+      if (ev->wd < 0 || ev->wd >= ix.maxwd || (sd = ix.wds[ev->wd]) == NULL) continue;
+      if (ev->mask & IN_IGNORED) {
+	ix.wds[ev->wd] = NULL;
+	sd->wd = -1;
+	continue;
+      }
+      if (sd->dirty) continue;
+      sd->dirty = TRUE;
+      if (ndirty == maxdirty) dirty = xrealloc(dirty, sizeof(char *) * (maxdirty += MINC));
+      dirty[ndirty++] = scopy(sd->path);
+    }
+  }
+
+  if (overflow) {
+    drop("");
+    indexroots();
+  }
+  for(i = 0; i < ndirty; i++) {
+    if (!overflow) rescan(dirty[i]);
+    free(dirty[i]);
+  }
+  free(dirty);
+#endif
+}
+
+static void sigchld(int sig)
+{
+  int e = errno;
+
+  if (write(sigpipe[1], "", 1) < 0) {}
+  errno = e;
+}
+
+/**
+ * Sends the exit status of each query that finished to its client.
+ */
+static void reap(void)
+{
+  pid_t pid;
+  int st, i;
+  u_char status;
+
+  while ((pid = waitpid(-1, &st, WNOHANG)) > 0) {
+    for(i = 0; i < nqueries; i++) {
+      if (queries[i].pid != pid) continue;
+      status = WIFEXITED(st)? WEXITSTATUS(st) : 2;
+      send(queries[i].fd, &status, 1, MSG_NOSIGNAL);
+      close(queries[i].fd);
+      queries[i] = queries[--nqueries];
+      break;
+    }
+  }
+}
+
+/**
+ * Reads a query from the client on fd and runs it, in the forked process.
+ * The query is its argc, working directory, argv[] and environment, each
+ * ending in a NUL, with its stdin, stdout and stderr passed along.
+ */
+static int answer(int fd, int (*query)(int, char **))
+{
+  char cbuf[CMSG_SPACE(sizeof(int) * 3)], *buf = NULL, **argv, **envv, *p, *end;
+  size_t size = 0, len = 0;
+  struct cmsghdr *cm;
+  struct msghdr msg;
+  struct iovec iov;
+  int fds[3], nfd = 0, argc, i, n;
+  ssize_t r;
+
+  for(;;) {
+    if (len + 4096 > size) buf = xrealloc(buf, size += 65536);
+    iov.iov_base = buf + len;
+    iov.iov_len = size - len - 1;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    if ((r = recvmsg(fd, &msg, 0)) < 0) {
+      if (errno == EINTR) continue;
+      return 2;
+    }
+    if (r == 0) break;
+    for(cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+      if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS && !nfd && cm->cmsg_len == CMSG_LEN(sizeof(int) * 3)) {
+	memcpy(fds, CMSG_DATA(cm), sizeof(int) * 3);
+	nfd = 3;
+      }
+    len += r;
+  }
+  buf[len] = '\0';
+  if (nfd != 3 || len == 0 || buf[len-1] != '\0') return 2;
+
+  /* Split it up, the environment is whatever comes after argv[]: */
+  for(n = 0, p = buf; p < buf + len; p += strlen(p) + 1) n++;
+  argc = atoi(buf);
+  if (argc < 1 || argc + 2 > n) return 2;
+  argv = xmalloc(sizeof(char *) * (argc + 1));
+  envv = xmalloc(sizeof(char *) * (n - argc - 1));
+  end = buf + len;
+  p = buf + strlen(buf) + 1;
+  querycwd = p;
+  for(p += strlen(p) + 1, i = 0; i < argc; p += strlen(p) + 1) argv[i++] = p;
+  argv[i] = NULL;
+  for(i = 0; p < end; p += strlen(p) + 1) envv[i++] = p;
+  envv[i] = NULL;
+
+  for(i = 0; i < 3; i++) {
+    dup2(fds[i], i);
+    close(fds[i]);
+  }
+  if (chdir(querycwd) < 0) {
+    fprintf(stderr,"tree: %s: %s\n", querycwd, strerror(errno));
+    return 2;
+  }
+  environ = envv;
+  return query(argc, argv);
+}
+
+/**
+ * True if the client on fd is the user tree is serving as; a query runs with
+ * the server's permissions, and can write files (-o, -R).
+ */
+static bool peerok(int fd)
+{
+#ifdef SO_PEERCRED
+  struct ucred uc;
+  socklen_t len = sizeof(uc);
+
+  return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &uc, &len) == 0 && uc.uid == geteuid();
+#else
+  uid_t uid;
+  gid_t gid;
+
+  return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+/**
+ * Indexes the roots and answers queries on the socket sock until killed.  The
+ * socket is only usable by its owner, and only the owner's queries are taken.
+ */
+int serve_run(char *sock, char **roots, int (*query)(int, char **))
+{
+  struct sockaddr_un sa;
+  struct pollfd pfd[3];
+  struct sigaction act;
+  struct stat st;
+  int lfd, fd, i, n;
+  mode_t mask;
+  pid_t pid;
+
+  if (querycwd) {
+    fprintf(stderr,"tree: --serve can't be used in a query.\n");
+    return 2;
+  }
+  if (strlen(sock) >= sizeof(sa.sun_path)) {
+    fprintf(stderr,"tree: socket path too long for --serve: %s\n", sock);
+    return 1;
+  }
+  /* A socket left by an earlier server is replaced, anything else is not: */
+  if (lstat(sock, &st) == 0 && !S_ISSOCK(st.st_mode)) {
+    fprintf(stderr,"tree: %s exists and is not a socket, not using it for --serve.\n", sock);
+    return 1;
+  }
+
+  for(n = 0; roots[n]; n++);
+  ix.roots = xmalloc(sizeof(char *) * (n + 1));
+  for(n = i = 0; roots[i]; i++) {
+    if ((ix.roots[n] = realpath(roots[i], NULL)) == NULL) {
+      fprintf(stderr,"tree: %s: %s\n", roots[i], strerror(errno));
+      continue;
+    }
+    n++;
+  }
+  ix.roots[n] = NULL;
+  if (n == 0) return 1;
+  ix.tab = xmalloc(sizeof(struct sdir *) * (ix.size = 1024));
+  memset(ix.tab, 0, sizeof(struct sdir *) * ix.size);
+#ifdef __linux__
+  if ((ix.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+    fprintf(stderr,"tree: unable to watch for changes, the index won't be updated: %s\n", strerror(errno));
+#endif
+  indexroots();
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  strcpy(sa.sun_path, sock);
+  if (lstat(sock, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(sock);
+  mask = umask(077);
+  if ((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(lfd, 64) < 0) {
+    umask(mask);
+    fprintf(stderr,"tree: unable to listen on %s: %s\n", sock, strerror(errno));
+    return 1;
+  }
+  umask(mask);
+
+  if (pipe(sigpipe) < 0) {
+    fprintf(stderr,"tree: %s\n", strerror(errno));
+    return 1;
+  }
+  fcntl(sigpipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(sigpipe[1], F_SETFL, O_NONBLOCK);
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = sigchld;
+  act.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &act, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  pfd[0].fd = sigpipe[0];
+  pfd[1].fd = ix.ifd;
+  pfd[2].fd = lfd;
+  for(i = 0; i < 3; i++) pfd[i].events = POLLIN;
+  for(;;) {
+    if (poll(pfd, 3, -1) < 0) continue;
+    if (pfd[0].revents) {
+      char c[64];
+      while (read(sigpipe[0], c, sizeof(c)) > 0);
+      reap();
+    }
+    if (pfd[1].revents) events();
+    if (!pfd[2].revents || (fd = accept(lfd, NULL, NULL)) < 0) continue;
+    if (!peerok(fd)) {
+      close(fd);
+      continue;
+    }
+    events();
+
+    if ((pid = fork()) == 0) {
+      close(lfd);
+      close(sigpipe[0]);
+      close(sigpipe[1]);
+      if (ix.ifd >= 0) close(ix.ifd);
+      signal(SIGCHLD, SIG_DFL);
+      signal(SIGPIPE, SIG_DFL);
+      exit(answer(fd, query));
+    }
+    if (pid < 0) {
+      close(fd);
+      continue;
+    }
+    if (nqueries == maxqueries) queries = xrealloc(queries, sizeof(struct query) * (maxqueries += MINC));
+    queries[nqueries].pid = pid;
+    queries[nqueries++].fd = fd;
+  }
+  return 0;
+}
+
+/**
+ * --query: Sends this command line, less --query, to the server on sock and
+ * returns the exit status it sends back.
+ */
+int serve_query(char *sock, int argc, char **argv)
+{
+  char cbuf[CMSG_SPACE(sizeof(int) * 3)], cwd[PATH_MAX], *buf, *args, *p;
+  int fds[3] = { 0, 1, 2 }, fd, i, nargs = 0;
+  size_t len = 0, off;
+  struct sockaddr_un sa;
+  struct cmsghdr *cm;
+  struct msghdr msg;
+  struct iovec iov;
+  bool opts = TRUE;
+  u_char status;
+  ssize_t r;
+
+  if (querycwd) {
+    fprintf(stderr,"tree: --query can't be used in a query.\n");
+    return 2;
+  }
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    fprintf(stderr,"tree: unable to get the working directory: %s\n", strerror(errno));
+    return 2;
+  }
+  for(i = 0; i < argc; i++) len += strlen(argv[i]) + 1;
+  p = args = xmalloc(len + 1);
+  for(i = 0; i < argc; i++) {
+    if (opts && i && !strcmp(argv[i], "--")) opts = FALSE;
+    if (opts && !strcmp(argv[i], "--query")) {
+      i++;
+      continue;
+    }
+    if (opts && !strncmp(argv[i], "--query=", 8)) continue;
+    p += sprintf(p, "%s", argv[i]) + 1;
+    nargs++;
+  }
+  len = 32 + strlen(cwd) + (p - args);
+  for(i = 0; environ[i]; i++) len += strlen(environ[i]) + 1;
+  buf = xmalloc(len);
+  off = sprintf(buf, "%d", nargs) + 1;
+  off += sprintf(buf + off, "%s", cwd) + 1;
+  memcpy(buf + off, args, p - args);
+  off += p - args;
+  for(i = 0; environ[i]; i++) off += sprintf(buf + off, "%s", environ[i]) + 1;
+  len = off;
+  free(args);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", sock);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+    fprintf(stderr,"tree: unable to connect to %s: %s\n", sock, strerror(errno));
+    return 2;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+  memcpy(CMSG_DATA(cm), fds, sizeof(int) * 3);
+  for(off = 0; off < len; off += r) {
+    if ((r = off? write(fd, buf + off, len - off) : sendmsg(fd, &msg, 0)) < 0) {
+      if (errno == EINTR) {
+	r = 0;
+	continue;
+      }
+      fprintf(stderr,"tree: unable to send the query to %s: %s\n", sock, strerror(errno));
+      return 2;
+    }
+  }
+  shutdown(fd, SHUT_WR);
+  free(buf);
+
+  while ((r = read(fd, &status, 1)) < 0 && errno == EINTR);
+  close(fd);
+  if (r != 1) {
+    fprintf(stderr,"tree: no answer from %s\n", sock);
+    return 2;
+  }
+  return status;
+}
+
+/**
+ * dir made absolute and its . and .. taken out by name, which is only done
+ * while a .. goes up from the working directory (in dir, what comes before it
+ * may be a symbolic link).  NULL if that can't be done.
+ */
+static char *normpath(char *dir)
+{
+  static _Thread_local char *buf = NULL;
+  static _Thread_local size_t size = 0;
+  char *s, *d;
+  size_t len, cwdlen, phys;
+
+  phys = cwdlen = (*dir == '/')? 0 : strlen(querycwd);
+  len = cwdlen + strlen(dir) + 2;
+  if (len > size) buf = xrealloc(buf, size = len + PATH_MAX);
+  if (cwdlen) sprintf(buf, "%s/%s", querycwd, dir);
+  else strcpy(buf, dir);
+
+  for(s = d = buf; *s; s += len) {
+    while (*s == '/') s++;
+    for(len = 0; s[len] && s[len] != '/'; len++);
+    if (len == 0 || (len == 1 && *s == '.')) continue;
+    if (len == 2 && s[0] == '.' && s[1] == '.') {
+      if ((size_t)(d - buf) > phys) return NULL;
+      while (d > buf && *--d != '/');
+      phys = d - buf;
+      continue;
+    }
+    *d++ = '/';
+    memmove(d, s, len);
+    d += len;
+  }
+  if (d == buf) *d++ = '/';
+  *d = '\0';
+  return buf;
+}
+
+/**
+ * The entries of the directory dir if it's in the index and this process is
+ * answering a query (or has a --deadline index), otherwise NULL.
+ */
+struct servent *serve_lookup(char *dir, int *n)
+{
+  struct sdir *sd;
+  char *path;
+
+  if (querycwd == NULL || (!ix.local && ix.count == 0) || (path = normpath(dir)) == NULL) return NULL;
+  if (ix.local) pthread_mutex_lock(&ix.lock);
+  sd = *slot(path);
+  if (ix.local) pthread_mutex_unlock(&ix.lock);
+  if (sd == NULL || sd->failed) return NULL;
+  *n = sd->n;
+  return sd->ent;
+}
+
+/**
+ * --deadline: Starts an index of this process's own, with nothing watched,
+ * for serve_add() to fill in while the walk reads from it.  FALSE if there is
+ * one already, in a query.
+ */
+bool serve_local(void)
+{
+  if (querycwd) return FALSE;
+  querycwd = gnu_getcwd();
+  ix.tab = xmalloc(sizeof(struct sdir *) * (ix.size = 1024));
+  memset(ix.tab, 0, sizeof(struct sdir *) * ix.size);
+  ix.local = TRUE;
+  return TRUE;
+}
+
+/**
+ * Reads the directory path into the local index, returns its entries (and
+ * its device in *dev) or NULL if it can't be read.  One that can't be read is
+ * kept as such, for the walk to read (and fail on) as usual.  May be called
+ * from any thread.
+ */
+struct servent *serve_add(char *path, int *n, dev_t *dev)
+{
+  struct sdir *sd, *old;
+  char *key;
+
+  if ((key = normpath(path)) == NULL) return NULL;
+  key = scopy(key);
+  if ((sd = readone(path)) == NULL) {
+    sd = xmalloc(sizeof(struct sdir));
+    memset(sd, 0, sizeof(struct sdir));
+    sd->failed = TRUE;
+  } else free(sd->path);
+  sd->path = key;
+  pthread_mutex_lock(&ix.lock);
+  if ((old = *slot(key)) == NULL) insert(sd);
+  pthread_mutex_unlock(&ix.lock);
+  if (old) {
+    freedir(sd);
+    sd = old;
+  }
+  if (sd->failed) return NULL;
+  *n = sd->n;
+  *dev = sd->dev;
+  return sd->ent;
+}
+
+/**
+ * TRUE if dir would be looked up in the local index but isn't there.
+ */
+bool serve_missing(char *dir)
+{
+  char *path;
+  bool missing;
+
+  if (!ix.local || (path = normpath(dir)) == NULL) return FALSE;
+  pthread_mutex_lock(&ix.lock);
+  missing = (*slot(path) == NULL);
+  pthread_mutex_unlock(&ix.lock);
+  return missing;
+}
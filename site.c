@@ -0,0 +1,213 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+extern bool duflag, noreport, statsflag;
+extern int nthreads;
+extern _Thread_local FILE *outfile;
+extern _Thread_local int *dirs, maxdirs;
+extern _Thread_local int htmldirlen;
+
+/**
+ * --site: -H -R without walking each subtree again for its page.  The whole
+ * tree is read once (ignoring -L), the top page is listed as usual, and each
+ * directory -R would run tree on is handed its part of the tree here as a
+ * page to write to its 00Tree.html.  Pages go on a stack that a pool of
+ * threads works through, each with its own outfile and dirs[]; a page can add
+ * more pages.  site_finish() helps with and waits for the pages before the
+ * tree is freed, then stops the threads.  Pages link to one 00Tree.css in the top directory instead of
+ * each carrying the style sheet.
+ */
+struct sitepage {
+  struct walkopts *w;
+  char *path;
+  struct _info **dir;
+  char *err;
+  off_t size;
+  int depth;
+  struct sitepage *next;
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work, idle;
+  struct sitepage *stack;
+  int busy, threads;
+  pthread_t *tids;
+  bool started, stop;
+} site = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+_Thread_local int sitedepth = 0;	/* Directories between the page and the top */
+
+/**
+ * Writes one page, as emit_tree() would for the page's directory.
+ */
+static void writepage(struct sitepage *pg)
+{
+  struct walkopts *w = pg->w;
+  FILE *outsave = outfile;
+  struct totals tot = {0};
+  struct _info *info = NULL;
+  struct stat st;
+  char *output = xmalloc(strlen(pg->path) + 13);
+  int depthsave = sitedepth;
+
+  sprintf(output, "%s/00Tree.html", pg->path);
+  setoutput(output);
+  sitedepth = pg->depth;
+  htmldirlen = strlen(pg->path);
+
+  w->lc.intro();
+  stats_count[ST_LSTAT]++;
+  if (lstat(pg->path, &st) >= 0) {
+    saveino(st.st_ino, st.st_dev);
+    info = stat2info(&st);
+    info->name = pg->path;
+    if (duflag) info->size = pg->size;
+    w->lc.printinfo(w, pg->path, info, 0);
+  }
+  w->lc.printfile(w, NULL, pg->path, info, pg->dir != NULL);
+  if (pg->err) w->lc.error(pg->err);
+  w->lc.newline(info, 0, 0, 0);
+  if (pg->dir) {
+    tot = listdir(w, pg->path, pg->dir, 1, 0, TRUE);
+    free_dir(pg->dir);
+  }
+  if (info) {
+    if (duflag) tot.size = info->size;
+    else tot.size += st.st_size;
+  }
+  if (!noreport) w->lc.report(w, tot);
+  w->lc.outtro();
+
+  fclose(outfile);
+  outfile = outsave;
+  /* site_finish() writes pages on the listing's thread, the next root's
+   * pages are counted from its top again: */
+  sitedepth = depthsave;
+  free(output);
+  free(pg->path);
+  free(pg);
+}
+
+static void *siteworker(void *arg)
+{
+  struct sitepage *pg;
+
+  dirs = xmalloc(sizeof(int) * (maxdirs = PATH_MAX));
+  memset(dirs, 0, sizeof(int) * maxdirs);
+
+  pthread_mutex_lock(&site.lock);
+  for(;;) {
+    while (site.stack == NULL && !site.stop) pthread_cond_wait(&site.work, &site.lock);
+    if (site.stop) break;
+    pg = site.stack;
+    site.stack = pg->next;
+    site.busy++;
+    pthread_mutex_unlock(&site.lock);
+
+    writepage(pg);
+
+    pthread_mutex_lock(&site.lock);
+    if (--site.busy == 0 && site.stack == NULL) pthread_cond_broadcast(&site.idle);
+  }
+  pthread_mutex_unlock(&site.lock);
+
+  free(dirs);
+  return NULL;
+}
+
+/**
+ * Starts the threads, unless --stats (whose clock isn't shared) is given.
+ */
+static void sitestart(void)
+{
+  long n = nthreads > 1? nthreads : sysconf(_SC_NPROCESSORS_ONLN);
+  int i;
+
+  site.started = TRUE;
+  if (n > 16) n = 16;
+  site.tids = xmalloc(sizeof(pthread_t) * n);
+  for(site.threads = i = 0; i < n && n > 1 && !statsflag; i++)
+    if (pthread_create(&site.tids[site.threads], NULL, siteworker, NULL) == 0) site.threads++;
+}
+
+/**
+ * Queues the page for the directory ent at path, lev levels below the page
+ * being listed by the walk w.  The page takes ent's children.
+ */
+void site_page(struct walkopts *w, char *path, struct _info *ent, int lev)
+{
+  struct sitepage *pg = xmalloc(sizeof(struct sitepage));
+
+  if (!site.started) sitestart();
+
+  pg->w = w;
+  pg->path = scopy(path);
+  pg->dir = ent->child;
+  pg->err = ent->err;
+  pg->size = ent->size;
+  pg->depth = sitedepth + lev;
+  ent->child = NULL;
+
+  pthread_mutex_lock(&site.lock);
+  pg->next = site.stack;
+  site.stack = pg;
+  pthread_cond_signal(&site.work);
+  pthread_mutex_unlock(&site.lock);
+}
+
+/**
+ * Writes the pages left on the stack and waits for those being written, then
+ * stops and joins the threads (the next root's first page starts them again).
+ */
+void site_finish(void)
+{
+  struct sitepage *pg;
+  int i;
+
+  pthread_mutex_lock(&site.lock);
+  while (site.stack || site.busy) {
+    if ((pg = site.stack) == NULL) {
+      pthread_cond_wait(&site.idle, &site.lock);
+      continue;
+    }
+    site.stack = pg->next;
+    site.busy++;
+    pthread_mutex_unlock(&site.lock);
+
+    writepage(pg);
+
+    pthread_mutex_lock(&site.lock);
+    if (--site.busy == 0 && site.stack == NULL) pthread_cond_broadcast(&site.idle);
+  }
+  if (!site.started) {
+    pthread_mutex_unlock(&site.lock);
+    return;
+  }
+  site.stop = TRUE;
+  pthread_cond_broadcast(&site.work);
+  pthread_mutex_unlock(&site.lock);
+
+  for(i = 0; i < site.threads; i++) pthread_join(site.tids[i], NULL);
+  free(site.tids);
+  site.tids = NULL;
+  site.threads = 0;
+  site.started = site.stop = FALSE;
+}
@@ -0,0 +1,213 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+#include <sys/resource.h>
+
+extern bool statsflag, noindent;
+extern _Thread_local FILE *outfile;
+extern char *_nl;
+
+/**
+ * --stats: Counters are always kept (they're just increments), the phase
+ * clock is only read when --stats is given.  Phase times are exclusive, time
+ * spent in a nested phase (stat() inside read_dir()) is not also counted in the
+ * outer one, and anything not inside a phase is charged to output.
+ */
+u_long stats_count[ST_MAX];
+
+static char *countnames[ST_MAX] = {
+  "opendir", "readdir", "lstat", "stat", "readlink", "getpwuid", "getgrgid",
+  "patmatch", "filtercheck", "qsort"
+};
+static char *phasenames[PH_MAX] = {
+  "output", "readdir", "stat", "filter", "sort", "names"
+};
+
+static double phasetime[PH_MAX], start, mark;
+static int phase = PH_OUTPUT;
+static bool reported = FALSE;
+
+static unsigned long long written = 0;
+static FILE *realout = NULL;
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#ifdef __linux__
+static ssize_t stats_write(void *cookie, const char *buf, size_t size)
+{
+  size_t n = fwrite(buf, 1, size, (FILE *)cookie);
+
+  written += n;
+  return n;
+}
+#endif
+
+/**
+ * Starts the clock and interposes a byte counter in front of outfile.
+ */
+void stats_start(void)
+{
+#ifdef __linux__
+  FILE *fp;
+
+  fp = fopencookie(outfile, "w", (cookie_io_functions_t){ NULL, stats_write, NULL, NULL });
+  if (fp != NULL) {
+    setvbuf(fp, NULL, _IOFBF, BUFSIZ);
+    realout = outfile;
+    outfile = fp;
+  }
+#endif
+  start = mark = now();
+}
+
+/**
+ * Switches the clock to phase p, returns the phase to give back to
+ * stats_leave().
+ */
+int stats_enter(int p)
+{
+  int prev = phase;
+  double t;
+
+  if (!statsflag) return prev;
+  t = now();
+  phasetime[phase] += t - mark;
+  mark = t;
+  phase = p;
+  return prev;
+}
+
+void stats_leave(int prev)
+{
+  double t;
+
+  if (!statsflag) return;
+  t = now();
+  phasetime[phase] += t - mark;
+  mark = t;
+  phase = prev;
+}
+
+static void cacherate(FILE *fp, char *name, u_long hits, u_long misses)
+{
+  u_long n = hits + misses;
+
+  fprintf(fp, "  %-12s %lu hits, %lu misses (%.1f%%)\n", name, hits, misses, n? 100.0 * hits / n : 0.0);
+}
+
+/**
+ * Brings the phase times up to date and fetches CPU time and peak memory.
+ */
+static double snapshot(struct rusage *ru)
+{
+  stats_leave(phase);
+  fflush(outfile);
+  getrusage(RUSAGE_SELF, ru);
+  return mark - start;
+}
+
+static double tv2d(struct timeval tv)
+{
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void stats_print(FILE *fp)
+{
+  struct rusage ru;
+  double wall = snapshot(&ru);
+  int i;
+
+  fprintf(fp, "tree: stats\n");
+  for(i=0; i < PH_MAX; i++)
+    fprintf(fp, "  %-12s %.6fs\n", phasenames[i], phasetime[i]);
+  fprintf(fp, "  %-12s %.6fs (user %.6fs, sys %.6fs)\n", "total", wall, tv2d(ru.ru_utime), tv2d(ru.ru_stime));
+  for(i=0; i < ST_UID_HIT; i++)
+    fprintf(fp, "  %-12s %lu\n", countnames[i], stats_count[i]);
+  cacherate(fp, "uid cache", stats_count[ST_UID_HIT], stats_count[ST_GETPWUID]);
+  cacherate(fp, "gid cache", stats_count[ST_GID_HIT], stats_count[ST_GETGRGID]);
+  cacherate(fp, "inode table", stats_count[ST_INO_HIT], stats_count[ST_INO_MISS]);
+  if (realout) fprintf(fp, "  %-12s %llu\n", "bytes", written);
+  fprintf(fp, "  %-12s %ld KiB\n", "maxrss", ru.ru_maxrss);
+}
+
+void stats_json(void)
+{
+  struct rusage ru;
+  double wall = snapshot(&ru);
+  char *ind = noindent? "" : "\n  ";
+  int i;
+
+  fprintf(outfile, ",%s{\"type\":\"stats\",\"wall\":{", ind);
+  for(i=0; i < PH_MAX; i++)
+    fprintf(outfile, "%s\"%s\":%.6f", i? ",":"", phasenames[i], phasetime[i]);
+  fprintf(outfile, ",\"total\":%.6f},\"cpu\":{\"user\":%.6f,\"sys\":%.6f},\"calls\":{",
+	  wall, tv2d(ru.ru_utime), tv2d(ru.ru_stime));
+  for(i=0; i < ST_UID_HIT; i++)
+    fprintf(outfile, "%s\"%s\":%lu", i? ",":"", countnames[i], stats_count[i]);
+  fprintf(outfile, "},\"cache\":{\"uid\":{\"hits\":%lu,\"misses\":%lu},\"gid\":{\"hits\":%lu,\"misses\":%lu},\"inode\":{\"hits\":%lu,\"misses\":%lu}}",
+	  stats_count[ST_UID_HIT], stats_count[ST_GETPWUID], stats_count[ST_GID_HIT], stats_count[ST_GETGRGID],
+	  stats_count[ST_INO_HIT], stats_count[ST_INO_MISS]);
+  if (realout) fprintf(outfile, ",\"bytes\":%llu", written);
+  fprintf(outfile, ",\"maxrss\":%ld}", ru.ru_maxrss);
+  reported = TRUE;
+}
+
+void stats_xml(void)
+{
+  struct rusage ru;
+  double wall = snapshot(&ru);
+  char *ind = noindent? "" : "    ";
+  int i;
+
+  fprintf(outfile, "%s<stats>%s", noindent?"":"  ", _nl);
+  for(i=0; i < PH_MAX; i++)
+    fprintf(outfile, "%s<wall phase=\"%s\">%.6f</wall>%s", ind, phasenames[i], phasetime[i], _nl);
+  fprintf(outfile, "%s<wall phase=\"total\">%.6f</wall>%s", ind, wall, _nl);
+  fprintf(outfile, "%s<cpu user=\"%.6f\" sys=\"%.6f\"></cpu>%s", ind, tv2d(ru.ru_utime), tv2d(ru.ru_stime), _nl);
+  for(i=0; i < ST_UID_HIT; i++)
+    fprintf(outfile, "%s<calls name=\"%s\">%lu</calls>%s", ind, countnames[i], stats_count[i], _nl);
+  fprintf(outfile, "%s<cache name=\"uid\" hits=\"%lu\" misses=\"%lu\"></cache>%s", ind, stats_count[ST_UID_HIT], stats_count[ST_GETPWUID], _nl);
+  fprintf(outfile, "%s<cache name=\"gid\" hits=\"%lu\" misses=\"%lu\"></cache>%s", ind, stats_count[ST_GID_HIT], stats_count[ST_GETGRGID], _nl);
+  fprintf(outfile, "%s<cache name=\"inode\" hits=\"%lu\" misses=\"%lu\"></cache>%s", ind, stats_count[ST_INO_HIT], stats_count[ST_INO_MISS], _nl);
+  if (realout) fprintf(outfile, "%s<bytes>%llu</bytes>%s", ind, written, _nl);
+  fprintf(outfile, "%s<maxrss>%ld</maxrss>%s", ind, ru.ru_maxrss, _nl);
+  fprintf(outfile, "%s</stats>%s", noindent?"":"  ", _nl);
+  reported = TRUE;
+}
+
+/**
+ * Removes the byte counter and prints the stats to stderr if the report
+ * didn't include them.
+ */
+void stats_finish(void)
+{
+  if (!reported) stats_print(stderr);
+  if (realout) {
+    fclose(outfile);
+    outfile = realout;
+    realout = NULL;
+  }
+}
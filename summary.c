@@ -0,0 +1,508 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+extern bool noindent, duflag, hflag, siflag;
+extern _Thread_local FILE *outfile;
+extern char *_nl;
+
+/**
+ * --summary: Totals of what was listed, gathered as each entry is listed:
+ * files (anything not a directory) by extension, owner, group, age (by
+ * modification time) and size, and the largest files and directories, a
+ * directory's size being that of what was listed under it (or its --du size).
+ * Nothing is kept per entry: the groups are hash tables and the largest N are
+ * kept in min-heaps.
+ * Each thread listing keeps its own totals, which are added up for the report,
+ * where the N largest groups of each kind (and no more than SUM_MAXEXT
+ * extensions) are shown and the rest folded into one.  Equal sizes are ordered
+ * by name, path or id, so the report doesn't depend on which thread listed
+ * what, or in what order.
+ */
+#define SUM_MAXEXT	4096
+#define SUM_AGES	5
+#define SUM_SIZES	8
+
+int sumtop = 10;
+
+struct sumgroup {
+  char *name;		/* The extension, NULL for an id */
+  u_long id, files;	/* files is 0 for an empty slot */
+  off_t size;
+  bool other;
+};
+
+struct sumtable {
+  struct sumgroup *g;
+  int size, used;
+};
+
+struct sumbig {
+  char *path;
+  off_t size;
+};
+
+struct sumheap {
+  struct sumbig *b;
+  int n;
+};
+
+struct summary {
+  struct sumtable ext, user, group;
+  u_long agefiles[SUM_AGES], sizefiles[SUM_SIZES], files, dirs;
+  off_t agesize[SUM_AGES], sizesize[SUM_SIZES], size;
+  struct sumheap big, bigdirs;
+  struct summary *next;
+};
+
+static long agedays[SUM_AGES-1] = { 1, 7, 30, 365 };
+static char *agenames[SUM_AGES] = { "< 1 day", "< 1 week", "< 30 days", "< 1 year", "older" };
+static char *sizenames[SUM_SIZES] = { "empty", "<= 1K", "<= 16K", "<= 256K", "<= 4M", "<= 64M", "<= 1G", "larger" };
+
+static struct summary *all = NULL;
+static pthread_mutex_t sumlock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local struct summary *mine = NULL;
+static time_t now;
+
+/* Size buckets go up by 16 from 1K: */
+static off_t sizelimit(int i)
+{
+  return i? (off_t)1 << (6 + 4*i) : 0;
+}
+
+static int probe(struct sumtable *t, char *name, u_long id)
+{
+  u_long h = 5381;
+  char *s;
+  int i;
+
+  if (name) for(s = name; *s; s++) h = h * 33 ^ (u_char)*s;
+  else h = id * 2654435761UL;
+  for(i = h & (t->size-1); t->g[i].files; i = (i+1) & (t->size-1))
+    if (name? !strcmp(t->g[i].name, name) : t->g[i].id == id) break;
+  return i;
+}
+
+/**
+ * The group for name (or id if name is NULL).  A new group has to be counted
+ * in right away.
+ */
+static struct sumgroup *group(struct sumtable *t, char *name, u_long id)
+{
+  struct sumgroup *old, *g;
+  int i = 0, size;
+
+  if (t->size && t->g[i = probe(t, name, id)].files) return &t->g[i];
+  if (t->used * 2 >= t->size) {
+    old = t->g;
+    size = t->size;
+    t->g = xmalloc(sizeof(struct sumgroup) * (t->size = size? size * 2 : 64));
+    memset(t->g, 0, sizeof(struct sumgroup) * t->size);
+    for(i = 0; i < size; i++)
+      if (old[i].files) t->g[probe(t, old[i].name, old[i].id)] = old[i];
+    free(old);
+    i = probe(t, name, id);
+  }
+  g = &t->g[i];
+  g->name = name? scopy(name) : NULL;
+  g->id = id;
+  t->used++;
+  return g;
+}
+
+static void count(struct sumgroup *g, u_long files, off_t size)
+{
+  g->files += files;
+  g->size += size;
+}
+
+/**
+ * Whether a comes after b in the largest first order: it's smaller, or as
+ * large with a later path.  The heaps keep the least at the top.
+ */
+static bool bigless(struct sumbig *a, struct sumbig *b)
+{
+  return a->size < b->size || (a->size == b->size && strcmp(a->path, b->path) > 0);
+}
+
+static void heapdown(struct sumheap *h, int i)
+{
+  struct sumbig t;
+  int c;
+
+  for(;;) {
+    c = 2*i+1;
+    if (c >= h->n) break;
+    if (c+1 < h->n && bigless(&h->b[c+1], &h->b[c])) c++;
+    if (!bigless(&h->b[c], &h->b[i])) break;
+    t = h->b[i]; h->b[i] = h->b[c]; h->b[c] = t;
+    i = c;
+  }
+}
+
+static void heapup(struct sumheap *h, int i)
+{
+  struct sumbig t;
+
+  for(; i && bigless(&h->b[i], &h->b[(i-1)/2]); i = (i-1)/2) {
+    t = h->b[i]; h->b[i] = h->b[(i-1)/2]; h->b[(i-1)/2] = t;
+  }
+}
+
+/**
+ * Offers dirname/name (or name if dirname is NULL) of the given size to one
+ * of the heaps of the largest.
+ */
+static void offer(struct sumheap *h, char *dirname, char *name, off_t size)
+{
+  struct sumbig b;
+  int len;
+
+  if (sumtop <= 0 || (h->n == sumtop && size < h->b[0].size)) return;
+  if (dirname) {
+    len = strlen(dirname);
+    b.path = xmalloc(len + strlen(name) + 2);
+    sprintf(b.path, "%s%s%s", dirname, len && dirname[len-1] == '/'? "" : "/", name);
+  } else b.path = scopy(name);
+  b.size = size;
+  /* A tie with the least kept is settled by the path: */
+  if (h->n == sumtop && !bigless(&h->b[0], &b)) {
+    free(b.path);
+    return;
+  }
+  if (h->b == NULL) h->b = xmalloc(sizeof(struct sumbig) * sumtop);
+  if (h->n < sumtop) {
+    h->b[h->n] = b;
+    heapup(h, h->n++);
+  } else {
+    free(h->b[0].path);
+    h->b[0] = b;
+    heapdown(h, 0);
+  }
+}
+
+static struct summary *newsummary(void)
+{
+  struct summary *s = xmalloc(sizeof(struct summary));
+
+  memset(s, 0, sizeof(struct summary));
+  pthread_mutex_lock(&sumlock);
+  if (all == NULL) now = time(NULL);
+  s->next = all;
+  all = s;
+  pthread_mutex_unlock(&sumlock);
+  return s;
+}
+
+/**
+ * Counts an entry of dirname as it's listed.  total is the size of a
+ * directory and everything listed under it.
+ */
+void summary_entry(char *dirname, struct _info *ent, off_t total)
+{
+  struct summary *s = mine;
+  char *ext;
+  long age;
+  int i;
+
+  if (s == NULL) s = mine = newsummary();
+
+  if (ent->isdir) {
+    s->dirs++;
+    offer(&s->bigdirs, dirname, ent->name, duflag? ent->size : total);
+    return;
+  }
+  s->files++;
+  s->size += ent->size;
+
+  if ((ext = strrchr(ent->name, '.')) == NULL || ext == ent->name) ext = "";
+  else ext++;
+  count(group(&s->ext, ext, 0), 1, ent->size);
+  count(group(&s->user, NULL, ent->uid), 1, ent->size);
+  count(group(&s->group, NULL, ent->gid), 1, ent->size);
+
+  age = (long)((now - ent->mtime) / (24*60*60));
+  for(i = 0; i < SUM_AGES-1 && age >= agedays[i]; i++);
+  s->agefiles[i]++;
+  s->agesize[i] += ent->size;
+
+  for(i = 0; i < SUM_SIZES-1 && ent->size > sizelimit(i); i++);
+  s->sizefiles[i]++;
+  s->sizesize[i] += ent->size;
+
+  offer(&s->big, dirname, ent->name, ent->size);
+}
+
+static void addtable(struct sumtable *to, struct sumtable *from)
+{
+  int i;
+
+  for(i = 0; i < from->size; i++) {
+    if (!from->g[i].files) continue;
+    count(group(to, from->g[i].name, from->g[i].id), from->g[i].files, from->g[i].size);
+  }
+}
+
+static int groupcmp(const void *a, const void *b)
+{
+  const struct sumgroup *x = a, *y = b;
+
+  if (x->size != y->size) return x->size < y->size? 1 : -1;
+  if (x->name) return strcmp(x->name, y->name);
+  return x->id < y->id? -1 : x->id > y->id;
+}
+
+static int bigcmp(const void *a, const void *b)
+{
+  const struct sumbig *x = a, *y = b;
+
+  if (x->size != y->size) return x->size < y->size? 1 : -1;
+  return strcmp(x->path, y->path);
+}
+
+/**
+ * Packs a table's groups, largest first, and folds all but the max largest
+ * (0 for no limit) into one.
+ */
+static void sortgroups(struct sumtable *t, int max)
+{
+  int i, n;
+
+  for(i = n = 0; i < t->size; i++)
+    if (t->g[i].files) t->g[n++] = t->g[i];
+  qsort(t->g, n, sizeof(struct sumgroup), groupcmp);
+  if (max > 0 && n > max + 1) {
+    for(i = max + 1; i < n; i++) count(&t->g[max], t->g[i].files, t->g[i].size);
+    t->g[max].other = TRUE;
+    n = max + 1;
+  }
+  t->used = n;
+}
+
+/**
+ * Adds the threads' totals up and sorts them, once the listing is done.
+ */
+static struct summary *finish(void)
+{
+  struct summary *t, *s;
+  int i;
+
+  if (all == NULL) newsummary();
+  t = all;
+  while ((s = t->next) != NULL) {
+    addtable(&t->ext, &s->ext);
+    addtable(&t->user, &s->user);
+    addtable(&t->group, &s->group);
+    for(i = 0; i < SUM_AGES; i++) {
+      t->agefiles[i] += s->agefiles[i];
+      t->agesize[i] += s->agesize[i];
+    }
+    for(i = 0; i < SUM_SIZES; i++) {
+      t->sizefiles[i] += s->sizefiles[i];
+      t->sizesize[i] += s->sizesize[i];
+    }
+    t->files += s->files;
+    t->dirs += s->dirs;
+    t->size += s->size;
+    for(i = 0; i < s->big.n; i++) offer(&t->big, NULL, s->big.b[i].path, s->big.b[i].size);
+    for(i = 0; i < s->bigdirs.n; i++) offer(&t->bigdirs, NULL, s->bigdirs.b[i].path, s->bigdirs.b[i].size);
+    t->next = s->next;
+  }
+  sortgroups(&t->ext, sumtop > 0 && sumtop < SUM_MAXEXT? sumtop : SUM_MAXEXT);
+  sortgroups(&t->user, sumtop);
+  sortgroups(&t->group, sumtop);
+  qsort(t->big.b, t->big.n, sizeof(struct sumbig), bigcmp);
+  qsort(t->bigdirs.b, t->bigdirs.n, sizeof(struct sumbig), bigcmp);
+  return t;
+}
+
+static char *groupname(struct summary *s, struct sumtable *t, int i)
+{
+  struct sumgroup *g = &t->g[i];
+
+  if (g->other) return "(other)";
+  if (t == &s->user) return uidtoname(g->id);
+  if (t == &s->group) return gidtoname(g->id);
+  return *g->name? g->name : "(none)";
+}
+
+static void textline(FILE *fp, bool html, char *name, u_long files, off_t size)
+{
+  char buf[64];
+  int len = strlen(name);
+
+  psize(buf, size);
+  fprintf(fp, "  ");
+  if (html) html_encode(fp, name);
+  else fputs(name, fp);
+  fprintf(fp, "%*s %10lu file%s%s\n", len < 20? 20 - len : 0, "", files, files == 1? " ":"s", buf);
+}
+
+static void textgroups(FILE *fp, bool html, char *title, struct summary *s, struct sumtable *t)
+{
+  int i;
+
+  if (t->used == 0) return;
+  fprintf(fp, "%s:\n", title);
+  for(i = 0; i < t->used; i++) textline(fp, html, groupname(s, t, i), t->g[i].files, t->g[i].size);
+}
+
+static void textbig(FILE *fp, bool html, char *title, struct sumheap *h)
+{
+  char buf[64];
+  int i;
+
+  if (h->n == 0) return;
+  fprintf(fp, "%s:\n", title);
+  for(i = 0; i < h->n; i++) {
+    psize(buf, h->b[i].size);
+    fprintf(fp, " %s  ", buf);
+    if (html) html_encode(fp, h->b[i].path);
+    else fputs(h->b[i].path, fp);
+    fputc('\n', fp);
+  }
+}
+
+/**
+ * The summary as text, after the report.  html encodes the names for -H.
+ */
+void summary_print(FILE *fp, bool html)
+{
+  struct summary *s = finish();
+  char buf[64];
+  int i;
+
+  psize(buf, s->size);
+  fprintf(fp, "\n%lu file%s,%s%s\n", s->files, s->files == 1? "":"s", buf, hflag || siflag? "" : " bytes");
+  textgroups(fp, html, "By extension", s, &s->ext);
+  textgroups(fp, html, "By owner", s, &s->user);
+  textgroups(fp, html, "By group", s, &s->group);
+  if (s->files) {
+    fprintf(fp, "By age:\n");
+    for(i = 0; i < SUM_AGES; i++)
+      if (s->agefiles[i]) textline(fp, FALSE, agenames[i], s->agefiles[i], s->agesize[i]);
+    fprintf(fp, "By size:\n");
+    for(i = 0; i < SUM_SIZES; i++)
+      if (s->sizefiles[i]) textline(fp, FALSE, sizenames[i], s->sizefiles[i], s->sizesize[i]);
+  }
+  textbig(fp, html, "Largest files", &s->big);
+  textbig(fp, html, "Largest directories", &s->bigdirs);
+}
+
+static void jsongroups(char *key, struct summary *s, struct sumtable *t)
+{
+  int i;
+
+  fprintf(outfile, ",\"%s\":[", key);
+  for(i = 0; i < t->used; i++) {
+    fprintf(outfile, "%s{\"name\":\"", i? ",":"");
+    json_encode(outfile, groupname(s, t, i));
+    fprintf(outfile, "\",\"files\":%lu,\"size\":%lld}", t->g[i].files, (long long)t->g[i].size);
+  }
+  fprintf(outfile, "]");
+}
+
+static void jsonbig(char *key, struct sumheap *h)
+{
+  int i;
+
+  fprintf(outfile, ",\"%s\":[", key);
+  for(i = 0; i < h->n; i++) {
+    fprintf(outfile, "%s{\"name\":\"", i? ",":"");
+    json_encode(outfile, h->b[i].path);
+    fprintf(outfile, "\",\"size\":%lld}", (long long)h->b[i].size);
+  }
+  fprintf(outfile, "]");
+}
+
+void summary_json(void)
+{
+  struct summary *s = finish();
+  int i;
+
+  fprintf(outfile, ",%s{\"type\":\"summary\",\"directories\":%lu,\"files\":%lu,\"size\":%lld",
+	  noindent?"":"\n  ", s->dirs, s->files, (long long)s->size);
+  jsongroups("extensions", s, &s->ext);
+  jsongroups("owners", s, &s->user);
+  jsongroups("groups", s, &s->group);
+  fprintf(outfile, ",\"age\":[");
+  for(i = 0; i < SUM_AGES; i++) {
+    fprintf(outfile, "%s{", i? ",":"");
+    if (i < SUM_AGES-1) fprintf(outfile, "\"days\":%ld,", agedays[i]);
+    fprintf(outfile, "\"files\":%lu,\"size\":%lld}", s->agefiles[i], (long long)s->agesize[i]);
+  }
+  fprintf(outfile, "],\"sizes\":[");
+  for(i = 0; i < SUM_SIZES; i++) {
+    fprintf(outfile, "%s{", i? ",":"");
+    if (i < SUM_SIZES-1) fprintf(outfile, "\"max\":%lld,", (long long)sizelimit(i));
+    fprintf(outfile, "\"files\":%lu,\"size\":%lld}", s->sizefiles[i], (long long)s->sizesize[i]);
+  }
+  fprintf(outfile, "]");
+  jsonbig("largest", &s->big);
+  jsonbig("largestdirs", &s->bigdirs);
+  fprintf(outfile, "}");
+}
+
+static void xmlgroups(char *tag, struct summary *s, struct sumtable *t)
+{
+  int i;
+
+  for(i = 0; i < t->used; i++) {
+    fprintf(outfile, "%s<%s name=\"", noindent? "" : "    ", tag);
+    html_encode(outfile, groupname(s, t, i));
+    fprintf(outfile, "\" files=\"%lu\" size=\"%lld\"></%s>%s", t->g[i].files, (long long)t->g[i].size, tag, _nl);
+  }
+}
+
+static void xmlbig(char *tag, struct sumheap *h)
+{
+  int i;
+
+  for(i = 0; i < h->n; i++) {
+    fprintf(outfile, "%s<%s size=\"%lld\">", noindent? "" : "    ", tag, (long long)h->b[i].size);
+    html_encode(outfile, h->b[i].path);
+    fprintf(outfile, "</%s>%s", tag, _nl);
+  }
+}
+
+void summary_xml(void)
+{
+  struct summary *s = finish();
+  char *ind = noindent? "" : "    ";
+  int i;
+
+  fprintf(outfile, "%s<summary directories=\"%lu\" files=\"%lu\" size=\"%lld\">%s",
+	  noindent?"":"  ", s->dirs, s->files, (long long)s->size, _nl);
+  xmlgroups("extension", s, &s->ext);
+  xmlgroups("owner", s, &s->user);
+  xmlgroups("group", s, &s->group);
+  for(i = 0; i < SUM_AGES; i++) {
+    fprintf(outfile, "%s<age", ind);
+    if (i < SUM_AGES-1) fprintf(outfile, " days=\"%ld\"", agedays[i]);
+    fprintf(outfile, " files=\"%lu\" size=\"%lld\"></age>%s", s->agefiles[i], (long long)s->agesize[i], _nl);
+  }
+  for(i = 0; i < SUM_SIZES; i++) {
+    fprintf(outfile, "%s<sizes", ind);
+    if (i < SUM_SIZES-1) fprintf(outfile, " max=\"%lld\"", (long long)sizelimit(i));
+    fprintf(outfile, " files=\"%lu\" size=\"%lld\"></sizes>%s", s->sizefiles[i], (long long)s->sizesize[i], _nl);
+  }
+  xmlbig("largest", &s->big);
+  xmlbig("largestdir", &s->bigdirs);
+  fprintf(outfile, "%s</summary>%s", noindent?"":"  ", _nl);
+}
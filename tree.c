@@ -19,6 +19,13 @@
 
 #include "tree.h"
 
+#include <fcntl.h>
+#include <stdatomic.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#endif
+
 char *version ="$Version: $ tree v2.0.2 (c) 1996 - 2022 by Steve Baker, Thomas Moore, Francesc Rocher, Florian Sesser, Kyosuke Tokoro $";
 char *hversion="\t\t tree v2.0.2 %s 1996 - 2022 by Steve Baker and Thomas Moore <br>\n"
 		      "\t\t HTML output hacked and copyleft %s 1998 by Francesc Rocher <br>\n"
@@ -26,32 +33,32 @@ char *hversion="\t\t tree v2.0.2 %s 1996 - 2022 by Steve Baker and Thomas Moore
 		      "\t\t Charsets / OS/2 support %s 2001 by Kyosuke Tokoro\n";
 
 /* Globals */
-bool dflag, lflag, pflag, sflag, Fflag, aflag, fflag, uflag, gflag;
-bool qflag, Nflag, Qflag, Dflag, inodeflag, devflag, hflag, Rflag;
-bool Hflag, siflag, cflag, Xflag, Jflag, duflag, pruneflag;
-bool noindent, force_color, nocolor, xdev, noreport, nolinks, flimit;
-bool ignorecase, matchdirs, fromfile, metafirst, gitignore, showinfo;
-bool reverse;
+bool Fflag, fflag, qflag, Nflag, Qflag, hflag, Rflag;
+bool Hflag, siflag, cflag, Xflag, Jflag, duflag, DUflag, pruneflag;
+bool noindent, force_color, nocolor, noreport, nolinks;
+bool fromfile, metafirst, showinfo;
+bool diffflag, statsflag, profdirs, profannotate, asyncwrite, flimitest, siteflag, summaryflag;
+bool rootthreads;
 
-struct listingcalls lc;
-
-int pattern = 0, maxpattern = 0, ipattern = 0, maxipattern = 0;
-char **patterns = NULL, **ipatterns = NULL;
+/* What tree walks with, from the command line: */
+struct walkopts opts;
 
 char *host = NULL, *title = "Directory Tree", *sp = " ", *_nl = "\n";
 char *file_comment = "#", *file_pathsep = "/";
 char *timefmt = NULL;
 const char *charset = NULL;
 
-struct _info **(*getfulltree)(char *d, u_long lev, dev_t dev, off_t *size, char **err) = unix_getfulltree;
+struct _info **(*getfulltree)(struct walkopts *w, char *d, u_long lev, dev_t dev, off_t *size, char **err) = unix_getfulltree;
 //off_t (*listdir)(char *, int *, int *, u_long, dev_t) = unix_listdir;
-int (*basesort)() = alnumsort;
-int (*topsort)() = NULL;
 
 char *sLevel, *curdir;
-FILE *outfile = NULL;
-int Level, *dirs, maxdirs;
-int errors;
+/* Per thread, so subtrees can be rendered in parallel (--threads): */
+_Thread_local FILE *outfile = NULL;
+_Thread_local int *dirs, maxdirs;
+int flimit;
+_Atomic int errors;	/* Several roots may be walked at once (--threads) */
+int nthreads = 1;
+int lazylevel = 0;
 
 int mb_cur_max;
 
@@ -83,33 +90,60 @@ struct sorts {
 
 /* Externs */
 /* hash.c */
-extern struct xtable *gtable[256], *utable[256];
 extern struct inotable *itable[256];
 
+/* profile.c */
+extern int proftop;
+
+/* summary.c */
+extern int sumtop;
+
+/* writer.c */
+extern size_t writebufsize;
+
+/* io.c */
+extern double iorate;
+
+/* sample.c */
+extern double samplerate;
+
+/* deadline.c */
+extern int deadline, refine;
+
+/* progress.c */
+extern int progressfd;
+extern bool progressflag;
+
+/* pred.c */
+extern int npreds;
+
+/* compress.c */
+extern char *compression;
+
 /* color.c */
 extern bool colorize, ansilines, linktargetcolor;
 extern char *leftcode, *rightcode, *endcode;
 extern const struct linedraw *linedraw;
 
 
+#ifndef TREE_NO_MAIN
 int main(int argc, char **argv)
 {
   char **dirname = NULL;
-  int i,j=0,k,n,optf,p = 0,q = 0;
-  char *stmp, *outfilename = NULL;;
+  int i,j=0,k,n,optf,p = 0,q = 0, preload = PRELOAD_NONE, maxpattern = 0, maxipattern = 0;
+  char *stmp, *outfilename = NULL, *difffile = NULL, *servesock = NULL, *querysock = NULL;
   bool needfulltree;
 
-  aflag = dflag = fflag = lflag = pflag = sflag = Fflag = uflag = gflag = FALSE;
-  Dflag = qflag = Nflag = Qflag = Rflag = hflag = Hflag = siflag = cflag = FALSE;
-  noindent = force_color = nocolor = xdev = noreport = nolinks = reverse = FALSE;
-  ignorecase = matchdirs = inodeflag = devflag = Xflag = Jflag = FALSE;
-  duflag = pruneflag = metafirst = gitignore = FALSE;
+  fflag = Fflag = qflag = Nflag = Qflag = Rflag = hflag = Hflag = siflag = cflag = FALSE;
+  noindent = force_color = nocolor = noreport = nolinks = Xflag = Jflag = FALSE;
+  duflag = DUflag = pruneflag = metafirst = diffflag = statsflag = asyncwrite = flimitest = FALSE;
+  profdirs = profannotate = siteflag = summaryflag = FALSE;
+  opts = (struct walkopts){ .level = -1, .basesort = alnumsort, .errors = &errors };
 
   flimit = 0;
   dirs = xmalloc(sizeof(int) * (maxdirs=PATH_MAX));
   memset(dirs, 0, sizeof(int) * maxdirs);
   dirs[0] = 0;
-  Level = -1;
 
   setlocale(LC_CTYPE, "");
   setlocale(LC_COLLATE, "");
@@ -121,7 +155,7 @@ int main(int argc, char **argv)
     charset = "UTF-8";
   }
 
-  lc = (struct listingcalls){
+  opts.lc = (struct listingcalls){
     null_intro, null_outtro, unix_printinfo, unix_printfile, unix_error, unix_newline,
     null_close, unix_report
   };
@@ -142,7 +176,7 @@ int main(int argc, char **argv)
     if (fcntl(std_fd, F_GETFD) >= 0) {
       Jflag = noindent = TRUE;
       _nl = "";
-      lc = (struct listingcalls){
+      opts.lc = (struct listingcalls){
 	json_intro, json_outtro, json_printinfo, json_printfile, json_error, json_newline,
 	json_close, json_report
       };
@@ -151,8 +185,6 @@ int main(int argc, char **argv)
   }
 #endif
 
-  memset(utable,0,sizeof(utable));
-  memset(gtable,0,sizeof(gtable));
   memset(itable,0,sizeof(itable));
 
   optf = TRUE;
@@ -171,23 +203,23 @@ int main(int argc, char **argv)
 	  Qflag = TRUE;
 	  break;
 	case 'd':
-	  dflag = TRUE;
+	  opts.dflag = TRUE;
 	  break;
 	case 'l':
-	  lflag = TRUE;
+	  opts.lflag = TRUE;
 	  break;
 	case 's':
-	  sflag = TRUE;
+	  opts.sflag = TRUE;
 	  break;
 	case 'h':
 	  hflag = TRUE;
-	  sflag = TRUE; /* Assume they also want -s */
+	  opts.sflag = TRUE; /* Assume they also want -s */
 	  break;
 	case 'u':
-	  uflag = TRUE;
+	  opts.uflag = TRUE;
 	  break;
 	case 'g':
-	  gflag = TRUE;
+	  opts.gflag = TRUE;
 	  break;
 	case 'f':
 	  fflag = TRUE;
@@ -196,10 +228,10 @@ int main(int argc, char **argv)
 	  Fflag = TRUE;
 	  break;
 	case 'a':
-	  aflag = TRUE;
+	  opts.aflag = TRUE;
 	  break;
 	case 'p':
-	  pflag = TRUE;
+	  opts.pflag = TRUE;
 	  break;
 	case 'i':
 	  noindent = TRUE;
@@ -212,25 +244,25 @@ int main(int argc, char **argv)
 	  nocolor = TRUE;
 	  break;
 	case 'x':
-	  xdev = TRUE;
+	  opts.xdev = TRUE;
 	  break;
 	case 'P':
 	  if (argv[n] == NULL) {
 	    fprintf(stderr,"tree: missing argument to -P option.\n");
 	    exit(1);
 	  }
-	  if (pattern >= maxpattern-1) patterns = xrealloc(patterns, sizeof(char *) * (maxpattern += 10));
-	  patterns[pattern++] = argv[n++];
-	  patterns[pattern] = NULL;
+	  if (opts.pattern >= maxpattern-1) opts.patterns = xrealloc(opts.patterns, sizeof(char *) * (maxpattern += 10));
+	  opts.patterns[opts.pattern++] = argv[n++];
+	  opts.patterns[opts.pattern] = NULL;
 	  break;
 	case 'I':
 	  if (argv[n] == NULL) {
 	    fprintf(stderr,"tree: missing argument to -I option.\n");
 	    exit(1);
 	  }
-	  if (ipattern >= maxipattern-1) ipatterns = xrealloc(ipatterns, sizeof(char *) * (maxipattern += 10));
-	  ipatterns[ipattern++] = argv[n++];
-	  ipatterns[ipattern] = NULL;
+	  if (opts.ipattern >= maxipattern-1) opts.ipatterns = xrealloc(opts.ipatterns, sizeof(char *) * (maxipattern += 10));
+	  opts.ipatterns[opts.ipattern++] = argv[n++];
+	  opts.ipatterns[opts.ipattern] = NULL;
 	  break;
 	case 'A':
 	  ansilines = TRUE;
@@ -239,28 +271,28 @@ int main(int argc, char **argv)
 	  charset = "IBM437";
 	  break;
 	case 'D':
-	  Dflag = TRUE;
+	  opts.Dflag = TRUE;
 	  break;
 	case 't':
-	  basesort = mtimesort;
+	  opts.basesort = mtimesort;
 	  break;
 	case 'c':
-	  basesort = ctimesort;
+	  opts.basesort = ctimesort;
 	  cflag = TRUE;
 	  break;
 	case 'r':
-	  reverse = TRUE;
+	  opts.reverse = TRUE;
 	  break;
 	case 'v':
-	  basesort = versort;
+	  opts.basesort = versort;
 	  break;
 	case 'U':
-	  basesort = NULL;
+	  opts.basesort = NULL;
 	  break;
 	case 'X':
 	  Xflag = TRUE;
 	  Hflag = Jflag = FALSE;
-	  lc = (struct listingcalls){
+	  opts.lc = (struct listingcalls){
 	    xml_intro, xml_outtro, xml_printinfo, xml_printfile, xml_error, xml_newline,
 	    xml_close, xml_report
 	  };
@@ -268,7 +300,7 @@ int main(int argc, char **argv)
 	case 'J':
 	  Jflag = TRUE;
 	  Xflag = Hflag = FALSE;
-	  lc = (struct listingcalls){
+	  opts.lc = (struct listingcalls){
 	    json_intro, json_outtro, json_printinfo, json_printfile, json_error, json_newline,
 	    json_close, json_report
 	  };
@@ -276,7 +308,7 @@ int main(int argc, char **argv)
 	case 'H':
 	  Hflag = TRUE;
 	  Xflag = Jflag = FALSE;
-	  lc = (struct listingcalls){
+	  opts.lc = (struct listingcalls){
 	    html_intro, html_outtro, html_printinfo, html_printfile, html_error, html_newline,
 	    html_close, html_report
 	  };
@@ -302,8 +334,8 @@ int main(int argc, char **argv)
 	    fprintf(stderr,"tree: Missing argument to -L option.\n");
 	    exit(1);
 	  }
-	  Level = strtoul(sLevel,NULL,0)-1;
-	  if (Level < 0) {
+	  opts.level = strtoul(sLevel,NULL,0)-1;
+	  if (opts.level < 0) {
 	    fprintf(stderr,"tree: Invalid level, must be greater than 0.\n");
 	    exit(1);
 	  }
@@ -332,12 +364,12 @@ int main(int argc, char **argv)
 	    }
 	    if (!strcmp("--inodes",argv[i])) {
 	      j = strlen(argv[i])-1;
-	      inodeflag=TRUE;
+	      opts.inodeflag=TRUE;
 	      break;
 	    }
 	    if (!strcmp("--device",argv[i])) {
 	      j = strlen(argv[i])-1;
-	      devflag=TRUE;
+	      opts.devflag=TRUE;
 	      break;
 	    }
 	    if (!strcmp("--noreport",argv[i])) {
@@ -352,12 +384,17 @@ int main(int argc, char **argv)
 	    }
 	    if (!strcmp("--dirsfirst",argv[i])) {
 	      j = strlen(argv[i])-1;
-	      topsort = dirsfirst;
+	      opts.topsort = dirsfirst;
 	      break;
 	    }
 	    if (!strcmp("--filesfirst",argv[i])) {
 	      j = strlen(argv[i])-1;
-	      topsort = filesfirst;
+	      opts.topsort = filesfirst;
+	      break;
+	    }
+	    if (!strcmp("--filelimit-estimate",argv[i])) {
+	      j = strlen(argv[i])-1;
+	      flimitest = TRUE;
 	      break;
 	    }
 	    if (!strncmp("--filelimit",argv[i],11)) {
@@ -401,16 +438,22 @@ int main(int argc, char **argv)
 	      }
 	      break;
 	    }
-	    if (!strncmp("--si", argv[i], 4)) {
+	    if (!strcmp("--si",argv[i])) {
 	      j = strlen(argv[i])-1;
-	      sflag = TRUE;
+	      opts.sflag = TRUE;
 	      hflag = TRUE;
 	      siflag = TRUE;
 	      break;
 	    }
+	    if (!strcmp("--DU",argv[i])) {
+	      j = strlen(argv[i])-1;
+	      opts.sflag = TRUE;
+	      duflag = DUflag = TRUE;
+	      break;
+	    }
 	    if (!strncmp("--du",argv[i],4)) {
 	      j = strlen(argv[i])-1;
-	      sflag = TRUE;
+	      opts.sflag = TRUE;
 	      duflag = TRUE;
 	      break;
 	    }
@@ -438,17 +481,17 @@ int main(int argc, char **argv)
 		fprintf(stderr,"tree: missing argument to --timefmt\n");
 		exit(1);
 	      }
-	      Dflag = TRUE;
+	      opts.Dflag = TRUE;
 	      break;
 	    }
 	    if (!strncmp("--ignore-case",argv[i],13)) {
 	      j = strlen(argv[i])-1;
-	      ignorecase = TRUE;
+	      opts.ignorecase = TRUE;
 	      break;
 	    }
 	    if (!strncmp("--matchdirs",argv[i],11)) {
 	      j = strlen(argv[i])-1;
-	      matchdirs = TRUE;
+	      opts.matchdirs = TRUE;
 	      break;
 	    }
 	    if (!strncmp("--sort",argv[i],6)) {
@@ -468,14 +511,14 @@ int main(int argc, char **argv)
 		fprintf(stderr,"tree: missing argument to --sort\n");
 		exit(1);
 	      }
-	      basesort = NULL;
+	      opts.basesort = NULL;
 	      for(k=0;sorts[k].name;k++) {
 		if (strcasecmp(sorts[k].name,stmp) == 0) {
-		  basesort = sorts[k].cmpfunc;
+		  opts.basesort = sorts[k].cmpfunc;
 		  break;
 		}
 	      }
-	      if (basesort == NULL) {
+	      if (opts.basesort == NULL) {
 		fprintf(stderr,"tree: sort type '%s' not valid, should be one of: ", stmp);
 		for(k=0; sorts[k].name; k++)
 		  printf("%s%c", sorts[k].name, sorts[k+1].name? ',': '\n');
@@ -496,7 +539,7 @@ int main(int argc, char **argv)
 	    }
 	    if (!strncmp("--gitignore",argv[i],11)) {
 	      j = strlen(argv[i])-1;
-	      gitignore=TRUE;
+	      opts.gitignore=TRUE;
 	      break;
 	    }	    
 	    if (!strncmp("--info",argv[i],6)) {
@@ -504,6 +547,141 @@ int main(int argc, char **argv)
 	      showinfo=TRUE;
 	      break;
 	    }	    
+	    if (!strncmp("--profile-dirs",argv[i],14) && (argv[i][14] == '=' || !argv[i][14])) {
+	      if (argv[i][14] == '=') {
+		if ((proftop = atoi(argv[i]+15)) < 0 || !isdigit(argv[i][15])) {
+		  fprintf(stderr,"tree: invalid count for --profile-dirs=\n");
+		  exit(1);
+		}
+	      }
+	      j = strlen(argv[i])-1;
+	      profdirs = TRUE;
+	      break;
+	    }
+	    if (!strncmp("--summary",argv[i],9) && (argv[i][9] == '=' || !argv[i][9])) {
+	      if (argv[i][9] == '=') {
+		if ((sumtop = atoi(argv[i]+10)) < 0 || !isdigit(argv[i][10])) {
+		  fprintf(stderr,"tree: invalid count for --summary=\n");
+		  exit(1);
+		}
+	      }
+	      j = strlen(argv[i])-1;
+	      summaryflag = TRUE;
+	      break;
+	    }
+	    if (!strncmp("--progress",argv[i],10) && (argv[i][10] == '=' || !argv[i][10])) {
+	      if (argv[i][10] == '=') {
+		if ((progressfd = atoi(argv[i]+11)) < 0 || !isdigit(argv[i][11]) || fcntl(progressfd, F_GETFD) < 0) {
+		  fprintf(stderr,"tree: invalid file descriptor for --progress=\n");
+		  exit(1);
+		}
+	      }
+	      j = strlen(argv[i])-1;
+	      progressflag = TRUE;
+	      break;
+	    }
+	    if (!strcmp("--profile-annotate",argv[i])) {
+	      j = strlen(argv[i])-1;
+	      profdirs = profannotate = TRUE;
+	      break;
+	    }
+	    if (!strncmp("--preload-ids",argv[i],13) && (argv[i][13] == '=' || !argv[i][13])) {
+	      if (!argv[i][13] || !strcmp(argv[i]+14, "nss")) preload = PRELOAD_NSS;
+	      else if (!strcmp(argv[i]+14, "nss-complete")) preload = PRELOAD_NSS_COMPLETE;
+	      else if (!strcmp(argv[i]+14, "files")) preload = PRELOAD_FILES;
+	      else {
+		fprintf(stderr,"tree: --preload-ids should be one of: nss,nss-complete,files\n");
+		exit(1);
+	      }
+	      j = strlen(argv[i])-1;
+	      break;
+	    }
+	    if (!strcmp("--site",argv[i])) {
+	      j = strlen(argv[i])-1;
+	      siteflag = TRUE;
+	      break;
+	    }
+	    if (!strcmp("--stats",argv[i])) {
+	      j = strlen(argv[i])-1;
+	      statsflag = TRUE;
+	      break;
+	    }
+	    if (!strncmp("--async-write",argv[i],13) && (argv[i][13] == '=' || !argv[i][13])) {
+	      if (argv[i][13] == '=') {
+		if ((k = atoi(argv[i]+14)) < 4 || !isdigit(argv[i][14])) {
+		  fprintf(stderr,"tree: invalid buffer size for --async-write=, at least 4 (KiB)\n");
+		  exit(1);
+		}
+		writebufsize = (size_t)k * 1024;
+	      }
+	      j = strlen(argv[i])-1;
+	      asyncwrite = TRUE;
+	      break;
+	    }
+	    if (!strncmp("--compress",argv[i],10) && (argv[i][10] == '=' || !argv[i][10])) {
+	      compression = argv[i][10] == '='? argv[i]+11 : "";
+	      j = strlen(argv[i])-1;
+	      break;
+	    }
+	    if ((stmp = long_arg(argv, i, &j, &n, "--threads")) != NULL) {
+	      if ((nthreads = atoi(stmp)) < 1 || !isdigit(*stmp)) {
+		fprintf(stderr,"tree: invalid number of threads for --threads\n");
+		exit(1);
+	      }
+	      break;
+	    }
+	    if ((stmp = long_arg(argv, i, &j, &n, "--io-rate")) != NULL) {
+	      if ((iorate = atof(stmp)) <= 0 || !isdigit(*stmp)) {
+		fprintf(stderr,"tree: invalid rate for --io-rate, must be greater than 0.\n");
+		exit(1);
+	      }
+	      break;
+	    }
+	    if ((stmp = long_arg(argv, i, &j, &n, "--sample")) != NULL) {
+	      if ((samplerate = atof(stmp)) <= 0 || samplerate > 1 || !isdigit(*stmp)) {
+		fprintf(stderr,"tree: invalid rate for --sample, must be greater than 0 and at most 1.\n");
+		exit(1);
+	      }
+	      opts.sflag = TRUE;
+	      duflag = TRUE;
+	      break;
+	    }
+	    if ((stmp = long_arg(argv, i, &j, &n, "--deadline")) != NULL) {
+	      if ((deadline = atoi(stmp)) <= 0 || !isdigit(*stmp)) {
+		fprintf(stderr,"tree: invalid time for --deadline, must be greater than 0.\n");
+		exit(1);
+	      }
+	      break;
+	    }
+	    if ((stmp = long_arg(argv, i, &j, &n, "--refine")) != NULL) {
+	      if ((refine = atoi(stmp)) <= 0 || !isdigit(*stmp)) {
+		fprintf(stderr,"tree: invalid time for --refine, must be greater than 0.\n");
+		exit(1);
+	      }
+	      break;
+	    }
+	    if ((stmp = long_arg(argv, i, &j, &n, "--serve")) != NULL) {
+	      servesock = stmp;
+	      break;
+	    }
+	    if ((stmp = long_arg(argv, i, &j, &n, "--query")) != NULL) {
+	      querysock = stmp;
+	      break;
+	    }
+	    if ((stmp = long_arg(argv, i, &j, &n, "--lazy")) != NULL) {
+	      if ((lazylevel = atoi(stmp)) < 1 || !isdigit(*stmp)) {
+		fprintf(stderr,"tree: invalid level for --lazy, must be greater than 0.\n");
+		exit(1);
+	      }
+	      break;
+	    }
+	    if (pred_option(argv, i, &j, &n)) break;
+	    if ((stmp = long_arg(argv, i, &j, &n, "--diff")) != NULL) {
+	      difffile = stmp;
+	      diffflag = TRUE;
+	      getfulltree = diff_getfulltree;
+	      break;
+	    }
 	    fprintf(stderr,"tree: Invalid argument `%s'.\n",argv[i]);
 	    usage(1);
 	    exit(1);
@@ -524,7 +702,14 @@ int main(int argc, char **argv)
   }
   if (p) dirname[p] = NULL;
 
+  /* The rest is up to each query: */
+  if (querysock) return serve_query(querysock, argc, argv);
+  if (servesock) return serve_run(servesock, dirname? dirname : (char *[]){ ".", NULL }, main);
+
   setoutput(outfilename);
+  if (asyncwrite) writer_start(outfilename);
+  compress_start(outfilename);
+  if (statsflag) stats_start();
 
   parse_dir_colors();
   initlinedraw(0);
@@ -535,13 +720,40 @@ int main(int argc, char **argv)
     dirname[0] = scopy(".");
     dirname[1] = NULL;
   }
-  if (topsort == NULL) topsort = basesort;
+  if (opts.topsort == NULL) opts.topsort = opts.basesort;
   if (timefmt) setlocale(LC_TIME,"");
-  if (dflag) pruneflag = FALSE;  /* You'll just get nothing otherwise. */
-  if (Rflag && (Level == -1)) Rflag = FALSE;
+  if (opts.dflag) pruneflag = FALSE;  /* You'll just get nothing otherwise. */
+  if (Rflag && (opts.level == -1)) Rflag = FALSE;
+  if (lazylevel && !Hflag) {
+    fprintf(stderr,"tree: --lazy requires -H.\n");
+    exit(1);
+  }
+  if (summaryflag && Rflag) {
+    fprintf(stderr,"tree: --summary cannot be used with -R.\n");
+    exit(1);
+  }
+  if (samplerate) {
+    if (opts.level < 0 || DUflag || Rflag) {
+      fprintf(stderr,"tree: --sample requires -L, and cannot be used with --DU or -R.\n");
+      exit(1);
+    }
+    srand48(time(NULL) ^ getpid());
+  }
+  if (deadline && (fromfile || diffflag || DUflag || samplerate || siteflag || Rflag)) {
+    fprintf(stderr,"tree: --deadline cannot be used with --fromfile, --diff, --DU, --sample, --site or -R.\n");
+    exit(1);
+  }
+  if (refine && (!deadline || summaryflag)) {
+    fprintf(stderr,"tree: --refine requires --deadline, and cannot be used with --summary.\n");
+    exit(1);
+  }
+  if (siteflag && !(Hflag && Rflag)) {
+    fprintf(stderr,"tree: --site requires -H, -R and -L.\n");
+    exit(1);
+  }
 
   // Not going to implement git configs so no core.excludesFile support.
-  if (gitignore && (stmp = getenv("GIT_DIR"))) {
+  if (opts.gitignore && (stmp = getenv("GIT_DIR"))) {
     char *path = xmalloc(PATH_MAX);
     snprintf(path, PATH_MAX, "%s/info/exclude", stmp);
     push_filterstack(new_ignorefile(path));
@@ -550,15 +762,76 @@ int main(int argc, char **argv)
   if (showinfo) {
     push_infostack(new_infofile(INFO_PATH));
   }
+  if (preload && (opts.uflag || opts.gflag)) preload_ids(preload);
+  pred_compile();
+  fields_compile(&opts);
+  unix_compile();
+  if (diffflag) {
+    if (fromfile) {
+      fprintf(stderr,"tree: --diff cannot be used with --fromfile.\n");
+      exit(1);
+    }
+    diff_load(difffile);
+  }
 
-  needfulltree = duflag || pruneflag || matchdirs || fromfile;
-
-  emit_tree(dirname, needfulltree);
+  /* --prune streams unless -l, whose loop detection depends on the walk order: */
+  needfulltree = duflag || (pruneflag && opts.lflag) || opts.matchdirs || fromfile || diffflag || siteflag || deadline;
+  /* --threads walks several directories at once, unless the walk shares state: */
+  rootthreads = nthreads > 1 && !(Rflag || siteflag || statsflag || profdirs || profannotate || fromfile ||
+				  diffflag || opts.matchdirs || DUflag || samplerate || deadline);
+
+  if (progressflag) progress_start(dirname);
+  if (deadline) deadline_start(dirname);
+  emit_tree(&opts, dirname, needfulltree);
+  while (deadline_refine()) {
+    free_inotable();
+    emit_tree(&opts, dirname, needfulltree);
+  }
+  du_finish();
+  progress_finish();
 
+  if (statsflag) stats_finish();
+  if (profdirs) profile_finish();
+  if (!compress_finish()) errors++;
+  if (asyncwrite && !writer_finish()) errors++;
   if (outfilename != NULL) fclose(outfile);
 
   return errors ? 2 : 0;
 }
+#endif
+
+/**
+ * Parses long options of the form --option=arg or --option arg, returns NULL
+ * if argv[i] is not the given option.
+ */
+char *long_arg(char *argv[], int i, int *j, int *n, char *prefix)
+{
+  char *ret = NULL;
+  int len = strlen(prefix);
+
+  if (!strncmp(prefix, argv[i], len)) {
+    *j = len;
+    if (*(argv[i]+(*j)) == '=') {
+      if (*(argv[i]+ (++(*j)))) {
+	ret = (argv[i] + (*j));
+	*j = strlen(argv[i])-1;
+      } else {
+	fprintf(stderr,"tree: missing argument to %s=\n", prefix);
+	exit(1);
+      }
+    } else if (*(argv[i]+(*j)) != '\0') {
+      return NULL;
+    } else if (argv[*n] != NULL) {
+      ret = argv[*n];
+      (*n)++;
+      *j = strlen(argv[i])-1;
+    } else {
+      fprintf(stderr,"tree: missing argument to %s\n", prefix);
+      exit(1);
+    }
+  }
+  return ret;
+}
 
 void setoutput(char *filename)
 {
@@ -590,8 +863,15 @@ void usage(int n)
 	"\t[-T title] [-o filename] [-P pattern] [-I pattern] [--gitignore]\n"
 	"\t[--matchdirs] [--metafirst] [--ignore-case] [--nolinks] [--inodes]\n"
 	"\t[--device] [--sort[=]<name>] [--dirsfirst] [--filesfirst]\n"
-	"\t[--filelimit #] [--si] [--du] [--prune] [--charset X]\n"
-	"\t[--timefmt[=]format] [--fromfile] [--noreport] [--version] [--help]\n"
+	"\t[--filelimit #] [--filelimit-estimate] [--si] [--du] [--DU] [--prune]\n"
+	"\t[--charset X] [--timefmt[=]format] [--fromfile] [--diff[=]file]\n"
+	"\t[--noreport] [--preload-ids[=nss|nss-complete|files]] [--type X]\n"
+	"\t[--newer file] [--mtime [+-]N] [--size [+-]N[ckMG]] [--user X] [--group X]\n"
+	"\t[--perm [-/]mode] [--not] [--and] [--or]\n"
+	"\t[--site] [--lazy N] [--stats] [--profile-dirs[=N]] [--profile-annotate]\n"
+	"\t[--threads N] [--async-write[=KiB]] [--io-rate N] [--serve socket]\n"
+	"\t[--query socket] [--summary[=N]] [--sample rate] [--deadline ms]\n"
+	"\t[--refine ms] [--progress[=fd]] [--compress[=X]] [--version] [--help]\n"
 	"\t[--] [directory ...]\n");
 
   if (n < 2) return;
@@ -612,9 +892,30 @@ void usage(int n)
 	"  --metafirst   Print meta-data at the beginning of each line.\n"
 	"  --info        Print information about files found in .info files.\n"
 	"  --noreport    Turn off file/directory count at end of tree listing.\n"
+	"  --summary[=N] Totals by extension, owner, group, age and size, N largest.\n"
 	"  --charset X   Use charset X for terminal/HTML and indentation line output.\n"
 	"  --filelimit # Do not descend dirs with more than # files in them.\n"
+	"  --filelimit-estimate Stop counting at the --filelimit and estimate the rest.\n"
+	"  --DU          Like --du, also counting what isn't listed (-L, -P, -a, ...).\n"
+	"  --sample rate Like --du, estimating what's past -L from a sample of it.\n"
+	"  --deadline ms List what can be read breadth first in ms milliseconds.\n"
+	"  --refine ms   After --deadline, keep reading and list again every ms.\n"
+	"  --progress[=fd] Report progress to stderr (or fd) every second.\n"
 	"  -o filename   Output to file instead of stdout.\n"
+	"  ------- Predicate options -------\n"
+	"  --type X      List only files of the types in X: f,d,l,p,s,b,c.\n"
+	"  --newer file  List only files modified more recently than file.\n"
+	"  --mtime [+-]N List only files modified (more than, less than) N days ago.\n"
+	"  --size [+-]N[ckMG] List only files of (more than, less than) N 512 byte\n"
+	"                blocks, or bytes, KiB, MiB or GiB, rounded up.\n"
+	"  --user X      List only files owned by user name or UID X.\n"
+	"  --group X     List only files owned by group name or GID X.\n"
+	"  --perm [-/]mode List only files with exactly, all of (-) or any of (/)\n"
+	"                the octal permission bits mode.\n"
+	"  --not         Negate the next predicate.\n"
+	"  --and         Require both predicates (the default between two).\n"
+	"  --or          Require either predicate (binds looser than --and).\n");
+  fprintf(stdout,
 	"  ------- File options -------\n"
 	"  -q            Print non-printable characters as '?'.\n"
 	"  -N            Print non-printable characters as is.\n"
@@ -630,6 +931,8 @@ void usage(int n)
 	"  -F            Appends '/', '=', '*', '@', '|' or '>' as per ls -F.\n"
 	"  --inodes      Print inode number of each file.\n"
 	"  --device      Print device ID number to which each file belongs.\n"
+	"  --preload-ids[=nss|nss-complete|files] Load all user and group names up\n"
+	"                front for -u/-g.\n"
 	"  ------- Sorting options -------\n"
 	"  -v            Sort files alphanumerically by version.\n"
 	"  -t            Sort files by last modification time.\n"
@@ -651,9 +954,21 @@ void usage(int n)
 	"  -H baseHREF   Prints out HTML format with baseHREF as top directory.\n"
 	"  -T string     Replace the default HTML title and H1 header with string.\n"
 	"  --nolinks     Turn off hyperlinks in HTML output.\n"
+	"  --site        With -H -R, read the tree once and write all pages from it.\n"
+	"  --lazy N      List N levels in the page and load the rest when opened.\n"
 	"  ------- Input options -------\n"
 	"  --fromfile    Reads paths from files (.=stdin)\n"
+	"  --diff file   Only list what changed since the JSON listing in file.\n"
 	"  ------- Miscellaneous options -------\n"
+	"  --stats       Print timings and call counts for the run.\n"
+	"  --profile-dirs[=N] Print the N slowest directories to read and a histogram.\n"
+	"  --profile-annotate Print the time taken to read each directory after it.\n"
+	"  --threads N   Walk the directories given and render subtrees on N threads.\n"
+	"  --async-write[=KiB] Write output from a separate thread, double buffered.\n"
+	"  --compress[=X] Compress the output with X: gzip, zstd (default by -o suffix).\n"
+	"  --io-rate N   Limit each file system to N operations a second.\n"
+	"  --serve sock  Keep the directories in memory and answer --query on sock.\n"
+	"  --query sock  Have the tree --serve on sock answer this command line.\n"
 	"  --version     Print version and exit.\n"
 	"  --help        Print usage and this help message and exit.\n"
 	"  --            Options processing terminator.\n");
@@ -663,21 +978,21 @@ void usage(int n)
 /**
  * True if file matches an -I pattern
  */
-int patignore(char *name, int isdir)
+int patignore(struct walkopts *w, char *name, int isdir)
 {
-  for(int i=0; i < ipattern; i++)
-    if (patmatch(name, ipatterns[i], isdir)) return 1;
+  for(int i=0; i < w->ipattern; i++)
+    if (patmatch(name, w->ipatterns[i], isdir, w->ignorecase)) return 1;
   return 0;
 }
 
 /**
  * True if name matches a -P pattern
  */
-int patinclude(char *name, int isdir)
+int patinclude(struct walkopts *w, char *name, int isdir)
 {
 //  printf("%s ", name);
-  for(int i=0; i < pattern; i++)
-    if (patmatch(name, patterns[i], isdir)) {
+  for(int i=0; i < w->pattern; i++)
+    if (patmatch(name, w->patterns[i], isdir, w->ignorecase)) {
 //      printf("included\n");
       return 1;
     }
@@ -686,41 +1001,147 @@ int patinclude(char *name, int isdir)
 }
 
 /**
- * Split out stat portion from read_dir as prelude to just using stat structure directly.
+ * Directories are opened relative to their parent's fd and their entries
+ * looked at with fstatat() and readlinkat(), so the kernel doesn't walk every
+ * ancestor of a deep directory again for each entry.  The fds of the
+ * directories being walked are kept on a stack whose paths are each a prefix
+ * of the next, so that one buffer holds them all.  walkfd() pops the fds that
+ * aren't ancestors of the directory asked for and opens it from the nearest
+ * one that is.  At most half the RLIMIT_NOFILE soft limit is kept open, by all
+ * the threads walking together (the stacks are per thread, the budget is
+ * shared); past that a directory is opened from the deepest fd kept and
+ * closed again on the next call.
  */
-struct _info *getinfo(char *name, char *path)
+#ifndef O_PATH
+#define O_PATH	O_RDONLY
+#endif
+
+static _Thread_local struct {
+  int *fd, *len, n, max, spare;
+  char *path;
+  size_t size;
+} walk = { .spare = -1 };
+
+/* The fds all the stacks may still keep, -1 until set: */
+static atomic_long walkbudget = -1;
+
+static void walkbudget_init(void)
 {
-  static char *lbuf = NULL;
-  static int lbufsize = 0;
-  struct _info *ent;
-  struct stat st, lst;
-  int len, rs;
+  struct rlimit rl;
+  long budget = 64;
 
-  if (lbuf == NULL) lbuf = xmalloc(lbufsize = PATH_MAX);
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) budget = rl.rlim_cur / 2;
+  if (budget < 1) budget = 1;
+  walkbudget = budget;
+}
 
-  if (lstat(path,&lst) < 0) return NULL;
+/**
+ * Takes one fd from the budget for the stack, FALSE if there's none left.
+ */
+static bool walktake(void)
+{
+  long b = atomic_load(&walkbudget);
 
-  if ((lst.st_mode & S_IFMT) == S_IFLNK) {
-    if ((rs = stat(path,&st)) < 0) memset(&st, 0, sizeof(st));
-  } else {
-    rs = 0;
-    st.st_mode = lst.st_mode;
-    st.st_dev = lst.st_dev;
-    st.st_ino = lst.st_ino;
+  while (b > 0)
+    if (atomic_compare_exchange_weak(&walkbudget, &b, b-1)) return TRUE;
+  return FALSE;
+}
+
+static void walkpop(void)
+{
+  close(walk.fd[--walk.n]);
+  atomic_fetch_add(&walkbudget, 1);
+}
+
+/**
+ * An fd for the directory dir, owned by the stack (don't close it), or -1.
+ */
+static int walkfd(char *dir)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  size_t dlen = strlen(dir);
+  int fd, len;
+  char *rel;
+
+  if (walk.spare >= 0) {
+    close(walk.spare);
+    walk.spare = -1;
   }
+  pthread_once(&once, walkbudget_init);
 
-  int isdir = (st.st_mode & S_IFMT) == S_IFDIR;
+  while (walk.n) {
+    len = walk.len[walk.n-1];
+    if (len == dlen && !memcmp(walk.path, dir, len)) return walk.fd[walk.n-1];
+    if (len < dlen && !memcmp(walk.path, dir, len) && (dir[len] == '/' || walk.path[len-1] == '/')) break;
+    walkpop();
+  }
 
-#ifndef __EMX__
-  if (gitignore && filtercheck(path, name, isdir)) return NULL;
+  if (walk.n) {
+    for(rel = dir + walk.len[walk.n-1]; *rel == '/'; rel++);
+    fd = openat(walk.fd[walk.n-1], rel, O_PATH | O_DIRECTORY);
+  } else fd = open(dir, O_PATH | O_DIRECTORY);
+  if (fd < 0) return -1;
 
-  if ((lst.st_mode & S_IFMT) != S_IFDIR && !(lflag && ((st.st_mode & S_IFMT) == S_IFDIR))) {
-    if (pattern && !patinclude(name, isdir)) return NULL;
+  if (!walktake()) return walk.spare = fd;
+  if (walk.n == walk.max) {
+    walk.fd = xrealloc(walk.fd, sizeof(int) * (walk.max += 64));
+    walk.len = xrealloc(walk.len, sizeof(int) * walk.max);
   }
-  if (ipattern && patignore(name, isdir)) return NULL;
+  if (dlen + 1 > walk.size) walk.path = xrealloc(walk.path, walk.size = dlen + PATH_MAX);
+  memcpy(walk.path, dir, dlen + 1);
+  walk.len[walk.n] = dlen;
+  walk.fd[walk.n++] = fd;
+  return fd;
+}
+
+/**
+ * Opens dir for reading, as open(dir, O_RDONLY | O_DIRECTORY).
+ */
+static int walkopen(char *dir)
+{
+  int fd = walkfd(dir);
+
+  return fd < 0? -1 : openat(fd, ".", O_RDONLY | O_DIRECTORY);
+}
+
+/**
+ * Closes the stack, so that nothing is opened from a directory that may have
+ * since been moved.
+ */
+void walk_release(void)
+{
+  while (walk.n) walkpop();
+  if (walk.spare >= 0) close(walk.spare);
+  walk.spare = -1;
+}
+
+/**
+ * Filters an entry given its lstat() and stat() (rs is stat()'s result) and
+ * makes its _info.  A symbolic link's target is lnk ("" if it couldn't be
+ * read), or read with readlinkat() if that's NULL.
+ */
+static struct _info *mkinfo(struct walkopts *w, int dfd, char *name, char *path, struct stat *lstp, struct stat *stp, int rs, char *lnk)
+{
+  static _Thread_local char *lbuf = NULL;
+  static _Thread_local int lbufsize = 0;
+  struct stat st = *stp, lst = *lstp;
+  struct _info *ent;
+  int len, ph, skip = 0;
+  int isdir = (st.st_mode & S_IFMT) == S_IFDIR;
+
+#ifndef __EMX__
+  ph = stats_enter(PH_FILTER);
+  if (npreds && (lst.st_mode & S_IFMT) != S_IFDIR && !(w->lflag && ((st.st_mode & S_IFMT) == S_IFDIR)) &&
+      !pred_match(&lst)) skip = 1;
+  else if (w->gitignore && filtercheck(w, path, name, isdir)) skip = 1;
+  else if ((lst.st_mode & S_IFMT) != S_IFDIR && !(w->lflag && ((st.st_mode & S_IFMT) == S_IFDIR)) &&
+	   w->pattern && !patinclude(w, name, isdir)) skip = 1;
+  else if (w->ipattern && patignore(w, name, isdir)) skip = 1;
+  stats_leave(ph);
+  if (skip) return NULL;
 #endif
 
-  if (dflag && ((st.st_mode & S_IFMT) != S_IFDIR)) return NULL;
+  if (w->dflag && ((st.st_mode & S_IFMT) != S_IFDIR)) return NULL;
 
 #ifndef __EMX__
 //    if (pattern && ((lst.st_mode & S_IFMT) == S_IFLNK) && !lflag) continue;
@@ -761,14 +1182,21 @@ struct _info *getinfo(char *name, char *path)
   ent->isexe  = (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) ? 1 : 0;
 
   if ((lst.st_mode & S_IFMT) == S_IFLNK) {
-    if (lst.st_size+1 > lbufsize) lbuf = xrealloc(lbuf,lbufsize=(lst.st_size+8192));
-    if ((len=readlink(path,lbuf,lbufsize-1)) < 0) {
+    if (lnk) len = *lnk? (int)strlen(lnk) : -1;
+    else {
+      if (lbuf == NULL || lst.st_size+1 > lbufsize) lbuf = xrealloc(lbuf,lbufsize=(lst.st_size+8192));
+      ph = stats_enter(PH_STAT);
+      stats_count[ST_READLINK]++;
+      len = readlinkat(dfd,name,lbuf,lbufsize-1);
+      stats_leave(ph);
+    }
+    if (len < 0) {
       ent->lnk = scopy("[Error reading symbolic link information]");
       ent->isdir = FALSE;
       ent->lnkmode = st.st_mode;
     } else {
-      lbuf[len] = 0;
-      ent->lnk = scopy(lbuf);
+      if (lnk == NULL) lbuf[len] = 0;
+      ent->lnk = scopy(lnk? lnk : lbuf);
       if (rs < 0) ent->orphan = TRUE;
       ent->lnkmode = st.st_mode;
     }
@@ -780,38 +1208,258 @@ struct _info *getinfo(char *name, char *path)
   return ent;
 }
 
-struct _info **read_dir(char *dir, int *n, int infotop)
+/**
+ * Split out stat portion from read_dir as prelude to just using stat structure directly.
+ * The entry is looked up as name in the directory dfd; path is only needed by
+ * --gitignore.
+ */
+static struct _info *getinfo(struct walkopts *w, int dfd, char *name, char *path)
+{
+  struct stat st, lst;
+  int rs, ph;
+
+  TREE_PROBE1(stat_entry, name);
+  ph = stats_enter(PH_STAT);
+  stats_count[ST_LSTAT]++;
+  if (fstatat(dfd,name,&lst,AT_SYMLINK_NOFOLLOW) < 0) {
+    stats_leave(ph);
+    TREE_PROBE2(stat_return, name, 0);
+    return NULL;
+  }
+
+  if ((lst.st_mode & S_IFMT) == S_IFLNK) {
+    stats_count[ST_STAT]++;
+    if ((rs = fstatat(dfd,name,&st,0)) < 0) memset(&st, 0, sizeof(st));
+  } else {
+    rs = 0;
+    st.st_mode = lst.st_mode;
+    st.st_dev = lst.st_dev;
+    st.st_ino = lst.st_ino;
+  }
+  stats_leave(ph);
+  TREE_PROBE2(stat_return, name, 1);
+
+  return mkinfo(w, dfd, name, path, &lst, &st, rs, NULL);
+}
+
+/**
+ * --filelimit: Counts what read_dir() would return for dir from the names and
+ * types that getdents() gives, with no stat() and no allocation, so that an
+ * enormous directory can be skipped without reading it the slow way.  Returns
+ * the count if it's over the limit and exact, otherwise 0 and read_dir() has
+ * to be used: the directory is under the limit, can't be opened, or has
+ * entries whose type isn't known (symbolic links, file systems without d_type)
+ * while a filter depends on it, or the directory is in the --serve index.
+ * With --filelimit-estimate counting stops at the end of the getdents() buffer
+ * in which the limit is passed, and if the directory has more to read the rest
+ * is estimated from the directory's size, as the average name length seen so
+ * far suggests.
+ */
+static _Thread_local bool flimitguessed;
+static _Thread_local int flimitsubdirs;
+
+#ifdef __linux__
+struct linux_dirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+#endif
+
+int filelimit_count(struct walkopts *w, char *dir)
+{
+#ifdef __linux__
+  char buf[32768], path[PATH_MAX];
+  struct linux_dirent64 *ent;
+  struct stat st;
+  long nread, pos;
+  unsigned long seen = 0, namelen = 0, count = 0, unsure = 0, est;
+  bool filters = w->gitignore || w->pattern || w->ipattern || w->dflag || npreds, isdir;
+  bool over = FALSE;
+  int fd, len, dirlen = strlen(dir);
+  char *name;
+
+  flimitguessed = FALSE;
+  if (serve_lookup(dir, &len)) return 0;
+  if (w->gitignore && dirlen + 2 < PATH_MAX) sprintf(path, "%s/", dir);
+  if ((fd = walkopen(dir)) < 0) return 0;
+  stats_count[ST_OPENDIR]++;
+  while ((nread = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+    for(pos = 0; pos < nread; pos += ent->d_reclen) {
+      ent = (struct linux_dirent64 *)(buf + pos);
+      name = ent->d_name;
+      if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+      if (Hflag && !strcmp(name, "00Tree.html")) continue;
+      if (siteflag && !strcmp(name, "00Tree.css")) continue;
+      if (lazylevel && !strcmp(name, "00Tree.json")) continue;
+      if (!w->aflag && *name == '.') continue;
+      seen++;
+      namelen += strlen(name);
+
+      if (filters) {
+	if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK) {
+	  unsure++;
+	  continue;
+	}
+	isdir = (ent->d_type == DT_DIR);
+	if (w->gitignore) {
+	  len = strlen(name);
+	  if (dirlen + len + 2 > PATH_MAX) {
+	    unsure++;
+	    continue;
+	  }
+	  memcpy(path + dirlen + 1, name, len + 1);
+	  if (filtercheck(w, path, name, isdir)) continue;
+	}
+	if (!isdir && npreds) {
+	  stats_count[ST_LSTAT]++;
+	  if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+	    unsure++;
+	    continue;
+	  }
+	  if (!pred_match(&st)) continue;
+	}
+	if (!isdir && w->pattern && !patinclude(w, name, isdir)) continue;
+	if (w->ipattern && patignore(w, name, isdir)) continue;
+	if (w->dflag && !isdir) continue;
+      }
+      if (++count > flimit && flimitest) over = TRUE;
+    }
+    /* A full buffer means there's more, otherwise ask whether there is: */
+    if (over) {
+      if (nread > (long)sizeof(buf) - 512) goto estimate;
+      if (syscall(SYS_getdents64, fd, buf, sizeof(buf)) != 0) goto estimate;
+      break;
+    }
+  }
+  if (over && unsure) goto estimate;
+  close(fd);
+  return (count > flimit && !unsure)? count : 0;
+
+estimate:
+  /* Directory size / average on-disk entry size (8 bytes + name, 4 aligned),
+   * no more than the smallest (12 byte) entries would fill: */
+  flimitguessed = TRUE;
+  flimitsubdirs = -1;
+  est = count;
+  if (fstat(fd, &st) == 0) {
+    est = st.st_size / ((8 + namelen / seen + 3) & ~3UL) * count / seen;
+    if (est > (unsigned long)st.st_size / 12) est = st.st_size / 12;
+    if (est < count) est = count;
+    if (st.st_nlink > 2) flimitsubdirs = st.st_nlink - 2;
+  }
+  close(fd);
+  return est > INT_MAX? INT_MAX : est;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * The error for a directory with n entries over the --filelimit.
+ */
+char *filelimit_msg(char *buf, int n)
+{
+  if (!flimitguessed) sprintf(buf, "%d entries exceeds filelimit, not opening dir", n);
+  else if (flimitsubdirs < 0) sprintf(buf, "about %d entries exceeds filelimit, not opening dir", n);
+  else sprintf(buf, "about %d entries (%d director%s) exceeds filelimit, not opening dir", n, flimitsubdirs, flimitsubdirs == 1? "y" : "ies");
+  return buf;
+}
+
+/* --DU: Size of what the last read_dir() left out: */
+static _Thread_local off_t duhidden;
+
+struct _info **read_dir(struct walkopts *w, char *dir, int *n, int infotop)
 {
   struct comment *com;
-  static char *path = NULL;
-  static long pathsize;
+  static _Thread_local char *path = NULL;
+  static _Thread_local long pathsize;
   struct _info **dl, *info;
   struct dirent *ent;
-  DIR *d;
-  int ne, p = 0, i;
-  int es = (dir[strlen(dir)-1] == '/');
+  struct servent *se;
+  struct stat st;
+  DIR *d = NULL;
+  int ne, p = 0, i, ph, hidden, fd, len, sn = 0, si = 0, dfd;
+  int dirlen = strlen(dir), es = (dir[dirlen-1] == '/');
+  bool needpath;
+  double t0 = 0, t1 = 0, t = 0, tstat = 0, io;
+  u_long count = 0;
+  char *name;
 
-  if (path == NULL) {
-    path=xmalloc(pathsize = strlen(dir)+PATH_MAX);
-  }
+  /* --serve: A directory in the index is read from it, its entries are then
+   * known only by their paths: */
+  se = serve_lookup(dir, &sn);
+  needpath = w->gitignore || showinfo || DUflag || se;
+
+  /* Entry paths are dir/ with each name copied in after it: */
+  if (dirlen+2 > pathsize) path = xrealloc(path,pathsize=(dirlen+PATH_MAX));
+  memcpy(path, dir, dirlen);
+  if (!es) path[dirlen++] = '/';
 
   *n = -1;
-  if ((d=opendir(dir)) == NULL) return NULL;
+  duhidden = 0;
+  TREE_PROBE1(dir_open, dir);
+  ph = stats_enter(PH_READDIR);
+  stats_count[ST_OPENDIR]++;
+  if (profdirs) t0 = profile_now();
+  if (se == NULL) {
+    /* The directory's own file system is the one to throttle its reads by: */
+    if ((fd = walkfd(dir)) >= 0) {
+      stats_count[ST_STAT]++;
+      if (fstat(fd, &st) == 0) io_dev(st.st_dev, fd, ".");
+      io = io_begin();
+      fd = openat(fd, ".", O_RDONLY | O_DIRECTORY);
+      io_end(io);
+    }
+    if (fd >= 0 && (d = fdopendir(fd)) == NULL) close(fd);
+  }
+  if (profdirs) t1 = profile_now();
+  if (d == NULL && se == NULL) {
+    stats_leave(ph);
+    if (profdirs) profile_dir(dir, t1-t0, 0, 0, 0);
+    TREE_PROBE2(dir_close, dir, -1);
+    return NULL;
+  }
 
   dl = (struct _info **)xmalloc(sizeof(struct _info *) * (ne = MINIT));
 
-  while((ent = (struct dirent *)readdir(d))) {
-    if (!strcmp("..",ent->d_name) || !strcmp(".",ent->d_name)) continue;
-    if (Hflag && !strcmp(ent->d_name,"00Tree.html")) continue;
-    if (!aflag && ent->d_name[0] == '.') continue;
+  dfd = d? dirfd(d) : AT_FDCWD;
+  for(;;) {
+    if (se) {
+      if (si == sn) break;
+      name = se[si++].name;
+    } else if ((ent = (struct dirent *)readdir(d)) != NULL) name = ent->d_name;
+    else break;
+    stats_count[ST_READDIR]++;
+    if (!strcmp("..",name) || !strcmp(".",name)) continue;
+    hidden = (Hflag && !strcmp(name,"00Tree.html")) || (siteflag && !strcmp(name,"00Tree.css")) ||
+	     (lazylevel && !strcmp(name,"00Tree.json")) || (!w->aflag && name[0] == '.');
+    if (hidden && !DUflag) continue;
+
+    if (needpath) {
+      len = strlen(name);
+      if (dirlen+len+1 > pathsize) path = xrealloc(path,pathsize=(dirlen+len+PATH_MAX));
+      memcpy(path+dirlen, name, len+1);
+    }
 
-    if (strlen(dir)+strlen(ent->d_name)+2 > pathsize) path = xrealloc(path,pathsize=(strlen(dir)+strlen(ent->d_name)+PATH_MAX));
-    if (es) sprintf(path, "%s%s", dir, ent->d_name);
-    else sprintf(path,"%s/%s",dir,ent->d_name);
+    if (hidden) {
+      duhidden += du_entry(dfd, d? name : path, path);
+      continue;
+    }
 
-    info = getinfo(ent->d_name, path);
+    count++;
+    if (profdirs) t = profile_now();
+    if (se) info = mkinfo(w, dfd, name, path, &se[si-1].lst, &se[si-1].st, se[si-1].rs, se[si-1].lnk);
+    else {
+      io = io_begin();
+      info = getinfo(w, dfd, name, path);
+      io_end(io);
+    }
+    if (profdirs) tstat += profile_now() - t;
     if (info) {
-      if (showinfo && (com = infocheck(path, ent->d_name, infotop, info->isdir))) {
+      if (showinfo && (com = infocheck(w, path, name, infotop, info->isdir))) {
 	for(i = 0; com->desc[i] != NULL; i++);
 	info->comment = xmalloc(sizeof(char *) * (i+1));
 	for(i = 0; com->desc[i] != NULL; i++) info->comment[i] = scopy(com->desc[i]);
@@ -819,9 +1467,13 @@ struct _info **read_dir(char *dir, int *n, int infotop)
       }
       if (p == (ne-1)) dl = (struct _info **)xrealloc(dl,sizeof(struct _info *) * (ne += MINC));
       dl[p++] = info;
-    }
+    } else if (DUflag) duhidden += du_entry(dfd, d? name : path, path);
   }
-  closedir(d);
+  if (d) closedir(d);
+  stats_leave(ph);
+  TREE_PROBE2(dir_close, dir, p);
+  if (profdirs) profile_dir(dir, t1-t0, profile_now()-t1-tstat, tstat, count);
+  if (progressflag) progress_read(dir, dl, p);
 
   if ((*n = p) == 0) {
     free(dl);
@@ -832,9 +1484,9 @@ struct _info **read_dir(char *dir, int *n, int infotop)
   return dl;
 }
 
-void push_files(char *dir, struct ignorefile **ig, struct infofile **inf)
+void push_files(struct walkopts *w, char *dir, struct ignorefile **ig, struct infofile **inf)
 {
-  if (gitignore) {
+  if (w->gitignore) {
     *ig = new_ignorefile(dir);
     if (*ig != NULL) push_filterstack(*ig);
   }
@@ -844,31 +1496,51 @@ void push_files(char *dir, struct ignorefile **ig, struct infofile **inf)
   }
 }
 
+/**
+ * unix_getfulltree() for the directory ent at path, unless --deadline leaves
+ * it out.
+ */
+static struct _info **getsubtree(struct walkopts *w, char *path, u_long lev, dev_t dev, struct _info *ent)
+{
+  if (!(w->level >= 0 && lev > w->level) && deadline_cut(path)) {
+    ent->truncated = TRUE;
+    return NULL;
+  }
+  return unix_getfulltree(w, path, lev, dev, &ent->size, &ent->err);
+}
+
 /* This is for all the impossible things people wanted the old tree to do.
  * This can and will use a large amount of memory for large directory trees
  * and also take some time.
  */
-struct _info **unix_getfulltree(char *d, u_long lev, dev_t dev, off_t *size, char **err)
+struct _info **unix_getfulltree(struct walkopts *w, char *d, u_long lev, dev_t dev, off_t *size, char **err)
 {
   char *path;
   long pathsize = 0;
   struct ignorefile *ig = NULL;
   struct infofile *inf = NULL;
   struct _info **dir, **sav, **p, *sp;
+  struct walkopts *rw = w, nopat;
   struct stat sb;
   int n;
   u_long lev_tmp;
-  int tmp_pattern = 0;
+  off_t hidden;
   char *start_rel_path;
 
   *err = NULL;
-  if (Level >= 0 && lev > Level) return NULL;
-  if (xdev && lev == 0) {
+  if (w->level >= 0 && lev > w->level) {
+    if (DUflag) *size += du_size(d);
+    else if (samplerate) *size += sample_dir(d);
+    return NULL;
+  }
+  if (w->xdev && lev == 0) {
+    stats_count[ST_STAT]++;
     stat(d,&sb);
     dev = sb.st_dev;
   }
+  if ((DUflag || samplerate) && lev == 0) du_root(dev);
   // if the directory name matches, turn off pattern matching for contents
-  if (matchdirs && pattern) {
+  if (w->matchdirs && w->pattern) {
     lev_tmp = lev;
     start_rel_path = d + strlen(d);
     for (start_rel_path = d + strlen(d); start_rel_path != d; --start_rel_path) {
@@ -880,57 +1552,60 @@ struct _info **unix_getfulltree(char *d, u_long lev, dev_t dev, off_t *size, cha
         break;
       }
     }
-    if (*start_rel_path && patinclude(start_rel_path, 1)) {
-      tmp_pattern = pattern;
-      pattern = 0;
+    if (*start_rel_path && patinclude(w, start_rel_path, 1)) {
+      nopat = *w;
+      nopat.pattern = 0;
+      rw = &nopat;
     }
   }
 
-  push_files(d, &ig, &inf);
+  push_files(w, d, &ig, &inf);
 
-  sav = dir = read_dir(d, &n, inf != NULL);
-  if (tmp_pattern) {
-    pattern = tmp_pattern;
-    tmp_pattern = 0;
+  if (flimit > 0 && (n = filelimit_count(rw, d)) > 0) sav = dir = NULL;
+  else sav = dir = read_dir(rw, d, &n, inf != NULL);
+  hidden = duhidden;
+  if (flimit > 0 && n > flimit) {
+    char msg[256];
+    if (DUflag) *size += du_size(d);
+    *err = scopy(filelimit_msg(msg, n));
+    if (sav != NULL) free_dir(sav);
+    return NULL;
   }
   if (dir == NULL && n) {
     *err = scopy("error opening dir");
-    errors++;
+    (*w->errors)++;
     return NULL;
   }
   if (n == 0) {
+    if (DUflag) *size += hidden;
     if (sav != NULL) free_dir(sav);
     return NULL;
   }
   path = xmalloc(pathsize=PATH_MAX);
-  
-  if (flimit > 0 && n > flimit) {
-    sprintf(path,"%d entries exceeds filelimit, not opening dir",n);
-    *err = scopy(path);
-    free_dir(sav);
-    free(path);
-    return NULL;
-  }
+
+  if (DUflag) *size += hidden;
 
   if (lev >= maxdirs-1) {
     dirs = xrealloc(dirs,sizeof(int) * (maxdirs += 1024));
   }
 
   while (*dir) {
-    if ((*dir)->isdir && !(xdev && dev != (*dir)->dev)) {
+    if ((*dir)->isdir && !(w->xdev && dev != (*dir)->dev)) {
+      /* The first directory profiled below is this one: */
+      int mark = profile_last();
       if ((*dir)->lnk) {
-	if (lflag) {
+	if (w->lflag) {
 	  if (findino((*dir)->inode,(*dir)->dev)) {
 	    (*dir)->err = scopy("recursive, not followed");
 	  } else {
 	    saveino((*dir)->inode, (*dir)->dev);
 	    if (*(*dir)->lnk == '/')
-	      (*dir)->child = unix_getfulltree((*dir)->lnk,lev+1,dev,&((*dir)->size),&((*dir)->err));
+	      (*dir)->child = getsubtree(w,(*dir)->lnk,lev+1,dev,*dir);
 	    else {
 	      if (strlen(d)+strlen((*dir)->lnk)+2 > pathsize) path=xrealloc(path,pathsize=(strlen(d)+strlen((*dir)->name)+1024));
 	      if (fflag && !strcmp(d,"/")) sprintf(path,"%s%s",d,(*dir)->lnk);
 	      else sprintf(path,"%s/%s",d,(*dir)->lnk);
-	      (*dir)->child = unix_getfulltree(path,lev+1,dev,&((*dir)->size),&((*dir)->err));
+	      (*dir)->child = getsubtree(w,path,lev+1,dev,*dir);
 	    }
 	  }
 	}
@@ -939,12 +1614,14 @@ struct _info **unix_getfulltree(char *d, u_long lev, dev_t dev, off_t *size, cha
 	if (fflag && !strcmp(d,"/")) sprintf(path,"%s%s",d,(*dir)->name);
 	else sprintf(path,"%s/%s",d,(*dir)->name);
 	saveino((*dir)->inode, (*dir)->dev);
-	(*dir)->child = unix_getfulltree(path,lev+1,dev,&((*dir)->size),&((*dir)->err));
+	(*dir)->child = getsubtree(w,path,lev+1,dev,*dir);
       }
+      if (profile_last() > mark) (*dir)->prof = mark+1;
       // prune empty folders, unless they match the requested pattern
-      if (pruneflag && (*dir)->child == NULL &&
-	  !(matchdirs && pattern && patinclude((*dir)->name, (*dir)->isdir))) {
+      if (pruneflag && (*dir)->child == NULL && !(*dir)->truncated &&
+	  !(w->matchdirs && w->pattern && patinclude(w, (*dir)->name, (*dir)->isdir))) {
 	sp = *dir;
+	if (DUflag) *size += sp->size;
 	for(p=dir;*p;p++) *p = *(p+1);
 	n--;
 	free(sp->name);
@@ -958,7 +1635,12 @@ struct _info **unix_getfulltree(char *d, u_long lev, dev_t dev, off_t *size, cha
   }
 
   // sorting needs to be deferred for --du:
-  if (topsort) qsort(sav,n,sizeof(struct _info *),topsort);
+  if (w->topsort) {
+    int ph = stats_enter(PH_SORT);
+    stats_count[ST_QSORT]++;
+    sortdir(w, sav, n, w->topsort);
+    stats_leave(ph);
+  }
 
   free(path);
   if (n == 0) {
@@ -970,6 +1652,22 @@ struct _info **unix_getfulltree(char *d, u_long lev, dev_t dev, off_t *size, cha
   return sav;
 }
 
+/* The walk whose directory this thread is sorting, for the comparators, which
+ * qsort() gives no argument of their own: */
+static _Thread_local struct walkopts *sorting = &opts;
+
+/**
+ * Sorts a directory's n entries with cmp, one of w's sorts.
+ */
+void sortdir(struct walkopts *w, struct _info **dir, int n, int (*cmp)())
+{
+  struct walkopts *save = sorting;
+
+  sorting = w;
+  qsort(dir, n, sizeof(struct _info *), cmp);
+  sorting = save;
+}
+
 /**
  * filesfirst and dirsfirst are now top-level meta-sorts.
  */
@@ -978,7 +1676,7 @@ int filesfirst(struct _info **a, struct _info **b)
   if ((*a)->isdir != (*b)->isdir) {
     return (*a)->isdir ? 1 : -1;
   }
-  return basesort(a, b);
+  return sorting->basesort(a, b);
 }
 
 int dirsfirst(struct _info **a, struct _info **b)
@@ -986,20 +1684,20 @@ int dirsfirst(struct _info **a, struct _info **b)
   if ((*a)->isdir != (*b)->isdir) {
     return (*a)->isdir ? -1 : 1;
   }
-  return basesort(a, b);
+  return sorting->basesort(a, b);
 }
 
 /* Sorting functions */
 int alnumsort(struct _info **a, struct _info **b)
 {
   int v = strcoll((*a)->name,(*b)->name);
-  return reverse? -v : v;
+  return sorting->reverse? -v : v;
 }
 
 int versort(struct _info **a, struct _info **b)
 {
   int v = strverscmp((*a)->name,(*b)->name);
-  return reverse? -v : v;
+  return sorting->reverse? -v : v;
 }
 
 int mtimesort(struct _info **a, struct _info **b)
@@ -1008,10 +1706,10 @@ int mtimesort(struct _info **a, struct _info **b)
 
   if ((*a)->mtime == (*b)->mtime) {
     v = strcoll((*a)->name,(*b)->name);
-    return reverse? -v : v;
+    return sorting->reverse? -v : v;
   }
   v =  (*a)->mtime == (*b)->mtime? 0 : ((*a)->mtime < (*b)->mtime ? -1 : 1);
-  return reverse? -v : v;
+  return sorting->reverse? -v : v;
 }
 
 int ctimesort(struct _info **a, struct _info **b)
@@ -1020,10 +1718,10 @@ int ctimesort(struct _info **a, struct _info **b)
 
   if ((*a)->ctime == (*b)->ctime) {
     v = strcoll((*a)->name,(*b)->name);
-    return reverse? -v : v;
+    return sorting->reverse? -v : v;
   }
   v = (*a)->ctime == (*b)->ctime? 0 : ((*a)->ctime < (*b)->ctime? -1 : 1);
-  return reverse? -v : v;
+  return sorting->reverse? -v : v;
 }
 
 int sizecmp(off_t a, off_t b)
@@ -1035,7 +1733,7 @@ int fsizesort(struct _info **a, struct _info **b)
 {
   int v = sizecmp((*a)->size, (*b)->size);
   if (v == 0) v = strcoll((*a)->name,(*b)->name);
-  return reverse? -v : v;
+  return sorting->reverse? -v : v;
 }
 
 void *xmalloc (size_t size)
@@ -1084,9 +1782,9 @@ char *gnu_getcwd()
   }
 }
 
-static inline char cond_lower(char c)
+static inline char cond_lower(char c, bool icase)
 {
-  return ignorecase ? tolower(c) : c;
+  return icase ? tolower(c) : c;
 }
 
 /*
@@ -1098,26 +1796,29 @@ static inline char cond_lower(char c)
  *    0 on a mismatch
  *   -1 on a syntax error in the pattern
  */
-int patmatch(char *buf, char *pat, int isdir)
+static int dopatmatch(char *buf, char *pat, int isdir, bool icase)
 {
   int match = 1,m,n;
   char *bar = strchr(pat, '|');
   char pprev = 0;
 
+  stats_count[ST_PATMATCH]++;
+
   /* If a bar is found, call patmatch recursively on the two sub-patterns */
   if (bar) {
     /* If the bar is the first or last character, it's a syntax error */
     if (bar == pat || !bar[1]) {
       return -1;
     }
-    /* Break pattern into two sub-patterns */
-    *bar = '\0';
-    match = patmatch(buf, pat, isdir);
+    /* Match the first sub-pattern from a copy, the pattern may be in use on
+     * other threads: */
+    char first[bar - pat + 1];
+    memcpy(first, pat, bar - pat);
+    first[bar - pat] = '\0';
+    match = dopatmatch(buf, first, isdir, icase);
     if (!match) {
-      match = patmatch(buf, bar+1, isdir);
+      match = dopatmatch(buf, bar+1, isdir, icase);
     }
-    /* Join sub-patterns back into one pattern */
-    *bar = '|';
     return match;
   }
 
@@ -1140,11 +1841,11 @@ int patmatch(char *buf, char *pat, int isdir)
 	  pat += 2;
 	  if(*pat == '\\' && *pat)
 	    pat++;
-	  if(cond_lower(*buf) >= cond_lower(m) && cond_lower(*buf) <= cond_lower(*pat))
+	  if(cond_lower(*buf, icase) >= cond_lower(m, icase) && cond_lower(*buf, icase) <= cond_lower(*pat, icase))
 	    match = n;
 	  if(!*pat)
 	    pat--;
-	} else if(cond_lower(*buf) == cond_lower(*pat)) match = n;
+	} else if(cond_lower(*buf, icase) == cond_lower(*pat, icase)) match = n;
 	pat++;
       }
       buf++;
@@ -1158,17 +1859,17 @@ int patmatch(char *buf, char *pat, int isdir)
 	pat++;
 	if(!*pat) return 1;
 
-	while(*buf && !(match = patmatch(buf, pat, isdir))) {
+	while(*buf && !(match = dopatmatch(buf, pat, isdir, icase))) {
 	  // ../**/.. is allowed to match a null /:
-	  if (pprev == '/' && *pat == '/' && *(pat+1) && (match = patmatch(buf, pat+1, isdir))) return match;
+	  if (pprev == '/' && *pat == '/' && *(pat+1) && (match = dopatmatch(buf, pat+1, isdir, icase))) return match;
 	  buf++;
 	  while(*buf && *buf != '/') buf++;
 	}
       } else {
-	while(*buf && !(match = patmatch(buf++, pat, isdir)));
+	while(*buf && !(match = dopatmatch(buf++, pat, isdir, icase)));
 //	if (!*buf && !match) match = patmatch(buf, pat, isdir);
       }
-      if (!*buf && !match) match = patmatch(buf, pat, isdir);
+      if (!*buf && !match) match = dopatmatch(buf, pat, isdir, icase);
       return match;
     case '?':
       if(!*buf) return 0;
@@ -1182,7 +1883,7 @@ int patmatch(char *buf, char *pat, int isdir)
       if(*pat)
 	pat++;
     default:
-      match = (cond_lower(*buf++) == cond_lower(*pat));
+      match = (cond_lower(*buf++, icase) == cond_lower(*pat, icase));
       break;
     }
     pprev = *pat++;
@@ -1192,6 +1893,20 @@ int patmatch(char *buf, char *pat, int isdir)
   return 0;
 }
 
+/**
+ * The pattern matching as seen from outside, with the probes around it.
+ * icase ignores case (--ignore-case).
+ */
+int patmatch(char *buf, char *pat, int isdir, bool icase)
+{
+  int match;
+
+  TREE_PROBE2(patmatch_entry, buf, pat);
+  match = dopatmatch(buf, pat, isdir, icase);
+  TREE_PROBE3(patmatch_return, buf, pat, match);
+  return match;
+}
+
 
 /**
  * They cried out for ANSI-lines (not really), but here they are, as an option
@@ -1206,7 +1921,7 @@ void indent(int maxlevel)
     for(i=1; (i <= maxlevel) && dirs[i]; i++) {
       if (dirs[i+1]) {
 	if (dirs[i] == 1) fprintf(outfile,"\170   ");
-	else printf("    ");
+	else fprintf(outfile,"    ");
       } else {
 	if (dirs[i] == 1) fprintf(outfile,"\164\161\161 ");
 	else fprintf(outfile,"\155\161\161 ");
@@ -1239,7 +1954,8 @@ char *prot(mode_t m)
     if(!(m&*p))
       *cp='-';
 #else
-  static char buf[11], perms[] = "rwxrwxrwx";
+  static _Thread_local char buf[11];
+  static char perms[] = "rwxrwxrwx";
   int i, b;
 
   for(i=0;ifmt[i] && (m&S_IFMT) != ifmt[i];i++);
@@ -1264,10 +1980,10 @@ char *prot(mode_t m)
 
 char *do_date(time_t t)
 {
-  static char buf[256];
-  struct tm *tm;
+  static _Thread_local char buf[256];
+  struct tm tmbuf, *tm;
 
-  tm = localtime(&t);
+  tm = localtime_r(&t, &tmbuf);
 
   if (timefmt) {
     strftime(buf,255,timefmt,tm);
@@ -1354,7 +2070,7 @@ int psize(char *buf, off_t size)
 char Ftype(mode_t mode)
 {
   int m = mode & S_IFMT;
-  if (!dflag && m == S_IFDIR) return '/';
+  if (!opts.dflag && m == S_IFDIR) return '/';
   else if (m == S_IFSOCK) return '=';
   else if (m == S_IFIFO) return '|';
   else if (m == S_IFLNK) return '@'; /* Here, but never actually used though. */
@@ -1367,7 +2083,7 @@ char Ftype(mode_t mode)
 
 struct _info *stat2info(struct stat *st)
 {
-  static struct _info info;
+  static _Thread_local struct _info info;
 
   info.linode = st->st_ino;
   info.ldev = st->st_dev;
@@ -1390,30 +2106,3 @@ struct _info *stat2info(struct stat *st)
   return &info;
 }
 
-char *fillinfo(char *buf, struct _info *ent)
-{
-  int n;
-  buf[n=0] = 0;
-  #ifdef __USE_FILE_OFFSET64
-  if (inodeflag) n += sprintf(buf," %7lld",(long long)ent->linode);
-  #else
-  if (inodeflag) n += sprintf(buf," %7ld",(long int)ent->linode);
-  #endif
-  if (devflag) n += sprintf(buf+n, " %3d", (int)ent->ldev);
-  #ifdef __EMX__
-  if (pflag) n += sprintf(buf+n, " %s",prot(ent->attr));
-  #else
-  if (pflag) n += sprintf(buf+n, " %s", prot(ent->mode));
-  #endif
-  if (uflag) n += sprintf(buf+n, " %-8.32s", uidtoname(ent->uid));
-  if (gflag) n += sprintf(buf+n, " %-8.32s", gidtoname(ent->gid));
-  if (sflag) n += psize(buf+n,ent->size);
-  if (Dflag) n += sprintf(buf+n, " %s", do_date(cflag? ent->ctime : ent->mtime));
-
-  if (buf[0] == ' ') {
-      buf[0] = '[';
-      sprintf(buf+n, "]");
-  }
-
-  return buf;
-}
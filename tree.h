@@ -33,6 +33,8 @@
 #include <limits.h>
 #include <pwd.h>
 #include <grp.h>
+#include <errno.h>
+#include <pthread.h>
 #ifdef __EMX__  /* for OS/2 systems */
 #  define INCL_DOSFILEMGR
 #  define INCL_DOSNLS
@@ -56,6 +58,8 @@
 #include <wchar.h>
 #include <wctype.h>
 
+#include "probe.h"
+
 #ifdef __ANDROID
 #define mbstowcs(w,m,x) mbsrtowcs(w,(const char**)(& #m),x,NULL)
 #endif
@@ -81,6 +85,7 @@
 #define scopy(x)	strcpy(xmalloc(strlen(x)+1),(x))
 #define MINIT		30	/* number of dir entries to initially allocate */
 #define MINC		20	/* allocation increment */
+#define LAZYDESCEND	100	/* printfile() descend flag for a --lazy directory */
 
 #ifndef TRUE
 typedef enum {FALSE=0, TRUE} bool;
@@ -110,6 +115,34 @@ struct _info {
   const char *tag;
   char **comment;
   struct _info **child, *next, *tchild;
+  /* --diff: */
+  int diff;
+  off_t delta;
+  /* --profile-annotate: */
+  int prof;
+  /* Streaming --prune, a directory read ahead and its .gitignore/.info: */
+  struct ignorefile *ig;
+  struct infofile *inf;
+  /* --deadline, a directory not read in time: */
+  bool truncated;
+};
+
+/* diff.c */
+enum { DIFF_NONE, DIFF_ADDED, DIFF_REMOVED, DIFF_MODIFIED };
+
+/* stats.c */
+enum {
+  ST_OPENDIR, ST_READDIR, ST_LSTAT, ST_STAT, ST_READLINK, ST_GETPWUID, ST_GETGRGID,
+  ST_PATMATCH, ST_FILTERCHECK, ST_QSORT, ST_UID_HIT, ST_GID_HIT, ST_INO_HIT, ST_INO_MISS,
+  ST_MAX
+};
+enum { PH_OUTPUT, PH_READDIR, PH_STAT, PH_FILTER, PH_SORT, PH_NAMES, PH_MAX };
+extern u_long stats_count[ST_MAX];
+
+/* profile.c */
+struct dirprof {
+  double open, read, stat, total;
+  u_long entries;
 };
 
 /* list.c */
@@ -118,24 +151,48 @@ struct totals {
   off_t size;
 };
 
+struct walkopts;
+
 struct listingcalls {
   void (*intro)(void);
   void (*outtro)(void);
-  int (*printinfo)(char *dirname, struct _info *file, int level);
-  int (*printfile)(char *dirname, char *filename, struct _info *file, int descend);
+  int (*printinfo)(struct walkopts *w, char *dirname, struct _info *file, int level);
+  int (*printfile)(struct walkopts *w, char *dirname, char *filename, struct _info *file, int descend);
   int (*error)(char *error);
   void (*newline)(struct _info *file, int level, int postdir, int needcomma);
   void (*close)(struct _info *file, int level, int needcomma);
-  void (*report)(struct totals tot);
+  void (*report)(struct walkopts *w, struct totals tot);
 };
 
+/* fields.c */
+typedef char *(*field_t)(char *p, struct _info *ent);
+#define MAXFIELDS	8
 
-/* hash.c */
-struct xtable {
-  unsigned int xid;
-  char *name;
-  struct xtable *nxt;
+/**
+ * The options a walk is run with: which entries it lists and in what order,
+ * the fields shown for them and the listing calls that show them.  tree's own
+ * walk uses opts (tree.c); libtree gives each walk its own, so that walks with
+ * different options can run at the same time.  The walk is handed its options
+ * from read_dir() and mkinfo() on up to listdir() and the listing calls.
+ */
+struct walkopts {
+  int level;			/* -L, less one, or -1 */
+  bool aflag, dflag, lflag, xdev;
+  bool gitignore, ignorecase, matchdirs, reverse;
+  int pattern, ipattern;	/* Number of -P and -I patterns */
+  char **patterns, **ipatterns;	/* NULL terminated */
+  int (*basesort)();
+  int (*topsort)();
+  /* The fields shown, compiled into the lists below by fields_compile(): */
+  bool inodeflag, devflag, pflag, uflag, gflag, sflag, Dflag;
+  field_t infofields[MAXFIELDS], jsonfields[MAXFIELDS], xmlfields[MAXFIELDS];
+  struct listingcalls lc;
+  _Atomic int *errors;		/* Counts what couldn't be listed */
 };
+
+
+/* hash.c */
+enum { PRELOAD_NONE, PRELOAD_NSS, PRELOAD_NSS_COMPLETE, PRELOAD_FILES };
 struct inotable {
   ino_t inode;
   dev_t device;
@@ -185,16 +242,27 @@ struct infofile {
   struct infofile *next;
 };
 
+/* --serve: An entry in the index, as read_dir() would have found it: */
+struct servent {
+  char *name, *lnk;
+  struct stat lst, st;
+  int rs;
+};
+
 
 /* Function prototypes: */
 /* tree.c */
+char *long_arg(char *argv[], int i, int *j, int *n, char *prefix);
 void setoutput(char *filename);
 void usage(int);
-void push_files(char *dir, struct ignorefile **ig, struct infofile **inf);
-int patignore(char *name, int isdir);
-int patinclude(char *name, int isdir);
-struct _info **unix_getfulltree(char *d, u_long lev, dev_t dev, off_t *size, char **err);
-struct _info **read_dir(char *dir, int *n, int infotop);
+void push_files(struct walkopts *w, char *dir, struct ignorefile **ig, struct infofile **inf);
+int patignore(struct walkopts *w, char *name, int isdir);
+int patinclude(struct walkopts *w, char *name, int isdir);
+struct _info **unix_getfulltree(struct walkopts *w, char *d, u_long lev, dev_t dev, off_t *size, char **err);
+struct _info **read_dir(struct walkopts *w, char *dir, int *n, int infotop);
+void walk_release(void);
+int filelimit_count(struct walkopts *w, char *dir);
+char *filelimit_msg(char *buf, int n);
 
 int filesfirst(struct _info **, struct _info **);
 int dirsfirst(struct _info **, struct _info **);
@@ -205,10 +273,11 @@ int mtimesort(struct _info **, struct _info **);
 int ctimesort(struct _info **, struct _info **);
 int sizecmp(off_t a, off_t b);
 int fsizesort(struct _info **a, struct _info **b);
+void sortdir(struct walkopts *w, struct _info **dir, int n, int (*cmp)());
 
 void *xmalloc(size_t), *xrealloc(void *, size_t);
 char *gnu_getcwd();
-int patmatch(char *, char *, int);
+int patmatch(char *, char *, int, bool);
 void indent(int maxlevel);
 void free_dir(struct _info **);
 #ifdef __EMX__
@@ -221,54 +290,55 @@ void printit(char *);
 int psize(char *buf, off_t size);
 char Ftype(mode_t mode);
 struct _info *stat2info(struct stat *st);
-char *fillinfo(char *buf, struct _info *ent);
 
 /* list.c */
 void null_intro(void);
 void null_outtro(void);
 void null_close(struct _info *file, int level, int needcomma);
-void emit_tree(char **dirname, bool needfulltree);
-struct totals listdir(char *dirname, struct _info **dir, int lev, dev_t dev, bool hasfulltree);
+void emit_tree(struct walkopts *w, char **dirname, bool needfulltree);
+struct totals listdir(struct walkopts *w, char *dirname, struct _info **dir, int lev, dev_t dev, bool hasfulltree);
 
 /* unix.c */
-int unix_printinfo(char *dirname, struct _info *file, int level);
-int unix_printfile(char *dirname, char *filename, struct _info *file, int descend);
+int unix_printinfo(struct walkopts *w, char *dirname, struct _info *file, int level);
+void unix_compile(void);
+int unix_printfile(struct walkopts *w, char *dirname, char *filename, struct _info *file, int descend);
 int unix_error(char *error);
 void unix_newline(struct _info *file, int level, int postdir, int needcomma);
-void unix_report(struct totals tot);
+void unix_report(struct walkopts *w, struct totals tot);
 
 /* html.c */
 void html_intro(void);
 void html_outtro(void);
-int html_printinfo(char *dirname, struct _info *file, int level);
-int html_printfile(char *dirname, char *filename, struct _info *file, int descend);
+void html_stylesheet(char *dir);
+int html_printinfo(struct walkopts *w, char *dirname, struct _info *file, int level);
+int html_printfile(struct walkopts *w, char *dirname, char *filename, struct _info *file, int descend);
 int html_error(char *error);
 void html_newline(struct _info *file, int level, int postdir, int needcomma);
 void html_close(struct _info *file, int level, int needcomma);
-void html_report(struct totals tot);
+void html_report(struct walkopts *w, struct totals tot);
 void html_encode(FILE *fd, char *s);
 
 /* xml.c */
 void xml_intro(void);
 void xml_outtro(void);
-int xml_printinfo(char *dirname, struct _info *file, int level);
-int xml_printfile(char *dirname, char *filename, struct _info *file, int descend);
+int xml_printinfo(struct walkopts *w, char *dirname, struct _info *file, int level);
+int xml_printfile(struct walkopts *w, char *dirname, char *filename, struct _info *file, int descend);
 int xml_error(char *error);
 void xml_newline(struct _info *file, int level, int postdir, int needcomma);
 void xml_close(struct _info *file, int level, int needcomma);
-void xml_report(struct totals tot);
+void xml_report(struct walkopts *w, struct totals tot);
 
 /* json.c */
+void json_encode(FILE *fd, char *s);
 void json_indent(int maxlevel);
-void json_fillinfo(struct _info *ent);
 void json_intro(void);
 void json_outtro(void);
-int json_printinfo(char *dirname, struct _info *file, int level);
-int json_printfile(char *dirname, char *filename, struct _info *file, int descend);
+int json_printinfo(struct walkopts *w, char *dirname, struct _info *file, int level);
+int json_printfile(struct walkopts *w, char *dirname, char *filename, struct _info *file, int descend);
 int json_error(char *error);
 void json_newline(struct _info *file, int level, int postdir, int needcomma);
 void json_close(struct _info *file, int level, int needcomma);
-void json_report(struct totals tot);
+void json_report(struct walkopts *w, struct totals tot);
 
 /* color.c */
 void parse_dir_colors();
@@ -280,16 +350,19 @@ void initlinedraw(int);
 /* hash.c */
 char *uidtoname(uid_t uid);
 char *gidtoname(gid_t gid);
+void preload_ids(int mode);
 int findino(ino_t, dev_t);
+void free_inotable(void);
 void saveino(ino_t, dev_t);
+void inotable_partition(bool own);
 
 /* file.c */
-struct _info **file_getfulltree(char *d, u_long lev, dev_t dev, off_t *size, char **err);
+struct _info **file_getfulltree(struct walkopts *w, char *d, u_long lev, dev_t dev, off_t *size, char **err);
 
 /* filter.c */
 void gittrim(char *s);
 struct pattern *new_pattern(char *pattern);
-int filtercheck(char *path, char *name, int isdir);
+int filtercheck(struct walkopts *w, char *path, char *name, int isdir);
 struct ignorefile *new_ignorefile(char *path);
 void push_filterstack(struct ignorefile *ig);
 struct ignorefile *pop_filterstack(void);
@@ -298,9 +371,107 @@ struct ignorefile *pop_filterstack(void);
 struct infofile *new_infofile(char *path);
 void push_infostack(struct infofile *inf);
 struct infofile *pop_infostack(void);
-struct comment *infocheck(char *path, char *name, int top, int isdir);
+struct comment *infocheck(struct walkopts *w, char *path, char *name, int top, int isdir);
 void printcomment(int line, int lines, char *s);
 
+/* diff.c */
+void diff_load(char *filename);
+void diff_freeent(struct _info *ent);
+void diff_free(struct _info **d);
+struct _info **diff_getfulltree(struct walkopts *w, char *d, u_long lev, dev_t dev, off_t *size, char **err);
+int pdelta(char *buf, off_t delta);
+char *diffname(int diff);
+
+/* stats.c */
+void stats_start(void);
+int stats_enter(int p);
+void stats_leave(int prev);
+void stats_print(FILE *fp);
+void stats_json(void);
+void stats_xml(void);
+void stats_finish(void);
+
+/* profile.c */
+double profile_now(void);
+void profile_dir(char *path, double open, double read, double stat, u_long entries);
+int profile_last(void);
+void profile_annotate(int prof);
+void profile_print(FILE *fp);
+void profile_json(void);
+void profile_xml(void);
+void profile_finish(void);
+
+/* du.c */
+void du_root(dev_t dev);
+off_t du_size(char *path);
+void du_counts(u_long *files, u_long *dirs);
+off_t du_entry(int dirfd, char *name, char *path);
+void du_finish(void);
+
+/* writer.c */
+void writer_start(char *filename);
+bool writer_finish(void);
+
+/* compress.c */
+void compress_start(char *filename);
+bool compress_finish(void);
+
+/* site.c */
+void site_page(struct walkopts *w, char *path, struct _info *ent, int lev);
+void site_finish(void);
+
+/* pred.c */
+bool pred_option(char *argv[], int i, int *j, int *n);
+void pred_compile(void);
+bool pred_match(struct stat *st);
+
+/* io.c */
+void io_dev(dev_t dev, int dfd, char *name);
+int io_threads(void);
+double io_begin(void);
+void io_end(double t0);
+int io_acquire(void);
+void io_release(int cls);
+
+/* summary.c */
+void summary_entry(char *dirname, struct _info *ent, off_t total);
+void summary_print(FILE *fp, bool html);
+void summary_json(void);
+void summary_xml(void);
+
+/* sample.c */
+off_t sample_dir(char *path);
+struct totals sample_totals(struct totals tot);
+void sample_print(FILE *fp);
+void sample_json(void);
+void sample_xml(void);
+
+/* serve.c */
+int serve_run(char *sock, char **roots, int (*query)(int, char **));
+int serve_query(char *sock, int argc, char **argv);
+struct servent *serve_lookup(char *dir, int *n);
+bool serve_local(void);
+struct servent *serve_add(char *path, int *n, dev_t *dev);
+bool serve_missing(char *dir);
+
+/* progress.c */
+void progress_dir(char *path, u_long files, off_t bytes);
+void progress_read(char *path, struct _info **dl, int n);
+void progress_queue(long n);
+void progress_start(char **roots);
+void progress_finish(void);
+
+/* deadline.c */
+void deadline_start(char **roots);
+bool deadline_cut(char *path);
+bool deadline_refine(void);
+
+/* fields.c */
+void fields_compile(struct walkopts *w);
+char *fillinfo(struct walkopts *w, char *buf, struct _info *ent);
+void json_fillinfo(struct walkopts *w, struct _info *ent);
+void xml_fillinfo(struct walkopts *w, struct _info *ent);
+
 /* list.c */
 void new_emit_unix(char **dirname, bool needfulltree);
 
@@ -18,17 +18,20 @@
  */
 #include "tree.h"
 
-extern FILE *outfile;
-extern bool dflag, Fflag, duflag, metafirst, hflag, siflag, noindent;
+extern _Thread_local FILE *outfile;
+extern double samplerate;
+extern int deadline;
+extern u_long unscanned;
+extern bool Fflag, duflag, metafirst, hflag, siflag, noindent, profannotate, summaryflag;
 extern bool colorize, linktargetcolor;
 extern const struct linedraw *linedraw;
-extern int *dirs;
+extern _Thread_local int *dirs;
 
-static char info[512] = {0};
+static _Thread_local char info[512] = {0};
 
-int unix_printinfo(char *dirname, struct _info *file, int level)
+int unix_printinfo(struct walkopts *w, char *dirname, struct _info *file, int level)
 {
-  fillinfo(info, file);
+  fillinfo(w, info, file);
   if (metafirst) {
     if (info[0] == '[') fprintf(outfile, "%s  ",info);
     if (!noindent) indent(level);
@@ -39,34 +42,116 @@ int unix_printinfo(char *dirname, struct _info *file, int level)
   return 0;
 }
 
-int unix_printfile(char *dirname, char *filename, struct _info *file, int descend)
+/**
+ * The name and what follows it (-F's type, a link's target, --profile-dirs
+ * annotations, --deadline's mark) are written by a list of writers that
+ * unix_compile() picks once from the options, like the [...] fields in
+ * fields.c, so the per-entry path doesn't test -C, -F and the rest.  What a
+ * symbolic link adds is a list of its own, run only for links.  The lists
+ * start out as tree's defaults, for callers that never compile them.
+ */
+typedef void (*namewriter_t)(char *filename, struct _info *file);
+
+static void w_name(char *filename, struct _info *file)
 {
-  int colored = FALSE, c;
+  printit(filename);
+}
 
-  if (file && colorize) {
-    if (file->lnk && linktargetcolor) colored = color(file->lnkmode,file->name,file->orphan,FALSE);
-    else colored = color(file->mode,file->name,file->orphan,FALSE);
-  }
+static void w_colorname(char *filename, struct _info *file)
+{
+  int colored = color(file->mode,file->name,file->orphan,FALSE);
 
   printit(filename);
+  if (colored) endcolor();
+}
+
+/* --color-links (ln=target): a link is colored as what it points to: */
+static void w_targetcolorname(char *filename, struct _info *file)
+{
+  int colored = color(file->lnk? file->lnkmode : file->mode,file->name,file->orphan,FALSE);
 
+  printit(filename);
   if (colored) endcolor();
+}
 
-  if (file) {
-    if (Fflag && !file->lnk) {
-      if ((c = Ftype(file->mode))) fputc(c, outfile);
-    }
+static void w_ftype(char *filename, struct _info *file)
+{
+  int c;
 
-    if (file->lnk) {
-      fprintf(outfile," -> ");
-      if (colorize) colored = color(file->lnkmode,file->lnk,file->orphan,TRUE);
-      printit(file->lnk);
-      if (colored) endcolor();
-      if (Fflag) {
-	if ((c = Ftype(file->lnkmode))) fputc(c, outfile);
-      }
-    }
-  }
+  if (!file->lnk && (c = Ftype(file->mode))) fputc(c, outfile);
+}
+
+static void l_target(char *filename, struct _info *file)
+{
+  fputs(" -> ", outfile);
+  printit(file->lnk);
+}
+
+static void l_colortarget(char *filename, struct _info *file)
+{
+  int colored;
+
+  fputs(" -> ", outfile);
+  colored = color(file->lnkmode,file->lnk,file->orphan,TRUE);
+  printit(file->lnk);
+  if (colored) endcolor();
+}
+
+static void l_ftype(char *filename, struct _info *file)
+{
+  int c;
+
+  if ((c = Ftype(file->lnkmode))) fputc(c, outfile);
+}
+
+static namewriter_t linkwriters[3] = { l_target, NULL };
+
+static void w_link(char *filename, struct _info *file)
+{
+  namewriter_t *w;
+
+  if (file->lnk)
+    for(w = linkwriters; *w; w++) (*w)(filename, file);
+}
+
+static void w_annotate(char *filename, struct _info *file)
+{
+  if (file->prof) profile_annotate(file->prof);
+}
+
+static void w_truncated(char *filename, struct _info *file)
+{
+  if (file->truncated) fputs("  [not scanned]", outfile);
+}
+
+static namewriter_t namewriters[6] = { w_name, w_link, NULL };
+
+/**
+ * Builds the name writer lists from the options, once they're all read.
+ */
+void unix_compile(void)
+{
+  int n = 0, l = 0;
+
+  if (!colorize) namewriters[n++] = w_name;
+  else namewriters[n++] = linktargetcolor? w_targetcolorname : w_colorname;
+  if (Fflag) namewriters[n++] = w_ftype;
+  namewriters[n++] = w_link;
+  if (profannotate) namewriters[n++] = w_annotate;
+  if (deadline) namewriters[n++] = w_truncated;
+  namewriters[n] = NULL;
+
+  linkwriters[l++] = colorize? l_colortarget : l_target;
+  if (Fflag) linkwriters[l++] = l_ftype;
+  linkwriters[l] = NULL;
+}
+
+int unix_printfile(struct walkopts *w, char *dirname, char *filename, struct _info *file, int descend)
+{
+  namewriter_t *nw;
+
+  if (file == NULL) printit(filename);
+  else for(nw = namewriters; *nw; nw++) (*nw)(filename, file);
   return 0;
 }
 
@@ -87,7 +172,7 @@ void unix_newline(struct _info *file, int level, int postdir, int needcomma)
     dirs[level+1] = 1;
     for(line = 0; line < lines; line++) {
       if (metafirst) {
-	printf("%*s", infosize, "");
+	fprintf(outfile, "%*s", infosize, "");
       }
       indent(level);
       printcomment(line, lines, file->comment[line]);
@@ -96,17 +181,21 @@ void unix_newline(struct _info *file, int level, int postdir, int needcomma)
   }
 }
 
-void unix_report(struct totals tot)
+void unix_report(struct walkopts *w, struct totals tot)
 {
   char buf[256];
 
+  if (samplerate) tot = sample_totals(tot);
   fputc('\n', outfile);
   if (duflag) {
     psize(buf, tot.size);
     fprintf(outfile,"%s%s used in ", buf, hflag || siflag? "" : " bytes");
   }
-  if (dflag)
+  if (w->dflag)
     fprintf(outfile,"%ld director%s\n",tot.dirs,(tot.dirs==1? "y":"ies"));
   else
     fprintf(outfile,"%ld director%s, %ld file%s\n",tot.dirs,(tot.dirs==1? "y":"ies"),tot.files,(tot.files==1? "":"s"));
+  if (samplerate) sample_print(outfile);
+  if (deadline && unscanned) fprintf(outfile,"(%lu director%s not scanned by the deadline)\n", unscanned, unscanned==1? "y":"ies");
+  if (summaryflag) summary_print(outfile, FALSE);
 }
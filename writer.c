@@ -0,0 +1,225 @@
+/* $Copyright: $
+ * Copyright (c) 1996 - 2022 by Steve Baker (ice@mama.indstate.edu)
+ * All Rights reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "tree.h"
+
+#include <fcntl.h>
+
+extern _Thread_local FILE *outfile;
+
+/**
+ * --async-write: outfile is replaced by a stream that fills one of two
+ * buffers while a writer thread drains the other to the real output, so a
+ * slow pipe or file system only holds up the walk once both buffers are full.
+ * When the output is a regular file (-o) it is written with O_DIRECT if the
+ * file system allows it, which needs the buffers and every write but the last
+ * to be block aligned.  A write error stops the writer; any further output
+ * fails and the error is reported when tree finishes.
+ */
+#define WRITE_BUFS	2
+#define WRITE_ALIGN	4096
+
+size_t writebufsize = 1024 * 1024;
+
+struct writebuf {
+  char *data;
+  size_t len;
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t filled, drained;
+  pthread_t thread;
+  struct writebuf buf[WRITE_BUFS];
+  int fill, drain, queued;	/* buffer being filled, next to drain, # waiting */
+  int fd, err;
+  bool direct, done;
+  FILE *realout;
+} wr = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static int failed = 0;	/* wr.err as last seen by the walk */
+
+/**
+ * Writes all of buf, dropping O_DIRECT for a short tail or if the file
+ * system refuses it after all.  Returns 0 or an errno.
+ */
+static int writeall(char *buf, size_t len)
+{
+  ssize_t n;
+
+  if (wr.direct && len % WRITE_ALIGN) {
+    fcntl(wr.fd, F_SETFL, fcntl(wr.fd, F_GETFL) & ~O_DIRECT);
+    wr.direct = FALSE;
+  }
+  while (len) {
+    if ((n = write(wr.fd, buf, len)) < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EINVAL && wr.direct) {
+	fcntl(wr.fd, F_SETFL, fcntl(wr.fd, F_GETFL) & ~O_DIRECT);
+	wr.direct = FALSE;
+	continue;
+      }
+      return errno;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static void *writer(void *arg)
+{
+  struct writebuf *b;
+  int err;
+
+  pthread_mutex_lock(&wr.lock);
+  for(;;) {
+    while (!wr.queued && !wr.done) pthread_cond_wait(&wr.filled, &wr.lock);
+    if (!wr.queued) break;
+    b = &wr.buf[wr.drain];
+    pthread_mutex_unlock(&wr.lock);
+
+    TREE_PROBE1(write_entry, b->len);
+    err = wr.err? 0 : writeall(b->data, b->len);
+    TREE_PROBE2(write_return, b->len, err);
+
+    pthread_mutex_lock(&wr.lock);
+    if (err) wr.err = err;
+    b->len = 0;
+    wr.drain = (wr.drain + 1) % WRITE_BUFS;
+    wr.queued--;
+    pthread_cond_signal(&wr.drained);
+  }
+  pthread_mutex_unlock(&wr.lock);
+  return NULL;
+}
+
+/**
+ * Hands the buffer being filled to the writer and waits for a free one.
+ */
+static int handoff(void)
+{
+  int err;
+
+  pthread_mutex_lock(&wr.lock);
+  wr.queued++;
+  pthread_cond_signal(&wr.filled);
+  wr.fill = (wr.fill + 1) % WRITE_BUFS;
+  while (wr.queued == WRITE_BUFS) pthread_cond_wait(&wr.drained, &wr.lock);
+  err = wr.err;
+  pthread_mutex_unlock(&wr.lock);
+  return err;
+}
+
+#ifdef __linux__
+static ssize_t writer_write(void *cookie, const char *buf, size_t size)
+{
+  struct writebuf *b;
+  size_t n, left = size;
+
+  while (left) {
+    if (failed) {
+      errno = failed;
+      return -1;
+    }
+    b = &wr.buf[wr.fill];
+    n = writebufsize - b->len;
+    if (n > left) n = left;
+    memcpy(b->data + b->len, buf, n);
+    b->len += n;
+    buf += n;
+    left -= n;
+    if (b->len == writebufsize) failed = handoff();
+  }
+  return size;
+}
+#endif
+
+/**
+ * Interposes the buffers and starts the writer thread.  filename is the -o
+ * file, if any, which is reopened with O_DIRECT.
+ */
+void writer_start(char *filename)
+{
+#ifdef __linux__
+  struct stat st;
+  FILE *fp;
+  int i;
+
+  writebufsize = (writebufsize + WRITE_ALIGN-1) & ~(size_t)(WRITE_ALIGN-1);
+  for(i=0; i < WRITE_BUFS; i++) {
+    if (posix_memalign((void **)&wr.buf[i].data, WRITE_ALIGN, writebufsize)) {
+      fprintf(stderr,"tree: virtual memory exhausted.\n");
+      exit(1);
+    }
+    wr.buf[i].len = 0;
+  }
+
+  fflush(outfile);
+  wr.fd = -1;
+  if (filename && fstat(fileno(outfile), &st) == 0 && S_ISREG(st.st_mode)) {
+    wr.fd = open(filename, O_WRONLY | O_DIRECT);
+    wr.direct = (wr.fd >= 0);
+  }
+  if (wr.fd < 0) wr.fd = fileno(outfile);
+
+  fp = fopencookie(NULL, "w", (cookie_io_functions_t){ NULL, writer_write, NULL, NULL });
+  if (fp == NULL || pthread_create(&wr.thread, NULL, writer, NULL)) {
+    fprintf(stderr,"tree: unable to start the output writer, writing synchronously.\n");
+    if (fp) fclose(fp);
+    if (wr.direct) close(wr.fd);
+    return;
+  }
+  setvbuf(fp, NULL, _IOFBF, BUFSIZ);
+  wr.realout = outfile;
+  outfile = fp;
+#endif
+}
+
+/**
+ * Flushes the last buffer, waits for the writer and puts outfile back.
+ * Returns FALSE if any of the output could not be written.
+ */
+bool writer_finish(void)
+{
+  int i;
+
+  if (wr.realout == NULL) return TRUE;
+  fclose(outfile);
+  outfile = wr.realout;
+  wr.realout = NULL;
+
+  pthread_mutex_lock(&wr.lock);
+  if (wr.buf[wr.fill].len) {
+    wr.queued++;
+    wr.fill = (wr.fill + 1) % WRITE_BUFS;
+  }
+  wr.done = TRUE;
+  pthread_cond_signal(&wr.filled);
+  pthread_mutex_unlock(&wr.lock);
+  pthread_join(wr.thread, NULL);
+
+  if (wr.direct) close(wr.fd);
+  for(i=0; i < WRITE_BUFS; i++) free(wr.buf[i].data);
+
+  if (wr.err) {
+    fprintf(stderr,"tree: error writing output: %s\n", strerror(wr.err));
+    return FALSE;
+  }
+  return TRUE;
+}
@@ -18,21 +18,21 @@
  */
 #include "tree.h"
 
-extern bool dflag, lflag, pflag, sflag, Fflag, aflag, fflag, uflag, gflag;
-extern bool Dflag, inodeflag, devflag, Rflag, cflag, duflag, siflag;
-extern bool noindent, force_color, xdev, nolinks, flimit, noreport;
+extern bool Fflag, fflag, Rflag, cflag, duflag, siflag;
+extern double samplerate;
+extern int deadline;
+extern u_long unscanned;
+extern bool noindent, force_color, nolinks, noreport, statsflag, profdirs, summaryflag;
 extern const char *charset;
 
 extern const int ifmt[];
 extern const char fmt[], *ftype[];
 
-extern FILE *outfile;
-extern int Level, *dirs, maxdirs, errors;
+extern _Thread_local FILE *outfile;
+extern _Thread_local int *dirs, maxdirs;
 
 extern char *endcode;
 
-extern struct listingcalls lc;
-
 /*
 <tree>
   <directory name="name" mode=0777 size=### user="user" group="group" inode=### dev=### time="00:00 00-00-0000">
@@ -65,25 +65,6 @@ void xml_indent(int maxlevel)
     fprintf(outfile, "  ");
 }
 
-void xml_fillinfo(struct _info *ent)
-{
-  #ifdef __USE_FILE_OFFSET64
-  if (inodeflag) fprintf(outfile," inode=\"%lld\"",(long long)ent->inode);
-  #else
-  if (inodeflag) fprintf(outfile," inode=\"%ld\"",(long int)ent->inode);
-  #endif
-  if (devflag) fprintf(outfile, " dev=\"%d\"", (int)ent->dev);
-  #ifdef __EMX__
-  if (pflag) fprintf(outfile, " mode=\"%04o\" prot=\"%s\"",ent->attr, prot(ent->attr));
-  #else
-  if (pflag) fprintf(outfile, " mode=\"%04o\" prot=\"%s\"", ent->mode & (S_IRWXU|S_IRWXG|S_IRWXO|S_ISUID|S_ISGID|S_ISVTX), prot(ent->mode));
-  #endif
-  if (uflag) fprintf(outfile, " user=\"%s\"", uidtoname(ent->uid));
-  if (gflag) fprintf(outfile, " group=\"%s\"", gidtoname(ent->gid));
-  if (sflag) fprintf(outfile, " size=\"%lld\"", (long long int)(ent->size));
-  if (Dflag) fprintf(outfile, " time=\"%s\"", do_date(cflag? ent->ctime : ent->mtime));
-}
-
 void xml_intro(void)
 {
   extern char *_nl;
@@ -98,7 +79,7 @@ void xml_outtro(void)
   fprintf(outfile,"</tree>\n");
 }
 
-int xml_printinfo(char *dirname, struct _info *file, int level)
+int xml_printinfo(struct walkopts *w, char *dirname, struct _info *file, int level)
 {
   mode_t mt;
   int t;
@@ -115,7 +96,7 @@ int xml_printinfo(char *dirname, struct _info *file, int level)
   return 0;
 }
 
-int xml_printfile(char *dirname, char *filename, struct _info *file, int descend)
+int xml_printfile(struct walkopts *w, char *dirname, char *filename, struct _info *file, int descend)
 {
   fprintf(outfile, " name=\"");
   html_encode(outfile, filename);
@@ -135,7 +116,7 @@ int xml_printfile(char *dirname, char *filename, struct _info *file, int descend
     html_encode(outfile,file->lnk);
     fputc('"',outfile);
   }
-  if (file) xml_fillinfo(file);
+  if (file) xml_fillinfo(w, file);
   fputc('>',outfile);
 
   return 1;
@@ -160,13 +141,19 @@ void xml_close(struct _info *file, int level, int needcomma)
 }
 
 
-void xml_report(struct totals tot)
+void xml_report(struct walkopts *w, struct totals tot)
 {
   extern char *_nl;
 
+  if (samplerate) tot = sample_totals(tot);
   fprintf(outfile,"%s<report>%s",noindent?"":"  ", _nl);
   if (duflag) fprintf(outfile,"%s<size>%lld</size>%s", noindent?"":"    ", (long long int)tot.size, _nl);
   fprintf(outfile,"%s<directories>%ld</directories>%s", noindent?"":"    ", tot.dirs, _nl);
-  if (!dflag) fprintf(outfile,"%s<files>%ld</files>%s", noindent?"":"    ", tot.files, _nl);
+  if (!w->dflag) fprintf(outfile,"%s<files>%ld</files>%s", noindent?"":"    ", tot.files, _nl);
+  if (samplerate) sample_xml();
+  if (deadline) fprintf(outfile,"%s<truncated>%lu</truncated>%s", noindent?"":"    ", unscanned, _nl);
   fprintf(outfile,"%s</report>%s",noindent?"":"  ", _nl);
+  if (summaryflag) summary_xml();
+  if (statsflag) stats_xml();
+  if (profdirs) profile_xml();
 }